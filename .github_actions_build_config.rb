@@ -82,6 +82,16 @@ end
 MRuby::Build.new('yabm-dummy') do |conf|
   cc.defines << %w(MRB_NO_FLOAT)
   cc.defines << %w(YABM_DUMMY)
+  conf.gem :core => 'mruby-bin-mruby'
   conf.gem '../'
   conf.gem :github => 'yamori813/mruby-simplehttp'
+  conf.enable_test
+end
+
+MRuby::Build.new('yabm-dummy-min') do |conf|
+  cc.defines << %w(MRB_NO_FLOAT)
+  cc.defines << %w(YABM_DUMMY YABM_NO_HTTPS YABM_NO_HTTPSVR YABM_NO_I2C)
+  cc.defines << %w(YABM_NO_MIB YABM_NO_MDIO)
+  conf.gem :core => 'mruby-bin-mruby'
+  conf.gem '../'
 end
@@ -0,0 +1,332 @@
+#
+# bench_yabm.rb - native path benchmarks for the yabm-dummy build
+#
+#   bench/run.sh path/to/build/yabm-dummy/bin/mruby
+#
+# Prints one JSON object per line.  ARGV[0] is the port of the stand-in
+# server started by bench/run.sh (bench/server.rb); without it the
+# network benchmarks are skipped.
+#
+
+$yabm = YABM.new
+$server = ARGV[0] ? ARGV[0].to_i : 0
+
+# counters are extra integer fields the benchmark body filled in.
+def report(name, iter, ms, bytes, bits = false, counters = {})
+  ms = 1 if ms == 0
+  line = "{\"bench\":\"#{name}\",\"iter\":#{iter},\"ms\":#{ms}"
+  line += ",\"ops_per_sec\":#{iter * 1000 / ms}"
+  line += ",\"bytes_per_sec\":#{bytes * 1000 / ms}" if bytes > 0
+  line += ",\"bits_per_sec\":#{bytes * 8000 / ms}" if bits
+  counters.each { |k, v| line += ",\"#{k}\":#{v}" }
+  puts line + "}"
+end
+
+def skip(name, why)
+  puts "{\"bench\":\"#{name}\",\"skip\":\"#{why}\"}"
+end
+
+def bench(name, iter, bytes = 0, bits = false, counters = {})
+  start = $yabm.count
+  i = 0
+  while i < iter
+    yield i
+    i += 1
+  end
+  report(name, iter, $yabm.count - start, bytes * iter, bits, counters)
+end
+
+def native?(*names)
+  names.each do |n|
+    return false unless $yabm.respond_to?(n)
+  end
+  true
+end
+
+bench("addr_parse", 20000) do |i|
+  $yabm.netstart("192.168.#{i & 0xff}.105", "255.255.255.0", "192.168.0.1",
+    "192.168.0.1")
+end
+
+$yabm.netstart("10.20.105.7", "255.0.0.0", "10.0.0.1", "10.0.0.1")
+bench("addr_format", 20000) do
+  $yabm.getaddress
+end
+
+nmea = "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n"
+$yabm.uartframe(0, YABM::FRAME_DELIM, 10, 1)
+bench("uart_frame_nmea", 20000, nmea.size) do
+  $yabm.uartinject(0, nmea)
+  $yabm.uartgetframe(0)
+end
+$yabm.uartframe(0, YABM::FRAME_NONE)
+
+bench("uart_read", 20000, nmea.size) do
+  $yabm.uartinject(0, nmea)
+  $yabm.uartread(0)
+end
+
+if YABM.const_defined?(:Buffer)
+  $buf = YABM::Buffer.new
+  bench("uart_read_buf", 20000, nmea.size) do
+    $yabm.uartinject(0, nmea)
+    $yabm.uartread(0, $buf)
+  end
+end
+
+line = "0123456789abcdef" * 4 + "\n"
+$yabm.printbuf(4096, YABM::PRINT_DROP, 1)
+bench("print_buffered", 20000, line.size) do
+  $yabm.print(line, 1)
+end
+$yabm.printbuf(0, YABM::PRINT_DROP, 1)
+
+if $server == 0
+  skip("udp_send", "no server")
+  skip("udp_echo", "no server")
+  skip("http_get", "no server")
+elsif !native?(:udpinit, :udpsend, :udprecv, :http)
+  skip("udp_send", "not implemented")
+  skip("udp_echo", "not implemented")
+  skip("http_get", "not implemented")
+else
+  pkt = "x" * 512
+  $yabm.udpinit
+  $yabm.udpbind($server + 1)
+  bench("udp_send", 20000, pkt.size) do
+    $yabm.udpsend("127.0.0.1", $server + 2, pkt, pkt.size)
+  end
+  echo = { "lost" => 0 }
+  bench("udp_echo", 5000, pkt.size, false, echo) do
+    $yabm.udpsend("127.0.0.1", $server, pkt, pkt.size)
+    n = 0
+    while $yabm.udprecv.size == 0
+      n += 1
+      if n > 100000
+        echo["lost"] += 1
+        break
+      end
+    end
+  end
+  if $buf
+    echo = { "lost" => 0 }
+    bench("udp_echo_buf", 5000, pkt.size, false, echo) do
+      $yabm.udpsend("127.0.0.1", $server, pkt, pkt.size)
+      n = 0
+      while $yabm.udprecv($buf) == 0
+        n += 1
+        if n > 100000
+          echo["lost"] += 1
+          break
+        end
+      end
+    end
+  end
+  req = "GET /4096 HTTP/1.0\r\nHost: 127.0.0.1\r\n\r\n"
+  bench("http_get", 500, 4096) do
+    $yabm.http("127.0.0.1", $server, req, 1000)
+  end
+  if native?(:download)
+    bench("http_download", 20, 262144) do
+      $yabm.download("127.0.0.1", $server, "/262144", nil, 0, 1000)
+    end
+  end
+  if native?(:httpreq)
+    chunk = "x" * 1460
+    bench("http_upload", 100, chunk.size * 64) do
+      $yabm.httpreq("127.0.0.1", $server, "POST /up HTTP/1.0\r\n",
+        chunk.size * 64, 1000) { chunk }
+    end
+    bench("http_upload_chunked", 100, chunk.size * 64) do
+      $yabm.httpreq("127.0.0.1", $server, "POST /up HTTP/1.1\r\n", nil,
+        1000) { |sent| chunk if sent < chunk.size * 64 }
+    end
+  end
+end
+
+if $server == 0
+  skip("mqtt_publish", "no server")
+elsif !native?(:mqttconnect)
+  skip("mqtt_publish", "not implemented")
+elsif $yabm.mqttconnect("127.0.0.1", $server + 1, "bench") != 0
+  skip("mqtt_publish", "no broker")
+else
+  sample = "temp=21.5,hum=40"
+  $yabm.mqttsubscribe("bench/echo", 1)
+  bench("mqtt_publish_q0", 20000, sample.size) do
+    $yabm.mqttpublish("bench/sink", sample)
+  end
+  $yabm.mqttbatch(20)
+  bench("mqtt_publish_batch", 20000, sample.size) do
+    $yabm.mqttpublish("bench/sink", sample)
+  end
+  $yabm.mqttflush(1000)
+  $yabm.mqttbatch(0)
+  bench("mqtt_roundtrip_q1", 2000, sample.size) do
+    $yabm.mqttpublish("bench/echo", sample, 1)
+    $yabm.mqttpoll(1000) {}
+  end
+  $yabm.mqttdisconnect
+end
+
+if native?(:i2csim) && native?(:i2cread, :i2cwrite)
+  $yabm.i2csim(0x76, "\x60" * 256, 0)
+  $yabm.i2cinit(1, 2, 0)
+  bench("i2c_write", 20000, 3) do
+    $yabm.i2cwrite(0x76, 0xf4, 0x27)
+  end
+  # i2cread waits 10 ms between the register write and the read
+  bench("i2c_read8", 200, 8) do
+    $yabm.i2cread(0x76, 8, 0xf7)
+  end
+else
+  skip("i2c_read8", "no simulated device")
+end
+
+bench("gpio_setdat", 100000) do |i|
+  $yabm.gpiosetdat(i & 0xff)
+end
+bench("gpio_getdat", 100000) do
+  $yabm.gpiogetdat
+end
+
+if native?(:crc16, :crc32, :cksum, :hexenc, :b64enc)
+  data = (0..1023).map { |i| ((i * 7) & 0xff).chr }.join
+  bench("crc16_ruby", 20, data.size) do
+    crc = 0xffff
+    data.each_byte do |b|
+      crc ^= b
+      8.times { crc = (crc & 1) == 1 ? (crc >> 1) ^ 0xa001 : crc >> 1 }
+    end
+  end
+  bench("crc16", 5000, data.size) { $yabm.crc16(data) }
+  bench("crc32", 5000, data.size) { $yabm.crc32(data) }
+  bench("cksum", 5000, data.size) { $yabm.cksum(data) }
+  hex = $yabm.hexenc(data)
+  b64 = $yabm.b64enc(data)
+  bench("hexenc", 5000, data.size) { $yabm.hexenc(data) }
+  bench("hexdec", 5000, data.size) { $yabm.hexdec(hex) }
+  bench("b64enc", 5000, data.size) { $yabm.b64enc(data) }
+  bench("b64dec", 5000, data.size) { $yabm.b64dec(b64) }
+else
+  skip("crc16", "not implemented")
+end
+
+if native?(:gpiowatch, :gpiosimin)
+  $yabm.gpiowatch(0xff00, 0, 1)
+  bench("gpio_edge_native", 20000) do |i|
+    $yabm.gpiosimin((i & 1) << 8, 0x100)
+    $yabm.gpiopulses(8)
+  end
+  $yabm.gpioevents
+  $yabm.gpiowatch(0)
+end
+
+if native?(:spiinit, :spixfer)
+  frame = (0..255).map { |i| i.chr }.join
+  $yabm.spiinit(0, 1, 2, 3, 0)
+  bench("spi_xfer_mode0", 200, frame.size, true) do
+    $yabm.spixfer(frame)
+  end
+  $yabm.spiinit(0, 1, 2, 3, 3)
+  bench("spi_write_mode3", 200, frame.size, true) do
+    $yabm.spiwrite(frame)
+  end
+  bench("spi_gpio_ruby", 20, frame.size, true) do
+    frame.each_byte do |b|
+      7.downto(0) do |n|
+        d = b[n] == 1 ? 0x02 : 0
+        $yabm.gpiosetdat(d)
+        $yabm.gpiosetdat(d | 0x01)
+        $yabm.gpiogetdat
+      end
+    end
+  end
+else
+  skip("spi_xfer", "not implemented")
+end
+
+if native?(:mibsim, :getmib)
+  $yabm.mibsim(0, YABM::MIB_IN, 12_500_000, 20_000)
+  bench("mib_read", 100000) do
+    $yabm.getmib(0, YABM::MIB_IN, YABM::MIB_IFINOCTETS)
+  end
+else
+  skip("mib_read", "no simulated switch")
+end
+
+if native?(:mibsim, :mibencode)
+  mibkeys = [[YABM::MIB_IN, YABM::MIB_IFINOCTETS, "in_octets"],
+    [YABM::MIB_IN, YABM::MIB_IFINUCASTPKTS, "in_ucast"],
+    [YABM::MIB_OUT, YABM::MIB_IFOUTOCTETS, "out_octets"],
+    [YABM::MIB_OUT, YABM::MIB_IFOUTUCASTPKTS, "out_ucast"]]
+  bench("mib_line_ruby", 2000) do
+    s = ""
+    5.times do |port|
+      s += "port,host=sw1,port=#{port} "
+      s += mibkeys.map { |d, t, k| "#{k}=#{$yabm.getmib(port, d, t)}i" }.join(",")
+      s += "\n"
+    end
+  end
+  bench("mib_line_native", 2000) do
+    $buf.clear
+    $yabm.mibencode($buf, YABM::TM_LINE, "port", 0x1f, "host=sw1")
+  end
+  $yabm.mibsim(0, YABM::MIB_IN, 0, 0)
+else
+  skip("mib_line", "no simulated switch")
+end
+
+if native?(:regsim, :regrun)
+  base = 0xb8010000
+  $yabm.regsim(base + 0x40, 1)
+  bench("reg_ruby", 5000) do
+    $yabm.regwrite(base, 5)
+    $yabm.regwrite(base + 4, 0x30)
+    $yabm.regwait(base + 0x40, 1, 1, 10)
+    $yabm.regread(base + 8, 8)
+  end
+  script = $yabm.regcompile([[YABM::REG_WRITE, base, 5],
+    [YABM::REG_WRITE, base + 4, 0x30],
+    [YABM::REG_WAIT, base + 0x40, 1, 1, 10]] +
+    (0...8).map { |i| [YABM::REG_READ, base + 8 + i * 4] })
+  bench("reg_script", 5000) do
+    $yabm.regrun(script)
+  end
+else
+  skip("reg_script", "not implemented")
+end
+
+if native?(:bme280, :fxstats)
+  calw = [27504, 26435, -1000, 36477, -10685, 3024, 2855, 140, -7, 15500,
+    -14600, 6000]
+  cal = calw.map { |v| [v & 0xff, (v >> 8) & 0xff] }.flatten
+  cal += [0, 75, 0x6a, 0x01, 0, 0x13, 0x2f, 0x03, 0x1e]
+  raw = [0x65, 0x5a, 0xc0, 0x7e, 0xed, 0x00, 0x6d, 0x60]
+  adc = (0...256).map { |i| (i * 37) & 0xfff }
+  bench("sensor_ruby", 2000) do
+    t1, t2, t3, p1, p2, p3, p4, p5, p6, p7, p8, p9 = calw
+    at = (raw[3] << 12) | (raw[4] << 4) | (raw[5] >> 4)
+    ap = (raw[0] << 12) | (raw[1] << 4) | (raw[2] >> 4)
+    v1 = (((at >> 3) - (t1 << 1)) * t2) >> 11
+    v2 = (((((at >> 4) - t1) * ((at >> 4) - t1)) >> 12) * t3) >> 14
+    fine = v1 + v2
+    v1 = fine - 128000
+    v2 = v1 * v1 * p6 + ((v1 * p5) << 17) + (p4 << 35)
+    v1 = ((v1 * v1 * p3) >> 8) + ((v1 * p2) << 12)
+    v1 = (((1 << 47) + v1) * p1) >> 33
+    pa = (((1048576 - ap) << 31) - v2) * 3125 / v1
+    pa = ((pa + ((p9 * (pa >> 13) * (pa >> 13)) >> 25) +
+      ((p8 * pa) >> 19)) >> 8) + (p7 << 4)
+    mv = adc.map { |x| (x * 52813 + 32768) >> 16 }
+    s = mv.sort
+    [(fine * 5 + 128) >> 8, pa >> 8, s[0], s[-1],
+      mv.inject(0) { |a, x| a + x } / mv.size, s[230]]
+  end
+  bench("sensor_native", 2000) do
+    mv = $yabm.fxscale(adc, 52813, 16)
+    [$yabm.bme280(cal, raw), $yabm.fxstats(mv), $yabm.fxpercentile(mv, 90)]
+  end
+else
+  skip("sensor_native", "not implemented")
+end
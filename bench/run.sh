@@ -0,0 +1,20 @@
+#!/bin/sh
+#
+# run.sh - run the yabm-dummy benchmarks against local stand-in servers
+#
+#   bench/run.sh [path/to/mruby] [port] > bench_output.txt
+#
+
+MRUBY=${1:-mruby/build/yabm-dummy/bin/mruby}
+PORT=${2:-18080}
+DIR=$(dirname "$0")
+YABM_FLASH=${YABM_FLASH:-${TMPDIR:-/tmp}/yabm_flash_$$.bin}
+YABM_OTA=${YABM_OTA:-${TMPDIR:-/tmp}/yabm_ota_$$.bin}
+export YABM_FLASH YABM_OTA
+
+ruby "$DIR/server.rb" "$PORT" > /dev/null &
+SERVER=$!
+trap 'kill $SERVER 2> /dev/null; rm -f "$YABM_FLASH" "$YABM_OTA"' EXIT INT TERM
+sleep 1
+
+"$MRUBY" "$DIR/bench_yabm.rb" "$PORT" 2> /dev/null
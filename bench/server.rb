@@ -0,0 +1,147 @@
+#!/usr/bin/env ruby
+#
+# server.rb - stand-in servers for bench_yabm.rb
+#
+#   ruby bench/server.rb PORT
+#
+# UDP PORT echoes datagrams, UDP PORT+2 discards them, TCP PORT
+# answers "GET /N" with an N byte body, honouring "Range: bytes=S-",
+# and any other request with the length and SHA-256 of its body, sent
+# with Content-Length or chunked.  TCP PORT+1 is a minimal MQTT 3.1.1 broker: QoS 0/1, exact topic
+# match, no retained messages.
+#
+# See Copyright Notice in LICENSE
+
+require 'socket'
+require 'digest'
+
+port = Integer(ARGV[0] || 18080)
+
+echo = UDPSocket.new
+echo.bind('127.0.0.1', port)
+Thread.new do
+  loop do
+    data, from = echo.recvfrom(65536)
+    echo.send(data, 0, from[3], from[1])
+  end
+end
+
+sink = UDPSocket.new
+sink.bind('127.0.0.1', port + 2)
+Thread.new do
+  loop { sink.recvfrom(65536) }
+end
+
+def mqtt_read(c)
+  hdr = c.read(1) or return nil
+  len = 0
+  shift = 0
+  loop do
+    b = c.read(1).ord
+    len |= (b & 0x7f) << shift
+    shift += 7
+    break if b & 0x80 == 0
+  end
+  [hdr.ord, len > 0 ? c.read(len) : '']
+end
+
+def mqtt_packet(type, body)
+  len = body.bytesize
+  hdr = type.chr
+  loop do
+    b = len & 0x7f
+    len >>= 7
+    hdr << (len > 0 ? b | 0x80 : b).chr
+    break if len == 0
+  end
+  hdr.b + body.b
+end
+
+subs = Hash.new { |h, k| h[k] = [] }
+lock = Mutex.new
+broker = TCPServer.new('127.0.0.1', port + 1)
+Thread.new do
+  loop do
+    Thread.new(broker.accept) do |c|
+      mine = []
+      while (pkt = mqtt_read(c))
+        type, body = pkt
+        case type >> 4
+        when 1
+          c.write mqtt_packet(0x20, "\0\0")
+        when 3
+          tlen = body.unpack1('n')
+          topic = body.byteslice(2, tlen)
+          off = 2 + tlen
+          if (type >> 1) & 3 > 0
+            c.write mqtt_packet(0x40, body.byteslice(off, 2))
+            off += 2
+          end
+          out = mqtt_packet(0x30, [tlen].pack('n') + topic + body.byteslice(off..-1))
+          lock.synchronize { subs[topic].dup }.each { |s| s.write(out) rescue nil }
+        when 8
+          tlen = body.byteslice(2, 2).unpack1('n')
+          topic = body.byteslice(4, tlen)
+          lock.synchronize { subs[topic] << c }
+          mine << topic
+          c.write mqtt_packet(0x90, body.byteslice(0, 2) + "\0")
+        when 12
+          c.write mqtt_packet(0xd0, '')
+        when 14
+          break
+        end
+      end
+      lock.synchronize { mine.each { |t| subs[t].delete(c) } }
+      c.close
+    end
+  end
+end
+
+# Bodies repeat a 251 byte pattern so a misplaced resume shows up.
+PATTERN = (0...251).map(&:chr).join.b
+
+http = TCPServer.new('127.0.0.1', port)
+$stdout.puts "ready #{port}"
+$stdout.flush
+loop do
+  client = http.accept
+  Thread.new(client) do |c|
+    req = c.gets.to_s
+    from = nil
+    len = 0
+    chunked = false
+    while (l = c.gets) && l != "\r\n"
+      from = $1.to_i if l =~ /\ARange: bytes=(\d+)-/i
+      len = $1.to_i if l =~ /\AContent-Length: (\d+)/i
+      chunked = true if l =~ /\ATransfer-Encoding: chunked/i
+    end
+    unless req.start_with?('GET ')
+      sha = Digest::SHA256.new
+      n = 0
+      while chunked ? (len = c.gets.to_i(16)) > 0 : n < len
+        data = c.read(chunked ? len : [len - n, 65536].min)
+        sha << data
+        n += data.bytesize
+        c.gets if chunked
+      end
+      c.gets if chunked
+      body = "#{n} #{sha.hexdigest}"
+      c.write "HTTP/1.0 200 OK\r\nContent-Length: #{body.size}\r\n" \
+              "Connection: close\r\n\r\n#{body}"
+      c.close
+      next
+    end
+    size = req[%r{\AGET /(\d+)}, 1].to_i
+    body = PATTERN * (size / PATTERN.size + 1)
+    if from && from < size
+      c.write "HTTP/1.0 206 Partial Content\r\n" \
+              "Content-Range: bytes #{from}-#{size - 1}/#{size}\r\n" \
+              "Content-Length: #{size - from}\r\nConnection: close\r\n\r\n"
+      c.write body[from, size - from]
+    else
+      c.write "HTTP/1.0 200 OK\r\nContent-Length: #{size}\r\n" \
+              "Connection: close\r\n\r\n#{body[0, size]}"
+    end
+    c.close
+  end
+end
@@ -9,6 +9,147 @@
 
 void mrb_mruby_yabm_gem_init(mrb_state *mrb);
 
+int mrb_yabm_clock();
+unsigned int mrb_yabm_uclock();
+int mrb_yabm_poll();
+
+#if defined(YABM_STATS)
+void mrb_yabm_stats_define(mrb_state *mrb, struct RClass *c, const char *name,
+  mrb_func_t func, mrb_aspec aspec);
+#define	yabm_define_method	mrb_yabm_stats_define
+#else
+#define	yabm_define_method	mrb_define_method
+#endif
+
+void mrb_yabm_stats_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_stats_final(mrb_state *mrb);
+
+void mrb_yabm_const_init(mrb_state *mrb, struct RClass *yabm, int start);
+void mrb_yabm_wdt_init(mrb_state *mrb, struct RClass *yabm);
+
+void mrb_yabm_trace_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_trace_final(mrb_state *mrb);
+void mrb_yabm_trace(int sub, int op, unsigned int arg, int res);
+
+void mrb_yabm_net_init(mrb_state *mrb, struct RClass *yabm);
+uint32_t mrb_yabm_strtoip(mrb_state *mrb, mrb_value str);
+mrb_value mrb_yabm_iptostr(mrb_state *mrb, uint32_t ip);
+int mrb_yabm_cpaddr(mrb_state *mrb, uint32_t *ip, mrb_value addr);
+
+void mrb_yabm_codec_init(mrb_state *mrb, struct RClass *yabm);
+unsigned short mrb_yabm_crc16(unsigned short crc, const unsigned char *ptr,
+  int len);
+unsigned long mrb_yabm_crc32(unsigned long crc, const unsigned char *ptr,
+  int len);
+unsigned int mrb_yabm_cksum(unsigned int sum, const unsigned char *ptr,
+  int len);
+
+typedef struct {
+  uint32_t state[8];
+  unsigned long long count;
+  unsigned char buf[64];
+} mrb_yabm_sha256;
+
+void mrb_yabm_sha256_init(mrb_yabm_sha256 *ctx);
+void mrb_yabm_sha256_update(mrb_yabm_sha256 *ctx, const unsigned char *ptr,
+  int len);
+void mrb_yabm_sha256_final(mrb_yabm_sha256 *ctx, unsigned char *digest);
+
+void mrb_yabm_uart_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_uart_final(mrb_state *mrb);
+int mrb_yabm_uart_poll();
+
+void mrb_yabm_console_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_console_final(mrb_state *mrb);
+int mrb_yabm_console_poll();
+
+void mrb_yabm_gc_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_gc_final(mrb_state *mrb);
+void mrb_yabm_gc_idle(mrb_state *mrb);
+
+typedef struct {
+  char *ptr;
+  int capa;
+  int fill;
+  int off;
+  int len;
+} mrb_yabm_buffer;
+
+void mrb_yabm_buffer_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_buffer_final(mrb_state *mrb);
+mrb_yabm_buffer *mrb_yabm_buffer_get(mrb_state *mrb, mrb_value val);
+mrb_yabm_buffer *mrb_yabm_buffer_arg(mrb_state *mrb, mrb_value val);
+void mrb_yabm_buffer_set(mrb_yabm_buffer *buf, int len);
+int mrb_yabm_buffer_cat(mrb_yabm_buffer *buf, const char *ptr, int len);
+char *mrb_yabm_bytes(mrb_state *mrb, mrb_value val, mrb_int *len);
+
+typedef struct {
+  mrb_yabm_buffer *buf;
+  int format;
+  int fields;
+  int start;
+  int full;
+} mrb_yabm_tm;
+
+void mrb_yabm_telemetry_init(mrb_state *mrb, struct RClass *yabm);
+mrb_yabm_buffer *mrb_yabm_tm_buffer(mrb_state *mrb, mrb_value val);
+void mrb_yabm_tm_begin(mrb_yabm_tm *tm, mrb_yabm_buffer *buf, int format,
+  const char *name, int namelen, const char *tags, int tagslen);
+void mrb_yabm_tm_tag(mrb_yabm_tm *tm, const char *key, int val);
+void mrb_yabm_tm_field(mrb_yabm_tm *tm, const char *key, long val);
+void mrb_yabm_tm_ufield(mrb_yabm_tm *tm, const char *key, unsigned long val);
+int mrb_yabm_tm_end(mrb_yabm_tm *tm, unsigned long sec, int ms);
+
+void mrb_yabm_mqtt_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_mqtt_final(mrb_state *mrb);
+void mrb_yabm_mqtt_poll();
+
+#if !defined(KV_SECTOR)
+#define	KV_SECTOR		4096
+#endif
+#if !defined(KV_SECTORS)
+#define	KV_SECTORS		4
+#endif
+#define	KV_KEYS			64
+#define	KV_KEYMAX		32
+#define	KV_VALMAX		512
+
+void mrb_yabm_kv_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_kv_final(mrb_state *mrb);
+int mrb_yabm_kv_get(const char *key, int klen, char *buf, int len);
+int mrb_yabm_kv_put(const char *key, int klen, const char *val, int vlen);
+int mrb_yabm_kv_del(const char *key, int klen);
+int mrb_yabm_kv_dnsget(const char *host, uint32_t *addr);
+void mrb_yabm_kv_dnsput(const char *host, uint32_t addr);
+
+#if !defined(OTA_SECTOR)
+#define	OTA_SECTOR		65536
+#endif
+
+void mrb_yabm_download_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_download_final(mrb_state *mrb);
+
+void mrb_yabm_upload_init(mrb_state *mrb, struct RClass *yabm);
+
+void mrb_yabm_i2c_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_gpio_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_gpio_final(mrb_state *mrb);
+int mrb_yabm_gpio_poll();
+void mrb_yabm_spi_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_spi_final(mrb_state *mrb);
+void mrb_yabm_mib_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_mib_final(mrb_state *mrb);
+void mrb_yabm_mib_poll();
+#if defined(YABM_REALTEK) || defined(YABM_DUMMY)
+unsigned long mrb_yabm_mibread(int port, int dir, int type);
+#endif
+void mrb_yabm_mmio_init(mrb_state *mrb, struct RClass *yabm);
+uint32_t mrb_yabm_reg_int(mrb_state *mrb, mrb_value v);
+void mrb_yabm_fixed_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_snmp_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_snmp_final(mrb_state *mrb);
+int mrb_yabm_snmp_poll();
+
 #define	MODULE_UNKNOWN				0
 #define	MODULE_RTL8196C				1
 #define	MODULE_BCM4712				2
@@ -24,6 +165,49 @@ void mrb_mruby_yabm_gem_init(mrb_state *mrb);
 
 #define	MODULE_DUMMY				100
 
+#define	TM_LINE					0
+#define	TM_JSON					1
+
+#define	FRAME_NONE				0
+#define	FRAME_DELIM				1
+#define	FRAME_LENGTH				2
+#define	FRAME_MODBUS				3
+
+#define	PRINT_DROP				0
+#define	PRINT_BLOCK				1
+
+#define	REG_READ				1
+#define	REG_WRITE				2
+#define	REG_MODIFY				3
+#define	REG_WAIT				4
+#define	REG_DELAY				5
+
+#define	TRACE_NET				1
+#define	TRACE_UDP				2
+#define	TRACE_HTTP				3
+#define	TRACE_I2C				4
+#define	TRACE_GPIO				5
+#define	TRACE_MDIO				6
+#define	TRACE_UART				7
+#define	TRACE_MQTT				8
+#define	TRACE_SPI				9
+#define	TRACE_SNMP				10
+
+#define	TRACE_OP_START				1
+#define	TRACE_OP_BIND				2
+#define	TRACE_OP_SEND				3
+#define	TRACE_OP_RECV				4
+#define	TRACE_OP_CONNECT			5
+#define	TRACE_OP_CLOSE				6
+#define	TRACE_OP_READ				7
+#define	TRACE_OP_WRITE				8
+#define	TRACE_OP_LOOKUP				9
+#define	TRACE_OP_SNTP				10
+#define	TRACE_OP_SETDIR				11
+#define	TRACE_OP_SETCTL				12
+#define	TRACE_OP_TIMEOUT			13
+#define	TRACE_OP_PROBE				14
+
 #define	MIB_IN					0x100
 #define	MIB_OUT					0x800
 
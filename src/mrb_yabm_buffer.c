@@ -0,0 +1,386 @@
+/*
+** mrb_yabm_buffer.c - YABM::Buffer, I/O buffers from a fixed slab pool
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <limits.h>
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+#define	BUFFER_DEFSLABS		8
+#define	BUFFER_DEFSIZE		1536
+
+static char *slabs;
+static mrb_yabm_buffer *bufs;
+static int nslabs;
+static int slabsize;
+static int nfree;
+static int minfree;
+
+static void mrb_yabm_buffer_free(mrb_state *mrb, void *ptr)
+{
+  mrb_yabm_buffer *buf = ptr;
+
+  if (buf == NULL || bufs == NULL)
+    return;
+  buf->ptr = NULL;
+  ++nfree;
+}
+
+static const struct mrb_data_type mrb_yabm_buffer_type = {
+  "mrb_yabm_buffer", mrb_yabm_buffer_free,
+};
+
+static void mrb_yabm_buffer_pool(mrb_state *mrb, int count, int size)
+{
+  if (bufs != NULL && nfree != nslabs)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "buffers in use");
+  mrb_free(mrb, slabs);
+  mrb_free(mrb, bufs);
+  slabs = NULL;
+  bufs = NULL;
+  slabs = (char *)mrb_malloc(mrb, count * size);
+  bufs = (mrb_yabm_buffer *)mrb_calloc(mrb, count, sizeof(mrb_yabm_buffer));
+  nslabs = count;
+  slabsize = size;
+  nfree = count;
+  minfree = count;
+}
+
+/* Buffer.pool(count, size) replaces the pool while no buffer is live. */
+static mrb_value mrb_yabm_buffer_setpool(mrb_state *mrb, mrb_value self)
+{
+  mrb_int count, size;
+  mrb_get_args(mrb, "ii", &count, &size);
+
+  if (count < 1 || size < 1 || count > INT_MAX / size)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid buffer pool");
+  mrb_yabm_buffer_pool(mrb, count, size);
+
+  return mrb_fixnum_value(count);
+}
+
+/* Buffer.stat returns [slabs, slab size, free, lowest free] */
+static mrb_value mrb_yabm_buffer_stat(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res;
+
+  res = mrb_ary_new_capa(mrb, 4);
+  mrb_ary_push(mrb, res, mrb_fixnum_value(nslabs));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(slabsize));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(nfree));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(minfree));
+
+  return res;
+}
+
+static int mrb_yabm_buffer_slot()
+{
+  int i;
+
+  for (i = 0; i < nslabs; ++i)
+    if (bufs[i].ptr == NULL)
+      break;
+  return i;
+}
+
+static mrb_value mrb_yabm_buffer_initialize(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_buffer *buf;
+  int i;
+
+  buf = (mrb_yabm_buffer *)DATA_PTR(self);
+  if (buf != NULL)
+    mrb_yabm_buffer_free(mrb, buf);
+  DATA_TYPE(self) = &mrb_yabm_buffer_type;
+  DATA_PTR(self) = NULL;
+
+  if (bufs == NULL)
+    mrb_yabm_buffer_pool(mrb, BUFFER_DEFSLABS, BUFFER_DEFSIZE);
+  i = mrb_yabm_buffer_slot();
+  if (i == nslabs) {
+    /* unreferenced Buffers only return their slab when collected */
+    mrb_full_gc(mrb);
+    i = mrb_yabm_buffer_slot();
+  }
+  if (i == nslabs)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "buffer pool exhausted");
+  buf = &bufs[i];
+  buf->ptr = slabs + i * slabsize;
+  buf->capa = slabsize;
+  buf->fill = 0;
+  buf->off = 0;
+  buf->len = 0;
+  if (--nfree < minfree)
+    minfree = nfree;
+  DATA_PTR(self) = buf;
+
+  return self;
+}
+
+/* NULL when val is not a Buffer; a released Buffer raises. */
+mrb_yabm_buffer *mrb_yabm_buffer_get(mrb_state *mrb, mrb_value val)
+{
+  mrb_yabm_buffer *buf;
+
+  if (mrb_type(val) != MRB_TT_DATA || DATA_TYPE(val) != &mrb_yabm_buffer_type)
+    return NULL;
+  buf = (mrb_yabm_buffer *)DATA_PTR(val);
+  if (buf == NULL)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "buffer released");
+  return buf;
+}
+
+/* Optional destination argument: nil or a Buffer. */
+mrb_yabm_buffer *mrb_yabm_buffer_arg(mrb_state *mrb, mrb_value val)
+{
+  mrb_yabm_buffer *buf;
+
+  if (mrb_nil_p(val))
+    return NULL;
+  buf = mrb_yabm_buffer_get(mrb, val);
+  if (buf == NULL)
+    mrb_raise(mrb, E_TYPE_ERROR, "YABM::Buffer expected");
+  return buf;
+}
+
+static mrb_yabm_buffer *mrb_yabm_buffer_self(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_buffer *buf;
+
+  buf = mrb_yabm_buffer_get(mrb, self);
+  if (buf == NULL)
+    mrb_raise(mrb, E_TYPE_ERROR, "not a buffer");
+  return buf;
+}
+
+/* Bytes to send: a String, or the view of a Buffer. */
+char *mrb_yabm_bytes(mrb_state *mrb, mrb_value val, mrb_int *len)
+{
+  mrb_yabm_buffer *buf;
+
+  buf = mrb_yabm_buffer_get(mrb, val);
+  if (buf != NULL) {
+    *len = buf->len;
+    return buf->ptr + buf->off;
+  }
+  if (!mrb_string_p(val))
+    mrb_raise(mrb, E_TYPE_ERROR, "String or YABM::Buffer expected");
+  *len = RSTRING_LEN(val);
+  return RSTRING_PTR(val);
+}
+
+/* Native fills replace the content and view the whole of it. */
+void mrb_yabm_buffer_set(mrb_yabm_buffer *buf, int len)
+{
+  buf->fill = len;
+  buf->off = 0;
+  buf->len = len;
+}
+
+int mrb_yabm_buffer_cat(mrb_yabm_buffer *buf, const char *ptr, int len)
+{
+  if (len > buf->capa - buf->fill)
+    len = buf->capa - buf->fill;
+  memcpy(buf->ptr + buf->fill, ptr, len);
+  buf->fill += len;
+  buf->len = buf->fill - buf->off;
+  return len;
+}
+
+static mrb_value mrb_yabm_buffer_len(mrb_state *mrb, mrb_value self)
+{
+  return mrb_fixnum_value(mrb_yabm_buffer_self(mrb, self)->len);
+}
+
+static mrb_value mrb_yabm_buffer_capa(mrb_state *mrb, mrb_value self)
+{
+  return mrb_fixnum_value(mrb_yabm_buffer_self(mrb, self)->capa);
+}
+
+static mrb_value mrb_yabm_buffer_offset(mrb_state *mrb, mrb_value self)
+{
+  return mrb_fixnum_value(mrb_yabm_buffer_self(mrb, self)->off);
+}
+
+/* view(off, len = rest) narrows the view to part of the content */
+static mrb_value mrb_yabm_buffer_view(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_buffer *buf;
+  mrb_int off, len = -1;
+  mrb_get_args(mrb, "i|i", &off, &len);
+
+  buf = mrb_yabm_buffer_self(mrb, self);
+  if (off < 0 || off > buf->fill)
+    mrb_raise(mrb, E_RANGE_ERROR, "offset out of range");
+  if (len < 0 || len > buf->fill - off)
+    len = buf->fill - off;
+  buf->off = off;
+  buf->len = len;
+
+  return self;
+}
+
+static mrb_value mrb_yabm_buffer_reset(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_buffer *buf;
+
+  buf = mrb_yabm_buffer_self(mrb, self);
+  buf->off = 0;
+  buf->len = buf->fill;
+
+  return self;
+}
+
+static mrb_value mrb_yabm_buffer_clear(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_buffer_set(mrb_yabm_buffer_self(mrb, self), 0);
+
+  return self;
+}
+
+static mrb_value mrb_yabm_buffer_append(mrb_state *mrb, mrb_value self)
+{
+  mrb_value val;
+  mrb_int len;
+  char *ptr;
+  mrb_get_args(mrb, "o", &val);
+
+  ptr = mrb_yabm_bytes(mrb, val, &len);
+
+  return mrb_fixnum_value(mrb_yabm_buffer_cat(mrb_yabm_buffer_self(mrb, self),
+    ptr, len));
+}
+
+static mrb_value mrb_yabm_buffer_getbyte(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_buffer *buf;
+  mrb_int i;
+  mrb_get_args(mrb, "i", &i);
+
+  buf = mrb_yabm_buffer_self(mrb, self);
+  if (i < 0 || i >= buf->len)
+    return mrb_nil_value();
+
+  return mrb_fixnum_value((unsigned char)buf->ptr[buf->off + i]);
+}
+
+static mrb_value mrb_yabm_buffer_setbyte(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_buffer *buf;
+  mrb_int i, val;
+  mrb_get_args(mrb, "ii", &i, &val);
+
+  buf = mrb_yabm_buffer_self(mrb, self);
+  if (i < 0 || i >= buf->len)
+    mrb_raise(mrb, E_RANGE_ERROR, "index out of range");
+  buf->ptr[buf->off + i] = val;
+
+  return mrb_fixnum_value(val);
+}
+
+/* index(str, from = 0) searches the view without allocating */
+static mrb_value mrb_yabm_buffer_index(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_buffer *buf;
+  mrb_value str;
+  mrb_int from = 0;
+  char *ptr;
+  int len, i;
+  mrb_get_args(mrb, "S|i", &str, &from);
+
+  buf = mrb_yabm_buffer_self(mrb, self);
+  ptr = RSTRING_PTR(str);
+  len = RSTRING_LEN(str);
+  if (from < 0)
+    from = 0;
+  for (i = from; i + len <= buf->len; ++i)
+    if (memcmp(buf->ptr + buf->off + i, ptr, len) == 0)
+      return mrb_fixnum_value(i);
+
+  return mrb_nil_value();
+}
+
+/* match?(str, pos = 0) */
+static mrb_value mrb_yabm_buffer_match(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_buffer *buf;
+  mrb_value str;
+  mrb_int pos = 0;
+  mrb_get_args(mrb, "S|i", &str, &pos);
+
+  buf = mrb_yabm_buffer_self(mrb, self);
+  if (pos < 0 || pos + RSTRING_LEN(str) > buf->len)
+    return mrb_false_value();
+
+  return mrb_bool_value(memcmp(buf->ptr + buf->off + pos, RSTRING_PTR(str),
+    RSTRING_LEN(str)) == 0);
+}
+
+static mrb_value mrb_yabm_buffer_to_s(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_buffer *buf;
+
+  buf = mrb_yabm_buffer_self(mrb, self);
+
+  return mrb_str_new(mrb, buf->ptr + buf->off, buf->len);
+}
+
+/* Hand the slab back now rather than at the next GC. */
+static mrb_value mrb_yabm_buffer_release(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_buffer *buf;
+
+  buf = (mrb_yabm_buffer *)mrb_data_check_get_ptr(mrb, self,
+    &mrb_yabm_buffer_type);
+  mrb_yabm_buffer_free(mrb, buf);
+  DATA_PTR(self) = NULL;
+
+  return mrb_nil_value();
+}
+
+void mrb_yabm_buffer_init(mrb_state *mrb, struct RClass *yabm)
+{
+  struct RClass *buffer;
+
+  buffer = mrb_define_class_under(mrb, yabm, "Buffer", mrb->object_class);
+  MRB_SET_INSTANCE_TT(buffer, MRB_TT_DATA);
+
+  mrb_define_class_method(mrb, buffer, "pool", mrb_yabm_buffer_setpool, MRB_ARGS_REQ(2));
+  mrb_define_class_method(mrb, buffer, "stat", mrb_yabm_buffer_stat, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "initialize", mrb_yabm_buffer_initialize, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "len", mrb_yabm_buffer_len, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "capa", mrb_yabm_buffer_capa, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "offset", mrb_yabm_buffer_offset, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "view", mrb_yabm_buffer_view, MRB_ARGS_ARG(1, 1));
+  mrb_define_method(mrb, buffer, "reset", mrb_yabm_buffer_reset, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "clear", mrb_yabm_buffer_clear, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "append", mrb_yabm_buffer_append, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, buffer, "getbyte", mrb_yabm_buffer_getbyte, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, buffer, "setbyte", mrb_yabm_buffer_setbyte, MRB_ARGS_REQ(2));
+  mrb_define_method(mrb, buffer, "index", mrb_yabm_buffer_index, MRB_ARGS_ARG(1, 1));
+  mrb_define_method(mrb, buffer, "match?", mrb_yabm_buffer_match, MRB_ARGS_ARG(1, 1));
+  mrb_define_method(mrb, buffer, "to_s", mrb_yabm_buffer_to_s, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "release", mrb_yabm_buffer_release, MRB_ARGS_NONE());
+}
+
+/* Buffer objects are swept after this, their dfree sees bufs == NULL. */
+void mrb_yabm_buffer_final(mrb_state *mrb)
+{
+  mrb_free(mrb, slabs);
+  mrb_free(mrb, bufs);
+  slabs = NULL;
+  bufs = NULL;
+  nslabs = 0;
+  slabsize = 0;
+  nfree = 0;
+  minfree = 0;
+}
@@ -0,0 +1,465 @@
+/*
+** mrb_yabm_codec.c - checksum and encoding kernels
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+static unsigned short crc16tab[256];
+static unsigned long crc32tab[256];
+static signed char b64val[256];
+
+static const char hexdigits[] = "0123456789abcdef";
+static const char b64digits[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void mrb_yabm_codec_tables()
+{
+  unsigned long c32;
+  unsigned short c16;
+  int i, n;
+
+  for (i = 0; i < 256; ++i) {
+    c16 = i;
+    c32 = i;
+    for (n = 0; n < 8; ++n) {
+      c16 = (c16 & 1) ? (c16 >> 1) ^ 0xa001 : c16 >> 1;
+      c32 = (c32 & 1) ? (c32 >> 1) ^ 0xedb88320UL : c32 >> 1;
+    }
+    crc16tab[i] = c16;
+    crc32tab[i] = c32;
+    b64val[i] = -1;
+  }
+  for (i = 0; i < 64; ++i)
+    b64val[(unsigned char)b64digits[i]] = i;
+}
+
+/* CRC-16/Modbus: start with 0xffff, a frame with its CRC gives 0. */
+unsigned short mrb_yabm_crc16(unsigned short crc, const unsigned char *ptr,
+  int len)
+{
+  while (len--)
+    crc = (crc >> 8) ^ crc16tab[(crc ^ *ptr++) & 0xff];
+  return crc;
+}
+
+/* CRC-32 as in zlib; pass the previous result to continue, 0 to start. */
+unsigned long mrb_yabm_crc32(unsigned long crc, const unsigned char *ptr,
+  int len)
+{
+  crc = ~crc & 0xffffffffUL;
+  while (len--)
+    crc = (crc >> 8) ^ crc32tab[(crc ^ *ptr++) & 0xff];
+  return ~crc & 0xffffffffUL;
+}
+
+/*
+ * Ones-complement sum of big-endian 16-bit words, two words per step,
+ * folded to 16 bits.  An odd length is padded with a zero byte.
+ */
+unsigned int mrb_yabm_cksum(unsigned int sum, const unsigned char *ptr,
+  int len)
+{
+  unsigned long acc;
+  int n;
+
+  acc = sum;
+  while (len >= 4) {
+    n = len < 0x10000 ? len & ~3 : 0x10000;
+    len -= n;
+    for (; n > 0; n -= 4, ptr += 4)
+      acc += ((ptr[0] << 8) | ptr[1]) + ((ptr[2] << 8) | ptr[3]);
+    acc = (acc & 0xffff) + (acc >> 16);
+  }
+  if (len >= 2) {
+    acc += (ptr[0] << 8) | ptr[1];
+    ptr += 2;
+    len -= 2;
+  }
+  if (len)
+    acc += ptr[0] << 8;
+  while (acc >> 16)
+    acc = (acc & 0xffff) + (acc >> 16);
+  return acc;
+}
+
+static const uint32_t sha256k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define	ROTR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static void mrb_yabm_sha256_block(mrb_yabm_sha256 *ctx,
+  const unsigned char *p)
+{
+  uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+  int i;
+
+  for (i = 0; i < 16; ++i, p += 4)
+    w[i] = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+  for (; i < 64; ++i)
+    w[i] = (ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10)) +
+      w[i - 7] + (ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^
+      (w[i - 15] >> 3)) + w[i - 16];
+  a = ctx->state[0];
+  b = ctx->state[1];
+  c = ctx->state[2];
+  d = ctx->state[3];
+  e = ctx->state[4];
+  f = ctx->state[5];
+  g = ctx->state[6];
+  h = ctx->state[7];
+  for (i = 0; i < 64; ++i) {
+    t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) +
+      sha256k[i] + w[i];
+    t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) +
+      ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  ctx->state[0] += a;
+  ctx->state[1] += b;
+  ctx->state[2] += c;
+  ctx->state[3] += d;
+  ctx->state[4] += e;
+  ctx->state[5] += f;
+  ctx->state[6] += g;
+  ctx->state[7] += h;
+}
+
+void mrb_yabm_sha256_init(mrb_yabm_sha256 *ctx)
+{
+  ctx->state[0] = 0x6a09e667;
+  ctx->state[1] = 0xbb67ae85;
+  ctx->state[2] = 0x3c6ef372;
+  ctx->state[3] = 0xa54ff53a;
+  ctx->state[4] = 0x510e527f;
+  ctx->state[5] = 0x9b05688c;
+  ctx->state[6] = 0x1f83d9ab;
+  ctx->state[7] = 0x5be0cd19;
+  ctx->count = 0;
+}
+
+void mrb_yabm_sha256_update(mrb_yabm_sha256 *ctx, const unsigned char *ptr,
+  int len)
+{
+  int fill, n;
+
+  fill = ctx->count & 63;
+  ctx->count += len;
+  if (fill > 0) {
+    n = 64 - fill < len ? 64 - fill : len;
+    memcpy(ctx->buf + fill, ptr, n);
+    ptr += n;
+    len -= n;
+    if (fill + n < 64)
+      return;
+    mrb_yabm_sha256_block(ctx, ctx->buf);
+  }
+  for (; len >= 64; ptr += 64, len -= 64)
+    mrb_yabm_sha256_block(ctx, ptr);
+  memcpy(ctx->buf, ptr, len);
+}
+
+void mrb_yabm_sha256_final(mrb_yabm_sha256 *ctx, unsigned char *digest)
+{
+  unsigned long long bits;
+  int i, fill;
+
+  bits = ctx->count * 8;
+  fill = ctx->count & 63;
+  ctx->buf[fill++] = 0x80;
+  if (fill > 56) {
+    memset(ctx->buf + fill, 0, 64 - fill);
+    mrb_yabm_sha256_block(ctx, ctx->buf);
+    fill = 0;
+  }
+  memset(ctx->buf + fill, 0, 56 - fill);
+  for (i = 0; i < 8; ++i)
+    ctx->buf[56 + i] = bits >> (56 - i * 8);
+  mrb_yabm_sha256_block(ctx, ctx->buf);
+  for (i = 0; i < 32; ++i)
+    digest[i] = ctx->state[i / 4] >> (24 - (i % 4) * 8);
+}
+
+/*
+ * Encoders and decoders return a String, or fill dst, a Buffer, and
+ * return the length.  max is the longest possible result.
+ */
+static char *mrb_yabm_codec_dst(mrb_state *mrb, mrb_value dst, mrb_value *res,
+  int max)
+{
+  mrb_yabm_buffer *buf;
+
+  buf = mrb_yabm_buffer_arg(mrb, dst);
+  if (buf != NULL) {
+    if (max > buf->capa)
+      mrb_raise(mrb, E_RANGE_ERROR, "buffer too small");
+    return buf->ptr;
+  }
+  *res = mrb_str_new(mrb, NULL, max);
+  return RSTRING_PTR(*res);
+}
+
+/*
+ * The encoders may be given the same Buffer as input and output.  The
+ * input is then moved to the end of the output area, where each byte is
+ * read before the output growing from the start reaches it.
+ */
+static unsigned char *mrb_yabm_codec_src(char *out, int max, char *ptr,
+  int len)
+{
+  if (len > 0 && ptr < out + max && out < ptr + len) {
+    memmove(out + max - len, ptr, len);
+    ptr = out + max - len;
+  }
+  return (unsigned char *)ptr;
+}
+
+static mrb_value mrb_yabm_codec_done(mrb_state *mrb, mrb_value dst,
+  mrb_value res, int len)
+{
+  if (!mrb_nil_p(dst)) {
+    mrb_yabm_buffer_set(mrb_yabm_buffer_get(mrb, dst), len);
+    return mrb_fixnum_value(len);
+  }
+  return mrb_str_resize(mrb, res, len);
+}
+
+/* crc16(data, crc = 0xffff) */
+static mrb_value mrb_yabm_crc16m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value data;
+  mrb_int crc = 0xffff, len;
+  char *ptr;
+  mrb_get_args(mrb, "o|i", &data, &crc);
+
+  ptr = mrb_yabm_bytes(mrb, data, &len);
+
+  return mrb_fixnum_value(mrb_yabm_crc16(crc, (unsigned char *)ptr, len));
+}
+
+/* crc32(data, crc = 0) */
+static mrb_value mrb_yabm_crc32m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value data;
+  mrb_int crc = 0, len;
+  char *ptr;
+  mrb_get_args(mrb, "o|i", &data, &crc);
+
+  ptr = mrb_yabm_bytes(mrb, data, &len);
+
+  return mrb_fixnum_value(mrb_yabm_crc32(crc, (unsigned char *)ptr, len));
+}
+
+/*
+ * cksum(data, sum = 0) returns the folded sum; the checksum field is
+ * sum ^ 0xffff.  Every chunk but the last must have an even length.
+ */
+static mrb_value mrb_yabm_cksumm(mrb_state *mrb, mrb_value self)
+{
+  mrb_value data;
+  mrb_int sum = 0, len;
+  char *ptr;
+  mrb_get_args(mrb, "o|i", &data, &sum);
+
+  ptr = mrb_yabm_bytes(mrb, data, &len);
+
+  return mrb_fixnum_value(mrb_yabm_cksum(sum, (unsigned char *)ptr, len));
+}
+
+/* sha256(data) returns the 32 byte digest */
+static mrb_value mrb_yabm_sha256m(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_sha256 ctx;
+  mrb_value data, res;
+  mrb_int len;
+  char *ptr;
+  mrb_get_args(mrb, "o", &data);
+
+  ptr = mrb_yabm_bytes(mrb, data, &len);
+  mrb_yabm_sha256_init(&ctx);
+  mrb_yabm_sha256_update(&ctx, (unsigned char *)ptr, len);
+  res = mrb_str_new(mrb, NULL, 32);
+  mrb_yabm_sha256_final(&ctx, (unsigned char *)RSTRING_PTR(res));
+
+  return res;
+}
+
+static mrb_value mrb_yabm_hexenc(mrb_state *mrb, mrb_value self)
+{
+  mrb_value data, res, dst = mrb_nil_value();
+  mrb_int len;
+  unsigned char *ptr;
+  char *out;
+  int i;
+  mrb_get_args(mrb, "o|o", &data, &dst);
+
+  mrb_yabm_bytes(mrb, data, &len);
+  out = mrb_yabm_codec_dst(mrb, dst, &res, len * 2);
+  ptr = (unsigned char *)mrb_yabm_bytes(mrb, data, &len);
+  ptr = mrb_yabm_codec_src(out, len * 2, (char *)ptr, len);
+  for (i = 0; i < len; ++i) {
+    *out++ = hexdigits[ptr[i] >> 4];
+    *out++ = hexdigits[ptr[i] & 0x0f];
+  }
+
+  return mrb_yabm_codec_done(mrb, dst, res, len * 2);
+}
+
+static int mrb_yabm_codec_hexval(int ch)
+{
+  if (ch >= '0' && ch <= '9')
+    return ch - '0';
+  ch |= 0x20;
+  if (ch >= 'a' && ch <= 'f')
+    return ch - 'a' + 10;
+  return -1;
+}
+
+/* hexdec(str, buf = nil) returns nil on a bad digit or an odd length */
+static mrb_value mrb_yabm_hexdec(mrb_state *mrb, mrb_value self)
+{
+  mrb_value data, res, dst = mrb_nil_value();
+  mrb_int len;
+  unsigned char *ptr;
+  char *out;
+  int i, hi, lo;
+  mrb_get_args(mrb, "o|o", &data, &dst);
+
+  mrb_yabm_bytes(mrb, data, &len);
+  if (len & 1)
+    return mrb_nil_value();
+  out = mrb_yabm_codec_dst(mrb, dst, &res, len / 2);
+  ptr = (unsigned char *)mrb_yabm_bytes(mrb, data, &len);
+  for (i = 0; i < len; i += 2) {
+    hi = mrb_yabm_codec_hexval(ptr[i]);
+    lo = mrb_yabm_codec_hexval(ptr[i + 1]);
+    if (hi < 0 || lo < 0)
+      return mrb_nil_value();
+    *out++ = (hi << 4) | lo;
+  }
+
+  return mrb_yabm_codec_done(mrb, dst, res, len / 2);
+}
+
+/* b64enc(data, buf = nil); every chunk but the last must be 3n bytes */
+static mrb_value mrb_yabm_b64enc(mrb_state *mrb, mrb_value self)
+{
+  mrb_value data, res, dst = mrb_nil_value();
+  mrb_int len;
+  unsigned char *ptr;
+  unsigned long v;
+  char *out, *start;
+  int i;
+  mrb_get_args(mrb, "o|o", &data, &dst);
+
+  mrb_yabm_bytes(mrb, data, &len);
+  start = out = mrb_yabm_codec_dst(mrb, dst, &res, (len + 2) / 3 * 4);
+  ptr = (unsigned char *)mrb_yabm_bytes(mrb, data, &len);
+  ptr = mrb_yabm_codec_src(out, (len + 2) / 3 * 4, (char *)ptr, len);
+  for (i = 0; i + 3 <= len; i += 3) {
+    v = (ptr[i] << 16) | (ptr[i + 1] << 8) | ptr[i + 2];
+    *out++ = b64digits[v >> 18];
+    *out++ = b64digits[(v >> 12) & 0x3f];
+    *out++ = b64digits[(v >> 6) & 0x3f];
+    *out++ = b64digits[v & 0x3f];
+  }
+  if (i < len) {
+    v = ptr[i] << 16;
+    if (i + 1 < len)
+      v |= ptr[i + 1] << 8;
+    *out++ = b64digits[v >> 18];
+    *out++ = b64digits[(v >> 12) & 0x3f];
+    *out++ = i + 1 < len ? b64digits[(v >> 6) & 0x3f] : '=';
+    *out++ = '=';
+  }
+
+  return mrb_yabm_codec_done(mrb, dst, res, out - start);
+}
+
+/*
+ * b64dec(str, buf = nil) skips whitespace and stops at padding; nil on
+ * any other character.  Every chunk but the last must be 4n digits.
+ */
+static mrb_value mrb_yabm_b64dec(mrb_state *mrb, mrb_value self)
+{
+  mrb_value data, res, dst = mrb_nil_value();
+  mrb_int len;
+  unsigned char *ptr;
+  unsigned long v;
+  char *out, *start;
+  int i, n, c;
+  mrb_get_args(mrb, "o|o", &data, &dst);
+
+  mrb_yabm_bytes(mrb, data, &len);
+  start = out = mrb_yabm_codec_dst(mrb, dst, &res, len / 4 * 3 + 2);
+  ptr = (unsigned char *)mrb_yabm_bytes(mrb, data, &len);
+  v = 0;
+  n = 0;
+  for (i = 0; i < len; ++i) {
+    c = b64val[ptr[i]];
+    if (c < 0) {
+      if (ptr[i] == '=')
+        break;
+      if (ptr[i] == ' ' || ptr[i] == '\r' || ptr[i] == '\n' || ptr[i] == '\t')
+        continue;
+      return mrb_nil_value();
+    }
+    v = (v << 6) | c;
+    if (++n == 4) {
+      *out++ = v >> 16;
+      *out++ = v >> 8;
+      *out++ = v;
+      v = 0;
+      n = 0;
+    }
+  }
+  if (n == 1)
+    return mrb_nil_value();
+  if (n >= 2)
+    *out++ = v >> (n == 2 ? 4 : 10);
+  if (n == 3)
+    *out++ = v >> 2;
+
+  return mrb_yabm_codec_done(mrb, dst, res, out - start);
+}
+
+void mrb_yabm_codec_init(mrb_state *mrb, struct RClass *yabm)
+{
+  mrb_yabm_codec_tables();
+
+  yabm_define_method(mrb, yabm, "crc16", mrb_yabm_crc16m, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "crc32", mrb_yabm_crc32m, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "cksum", mrb_yabm_cksumm, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "sha256", mrb_yabm_sha256m, MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "hexenc", mrb_yabm_hexenc, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "hexdec", mrb_yabm_hexdec, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "b64enc", mrb_yabm_b64enc, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "b64dec", mrb_yabm_b64dec, MRB_ARGS_ARG(1, 1));
+}
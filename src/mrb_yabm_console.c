@@ -0,0 +1,272 @@
+/*
+** mrb_yabm_console.c - buffered console output
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+#define	CONSOLE_PORTS		2
+#define	CONSOLE_CHUNK		16
+#define	CONSOLE_FIFO		16	/* bytes sent per poll */
+#define	CONSOLE_FIFOUS		4167	/* to send them at 38400 baud */
+
+typedef struct {
+  char *buf;
+  int size;
+  int head;
+  int tail;
+  int mode;
+  int written;
+  int dropped;
+  unsigned int sent;
+} console_ring;
+
+static console_ring rings[CONSOLE_PORTS];
+
+#if !defined(YABM_DUMMY)
+void print(char *);
+#if defined(YABM_BROADCOM) || defined(YABM_ADMTEK)
+void print2(char *);
+#endif
+#endif
+
+/*
+ * Send len bytes synchronously.  The firmware print() takes a C string,
+ * so data goes out in NUL-terminated pieces and NUL bytes are skipped.
+ */
+static void mrb_yabm_console_out(int port, const char *ptr, int len)
+{
+#if defined(YABM_DUMMY)
+  fwrite(ptr, 1, len, port == 1 ? stderr : stdout);
+  fflush(port == 1 ? stderr : stdout);
+#else
+  char tmp[CONSOLE_CHUNK + 1];
+  int n;
+
+  while (len > 0) {
+    n = 0;
+    while (n < CONSOLE_CHUNK && n < len && ptr[n] != '\0') {
+      tmp[n] = ptr[n];
+      ++n;
+    }
+    if (n > 0) {
+      tmp[n] = '\0';
+#if defined(YABM_BROADCOM) || defined(YABM_ADMTEK)
+      if (port == 1)
+        print2(tmp);
+      else
+#endif
+      print(tmp);
+    } else {
+      n = 1;
+    }
+    ptr += n;
+    len -= n;
+  }
+#endif
+}
+
+static int mrb_yabm_console_used(console_ring *ring)
+{
+  int n;
+
+  n = ring->head - ring->tail;
+  if (n < 0)
+    n += ring->size;
+  return n;
+}
+
+/* Send at most max queued bytes, in one or two contiguous pieces. */
+static void mrb_yabm_console_drain(int port, int max)
+{
+  console_ring *ring;
+  int n;
+
+  ring = &rings[port];
+  while (max > 0 && ring->head != ring->tail) {
+    if (ring->head > ring->tail)
+      n = ring->head - ring->tail;
+    else
+      n = ring->size - ring->tail;
+    if (n > max)
+      n = max;
+    mrb_yabm_console_out(port, ring->buf + ring->tail, n);
+    ring->tail = (ring->tail + n) % ring->size;
+    ring->written += n;
+    max -= n;
+  }
+}
+
+/*
+ * Called from every native wait point.  A port gets at most one UART
+ * FIFO of output, once the previous one had time to go out, so print()
+ * does not block here.  Returns the number of ports still holding
+ * output, so msleep keeps short slices until it is out.
+ */
+int mrb_yabm_console_poll()
+{
+  unsigned int now;
+  int i, n;
+
+  n = 0;
+  now = mrb_yabm_uclock();
+  for (i = 0; i < CONSOLE_PORTS; ++i) {
+    if (rings[i].buf != NULL) {
+      if (now - rings[i].sent >= CONSOLE_FIFOUS) {
+        mrb_yabm_console_drain(i, CONSOLE_FIFO);
+        rings[i].sent = now;
+      }
+      if (rings[i].head != rings[i].tail)
+        ++n;
+    }
+  }
+  return n;
+}
+
+static void mrb_yabm_console_write(int port, const char *ptr, int len)
+{
+  console_ring *ring;
+  int space, n;
+
+  ring = &rings[port];
+  if (ring->buf == NULL) {
+    mrb_yabm_console_out(port, ptr, len);
+    ring->written += len;
+    return;
+  }
+  while (len > 0) {
+    space = ring->size - 1 - mrb_yabm_console_used(ring);
+    if (space == 0) {
+      if (ring->mode == PRINT_DROP) {
+        ring->dropped += len;
+        return;
+      }
+      mrb_yabm_console_drain(port, CONSOLE_FIFO);
+      continue;
+    }
+    n = ring->size - ring->head;
+    if (n > space)
+      n = space;
+    if (n > len)
+      n = len;
+    memcpy(ring->buf + ring->head, ptr, n);
+    ring->head = (ring->head + n) % ring->size;
+    ptr += n;
+    len -= n;
+  }
+}
+
+static int mrb_yabm_console_port(mrb_state *mrb, mrb_int port)
+{
+  if (port < 0 || port >= CONSOLE_PORTS)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid console port");
+#if !defined(YABM_DUMMY) && !defined(YABM_BROADCOM) && !defined(YABM_ADMTEK)
+  port = 0;
+#endif
+  return port;
+}
+
+static mrb_value mrb_yabm_print(mrb_state *mrb, mrb_value self)
+{
+  mrb_value val;
+  mrb_int port = 0;
+  mrb_get_args(mrb, "S|i", &val, &port);
+
+  mrb_yabm_console_write(mrb_yabm_console_port(mrb, port),
+    RSTRING_PTR(val), RSTRING_LEN(val));
+  return mrb_nil_value();
+}
+
+/*
+ * printbuf(size, mode = PRINT_DROP, port = 0)
+ * size 0 flushes and returns the port to synchronous output.
+ */
+static mrb_value mrb_yabm_printbuf(mrb_state *mrb, mrb_value self)
+{
+  console_ring *ring;
+  mrb_int size, mode = PRINT_DROP, port = 0;
+  mrb_get_args(mrb, "i|ii", &size, &mode, &port);
+
+  if (mode != PRINT_DROP && mode != PRINT_BLOCK)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid print buffer mode");
+  port = mrb_yabm_console_port(mrb, port);
+  ring = &rings[port];
+  if (ring->buf != NULL) {
+    mrb_yabm_console_drain(port, ring->size);
+    mrb_free(mrb, ring->buf);
+    ring->buf = NULL;
+  }
+  if (size > 0) {
+    ring->buf = (char *)mrb_malloc(mrb, size + 1);
+    ring->size = size + 1;
+  }
+  ring->head = 0;
+  ring->tail = 0;
+  ring->mode = mode;
+  ring->sent = mrb_yabm_uclock() - CONSOLE_FIFOUS;
+
+  return mrb_fixnum_value(0);
+}
+
+static mrb_value mrb_yabm_printflush(mrb_state *mrb, mrb_value self)
+{
+  mrb_int port = 0;
+  mrb_get_args(mrb, "|i", &port);
+
+  port = mrb_yabm_console_port(mrb, port);
+  if (rings[port].buf != NULL)
+    mrb_yabm_console_drain(port, rings[port].size);
+
+  return mrb_fixnum_value(0);
+}
+
+static mrb_value mrb_yabm_printstat(mrb_state *mrb, mrb_value self)
+{
+  console_ring *ring;
+  mrb_value res;
+  mrb_int port = 0;
+  mrb_get_args(mrb, "|i", &port);
+
+  ring = &rings[mrb_yabm_console_port(mrb, port)];
+  res = mrb_ary_new(mrb);
+  mrb_ary_push(mrb, res, mrb_fixnum_value(ring->buf ?
+    mrb_yabm_console_used(ring) : 0));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(ring->dropped));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(ring->written));
+
+  return res;
+}
+
+void mrb_yabm_console_init(mrb_state *mrb, struct RClass *yabm)
+{
+  mrb_define_const(mrb, yabm, "PRINT_DROP", mrb_fixnum_value(PRINT_DROP));
+  mrb_define_const(mrb, yabm, "PRINT_BLOCK", mrb_fixnum_value(PRINT_BLOCK));
+
+  yabm_define_method(mrb, yabm, "print", mrb_yabm_print, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "printbuf", mrb_yabm_printbuf, MRB_ARGS_ARG(1, 2));
+  yabm_define_method(mrb, yabm, "printflush", mrb_yabm_printflush, MRB_ARGS_OPT(1));
+  yabm_define_method(mrb, yabm, "printstat", mrb_yabm_printstat, MRB_ARGS_OPT(1));
+}
+
+void mrb_yabm_console_final(mrb_state *mrb)
+{
+  int i;
+
+  for (i = 0; i < CONSOLE_PORTS; ++i) {
+    if (rings[i].buf != NULL) {
+      mrb_yabm_console_drain(i, rings[i].size);
+      mrb_free(mrb, rings[i].buf);
+    }
+    memset(&rings[i], 0, sizeof(console_ring));
+  }
+}
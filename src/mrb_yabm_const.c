@@ -0,0 +1,216 @@
+/*
+** mrb_yabm_const.c - constants defined on first use, build report
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+#include "mruby/variable.h"
+
+#include "mrb_yabm.h"
+
+/*
+ * MIB_* and REG_* are not defined by gem_init.  YABM.const_missing
+ * finds them here, without their prefix, and defines each one the
+ * first time a script uses it.  Until then defined?, const_defined?
+ * and constants do not see it.
+ */
+typedef struct {
+  const char *name;
+  unsigned short val;
+} yabm_const;
+
+#if (defined(YABM_REALTEK) || defined(YABM_DUMMY)) && !defined(YABM_NO_MIB)
+static const yabm_const mibconsts[] = {
+  { "IN", MIB_IN },
+  { "OUT", MIB_OUT },
+  { "IFINOCTETS", MIB_IFINOCTETS },
+  { "IFINUCASTPKTS", MIB_IFINUCASTPKTS },
+  { "ETHERSTATSOCTETS", MIB_ETHERSTATSOCTETS },
+  { "ETHERSTATSUNDERSIZEPKTS", MIB_ETHERSTATSUNDERSIZEPKTS },
+  { "ETHERSTATSFRAGMEMTS", MIB_ETHERSTATSFRAGMEMTS },
+  { "ETHERSTATSPKTS64OCTETS", MIB_ETHERSTATSPKTS64OCTETS },
+  { "ETHERSTATSPKTS65TO127OCTETS", MIB_ETHERSTATSPKTS65TO127OCTETS },
+  { "ETHERSTATSPKTS128TO255OCTETS", MIB_ETHERSTATSPKTS128TO255OCTETS },
+  { "ETHERSTATSPKTS256TO511OCTETS", MIB_ETHERSTATSPKTS256TO511OCTETS },
+  { "ETHERSTATSPKTS512TO1023OCTETS", MIB_ETHERSTATSPKTS512TO1023OCTETS },
+  { "ETHERSTATSPKTS1024TO1518OCTETS", MIB_ETHERSTATSPKTS1024TO1518OCTETS },
+  { "ETHERSTATSOVERSIZEPKTS", MIB_ETHERSTATSOVERSIZEPKTS },
+  { "ETHERSTATSJABBERS", MIB_ETHERSTATSJABBERS },
+  { "ETHERSTATSMULTICASTPKTS", MIB_ETHERSTATSMULTICASTPKTS },
+  { "ETHERSTATSBROADCASTPKTS", MIB_ETHERSTATSBROADCASTPKTS },
+  { "DOT1DTPPORTINDISCARDS", MIB_DOT1DTPPORTINDISCARDS },
+  { "ETHERSTATSDROPEVENTS", MIB_ETHERSTATSDROPEVENTS },
+  { "DOT3STATSFCSERRORS", MIB_DOT3STATSFCSERRORS },
+  { "DOT3STATSSYMBOLERRORS", MIB_DOT3STATSSYMBOLERRORS },
+  { "DOT3CONTROLINUNKNOWNOPCODES", MIB_DOT3CONTROLINUNKNOWNOPCODES },
+  { "DOT3INPAUSEFRAMES", MIB_DOT3INPAUSEFRAMES },
+  { "IFOUTOCTETS", MIB_IFOUTOCTETS },
+  { "IFOUTUCASTPKTS", MIB_IFOUTUCASTPKTS },
+  { "IFOUTMULTICASTPKTS", MIB_IFOUTMULTICASTPKTS },
+  { "IFOUTBROADCASTPKTS", MIB_IFOUTBROADCASTPKTS },
+  { "IFOUTDISCARDS", MIB_IFOUTDISCARDS },
+  { "DOT3STATSSINGLECOLLISIONFRAMES", MIB_DOT3STATSSINGLECOLLISIONFRAMES },
+  { "DOT3STATSMULTIPLECOLLISIONFRAMES", MIB_DOT3STATSMULTIPLECOLLISIONFRAMES },
+  { "DOT3STATSDEFERREDTRANSMISSIONS", MIB_DOT3STATSDEFERREDTRANSMISSIONS },
+  { "DOT3STATSLATECOLLISIONS", MIB_DOT3STATSLATECOLLISIONS },
+  { "DOT3STATSEXCESSIVECOLLISIONS", MIB_DOT3STATSEXCESSIVECOLLISIONS },
+  { "DOT3OUTPAUSEFRAMES", MIB_DOT3OUTPAUSEFRAMES },
+  { "DOT1DBASEPORTDELAYEXCEEDEDDISCARDS", MIB_DOT1DBASEPORTDELAYEXCEEDEDDISCARDS },
+  { "ETHERSTATSCOLLISIONS", MIB_ETHERSTATSCOLLISIONS },
+  { NULL, 0 }
+};
+#endif
+
+#if !defined(YABM_NO_MMIO)
+static const yabm_const regconsts[] = {
+  { "READ", REG_READ },
+  { "WRITE", REG_WRITE },
+  { "MODIFY", REG_MODIFY },
+  { "WAIT", REG_WAIT },
+  { "DELAY", REG_DELAY },
+  { NULL, 0 }
+};
+#endif
+
+static const struct {
+  const char *prefix;
+  const yabm_const *tab;
+} consttabs[] = {
+#if (defined(YABM_REALTEK) || defined(YABM_DUMMY)) && !defined(YABM_NO_MIB)
+  { "MIB_", mibconsts },
+#endif
+#if !defined(YABM_NO_MMIO)
+  { "REG_", regconsts },
+#endif
+};
+
+/*
+ * Subsystems a build can leave out with YABM_NO_*, see mrbgem.rake.
+ */
+static const char *const subsystems[] = {
+#if !defined(YABM_NO_HTTP)
+  "http",
+#endif
+#if !defined(YABM_NO_HTTPS)
+  "https",
+#endif
+#if !defined(YABM_NO_HTTPSVR)
+  "httpsvr",
+#endif
+#if !defined(YABM_NO_UDP)
+  "udp",
+#endif
+#if !defined(YABM_NO_I2C)
+  "i2c",
+#endif
+#if !defined(YABM_NO_GPIO)
+  "gpio",
+#endif
+#if !defined(YABM_NO_MIB)
+  "mib",
+#endif
+#if !defined(YABM_NO_MDIO)
+  "mdio",
+#endif
+#if !defined(YABM_NO_UART)
+  "uart",
+#endif
+#if !defined(YABM_NO_MMIO)
+  "mmio",
+#endif
+  NULL
+};
+
+static int inittime;
+static int resolved;
+
+static const yabm_const *mrb_yabm_const_find(const char *name, mrb_int len)
+{
+  const yabm_const *c;
+  int i, n;
+
+  for (i = 0; i < sizeof(consttabs) / sizeof(consttabs[0]); ++i) {
+    n = strlen(consttabs[i].prefix);
+    if (len <= n || memcmp(name, consttabs[i].prefix, n) != 0)
+      continue;
+    for (c = consttabs[i].tab; c->name != NULL; ++c)
+      if (strlen(c->name) == len - n && memcmp(c->name, name + n, len - n) == 0)
+        return c;
+  }
+  return NULL;
+}
+
+static mrb_value mrb_yabm_const_missing(mrb_state *mrb, mrb_value self)
+{
+  const yabm_const *c;
+  const char *name;
+  mrb_value msg, val;
+  mrb_sym sym;
+  mrb_int len;
+  mrb_get_args(mrb, "n", &sym);
+
+  name = mrb_sym2name_len(mrb, sym, &len);
+  c = mrb_yabm_const_find(name, len);
+  if (c == NULL) {
+    msg = mrb_str_new_cstr(mrb, "uninitialized constant YABM::");
+    mrb_str_cat(mrb, msg, name, len);
+    mrb_exc_raise(mrb, mrb_exc_new_str(mrb, E_NAME_ERROR, msg));
+  }
+  val = mrb_fixnum_value(c->val);
+  mrb_const_set(mrb, self, sym, val);
+  ++resolved;
+
+  return val;
+}
+
+/*
+ * buildinfo returns [subsystems, ms, constants]: the subsystems built
+ * in, the time gem_init took and the constants defined on use so far.
+ * Milliseconds, as the firmware has no finer clock.
+ */
+static mrb_value mrb_yabm_buildinfo(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res[3];
+  int i;
+
+  res[0] = mrb_ary_new(mrb);
+  for (i = 0; subsystems[i] != NULL; ++i)
+    mrb_ary_push(mrb, res[0], mrb_str_new_cstr(mrb, subsystems[i]));
+  res[1] = mrb_fixnum_value(inittime);
+  res[2] = mrb_fixnum_value(resolved);
+
+  return mrb_ary_new_from_values(mrb, 3, res);
+}
+
+/*
+ * Called last from gem_init with the mrb_yabm_clock() it started at.
+ */
+void mrb_yabm_const_init(mrb_state *mrb, struct RClass *yabm, int start)
+{
+  mrb_define_const(mrb, yabm, "MODULE_UNKNOWN", mrb_fixnum_value(MODULE_UNKNOWN));
+  mrb_define_const(mrb, yabm, "MODULE_RTL8196C", mrb_fixnum_value(MODULE_RTL8196C));
+  mrb_define_const(mrb, yabm, "MODULE_BCM4712", mrb_fixnum_value(MODULE_BCM4712));
+  mrb_define_const(mrb, yabm, "MODULE_RTL8196E", mrb_fixnum_value(MODULE_RTL8196E));
+  mrb_define_const(mrb, yabm, "MODULE_BCM5350", mrb_fixnum_value(MODULE_BCM5350));
+  mrb_define_const(mrb, yabm, "MODULE_BCM5352", mrb_fixnum_value(MODULE_BCM5352));
+  mrb_define_const(mrb, yabm, "MODULE_BCM5354", mrb_fixnum_value(MODULE_BCM5354));
+  mrb_define_const(mrb, yabm, "MODULE_ADM5120", mrb_fixnum_value(MODULE_ADM5120));
+  mrb_define_const(mrb, yabm, "MODULE_ADM5120P", mrb_fixnum_value(MODULE_ADM5120P));
+  mrb_define_const(mrb, yabm, "MODULE_KS8695", mrb_fixnum_value(MODULE_KS8695));
+  mrb_define_const(mrb, yabm, "MODULE_RTL8198", mrb_fixnum_value(MODULE_RTL8198));
+  mrb_define_const(mrb, yabm, "MODULE_RTL8197D", mrb_fixnum_value(MODULE_RTL8197D));
+  mrb_define_const(mrb, yabm, "MODULE_DUMMY", mrb_fixnum_value(MODULE_DUMMY));
+  mrb_define_class_method(mrb, yabm, "const_missing", mrb_yabm_const_missing,
+    MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "buildinfo", mrb_yabm_buildinfo,
+    MRB_ARGS_NONE());
+  resolved = 0;
+  inittime = mrb_yabm_clock() - start;
+}
@@ -0,0 +1,634 @@
+/*
+** mrb_yabm_download.c - streaming download with SHA-256 verification
+**
+** See Copyright Notice in LICENSE
+*/
+
+#if defined(YABM_DUMMY)
+#include <stdio.h>
+#include <unistd.h>
+#endif
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+#include "mruby/error.h"
+
+#include "mrb_yabm.h"
+
+#if !defined(YABM_NO_HTTP)
+
+int http_connect(uint32_t *addr, int port, char *header, int type);
+int http_read(char *buf, int len);
+void http_close();
+#if !defined(YABM_NO_HTTPS)
+int https_connect(char *host, uint32_t *addr, int port, char *header,
+  int type);
+int https_read(char *buf, int len);
+void https_close();
+#else
+#define	https_connect(host, addr, port, header, type)	0
+#define	https_read(buf, len)				(-1)
+#define	https_close()
+#endif
+
+void delay_ms(int ms);
+
+#if defined(YABM_DUMMY) || defined(YABM_FLASH)
+/*
+ * flash_ota_size() bytes of flash for an image, in OTA_SECTOR erase
+ * blocks, from the firmware as flash_ota_*.  Offsets are relative to
+ * the area.
+ */
+int flash_ota_size();
+int flash_ota_read(int off, char *buf, int len);
+int flash_ota_write(int off, char *buf, int len);
+int flash_ota_erase(int off);
+#endif
+
+#define	DL_FLASH		0
+#define	DL_BUFFER		1
+#define	DL_FILE			2
+
+#define	DL_CHUNK		1460
+#define	DL_HDRMAX		1024
+#define	DL_PROGRESS		250
+
+typedef struct {
+  int kind;
+  mrb_yabm_buffer *buf;
+} dl_sink;
+
+static char dlhdr[DL_HDRMAX];
+static char dlchunk[DL_CHUNK];
+#if defined(YABM_DUMMY)
+static FILE *dlfile;
+#endif
+
+/* The latest download, for dlstat */
+static long dldone;
+static long dltotal;
+static long dlfrom;
+static int dlstart;
+static int dlend;
+static int dlbusy;
+
+static void mrb_yabm_dl_open(mrb_state *mrb, dl_sink *sink, mrb_value dst)
+{
+#if defined(YABM_DUMMY)
+  const char *path;
+
+  if (dlfile != NULL)
+    fclose(dlfile);
+  dlfile = NULL;
+#endif
+  if (mrb_nil_p(dst)) {
+#if defined(YABM_DUMMY) || defined(YABM_FLASH)
+    sink->kind = DL_FLASH;
+    return;
+#endif
+  } else if (mrb_string_p(dst)) {
+#if defined(YABM_DUMMY)
+    path = mrb_str_to_cstr(mrb, dst);
+    dlfile = fopen(path, "r+b");
+    if (dlfile == NULL)
+      dlfile = fopen(path, "w+b");
+    if (dlfile == NULL)
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "cannot open download file");
+    sink->kind = DL_FILE;
+    return;
+#endif
+  } else {
+    sink->kind = DL_BUFFER;
+    sink->buf = mrb_yabm_buffer_arg(mrb, dst);
+    return;
+  }
+  mrb_raise(mrb, E_ARGUMENT_ERROR, "download sink not supported");
+}
+
+static void mrb_yabm_dl_close()
+{
+#if defined(YABM_DUMMY)
+  if (dlfile != NULL)
+    fclose(dlfile);
+  dlfile = NULL;
+#endif
+}
+
+static int mrb_yabm_dl_read(dl_sink *sink, int off, char *ptr, int len)
+{
+  switch (sink->kind) {
+  case DL_BUFFER:
+    if (len > sink->buf->fill - off)
+      len = sink->buf->fill - off;
+    if (len <= 0)
+      return 0;
+    memcpy(ptr, sink->buf->ptr + off, len);
+    return len;
+#if defined(YABM_DUMMY) || defined(YABM_FLASH)
+  case DL_FLASH:
+    if (len > flash_ota_size() - off)
+      len = flash_ota_size() - off;
+    if (len <= 0)
+      return 0;
+    flash_ota_read(off, ptr, len);
+    return len;
+#endif
+#if defined(YABM_DUMMY)
+  case DL_FILE:
+    if (fseek(dlfile, off, SEEK_SET) != 0)
+      return 0;
+    return fread(ptr, 1, len, dlfile);
+#endif
+  }
+  return 0;
+}
+
+/* Room in the sink, -1 when unbounded. */
+static long mrb_yabm_dl_capa(dl_sink *sink)
+{
+  switch (sink->kind) {
+  case DL_BUFFER:
+    return sink->buf->capa;
+#if defined(YABM_DUMMY) || defined(YABM_FLASH)
+  case DL_FLASH:
+    return flash_ota_size();
+#endif
+  }
+  return -1;
+}
+
+/*
+ * Flash blocks are erased as the write reaches them, so a resumed
+ * download keeps what was written before the offset in its block.
+ * Returns -2 when the data does not fit.
+ */
+static int mrb_yabm_dl_write(dl_sink *sink, int off, char *ptr, int len)
+{
+#if defined(YABM_DUMMY) || defined(YABM_FLASH)
+  int n;
+#endif
+
+  switch (sink->kind) {
+  case DL_BUFFER:
+    if (len > sink->buf->capa - off)
+      return -2;
+    memcpy(sink->buf->ptr + off, ptr, len);
+    mrb_yabm_buffer_set(sink->buf, off + len);
+    return 0;
+#if defined(YABM_DUMMY) || defined(YABM_FLASH)
+  case DL_FLASH:
+    if (len > flash_ota_size() - off)
+      return -2;
+    for (; len > 0; off += n, ptr += n, len -= n) {
+      if (off % OTA_SECTOR == 0)
+        flash_ota_erase(off);
+      n = OTA_SECTOR - off % OTA_SECTOR;
+      if (n > len)
+        n = len;
+      if (flash_ota_write(off, ptr, n) < 0)
+        return -1;
+    }
+    return 0;
+#endif
+#if defined(YABM_DUMMY)
+  case DL_FILE:
+    if (fseek(dlfile, off, SEEK_SET) != 0 ||
+      fwrite(ptr, 1, len, dlfile) != len)
+      return -1;
+    return 0;
+#endif
+  }
+  return -1;
+}
+
+#if defined(YABM_DUMMY) || defined(YABM_FLASH)
+/* Whether the OTA area from off to the end of its block is erased. */
+static int mrb_yabm_dl_blank(long off)
+{
+  long end;
+  int i, n;
+
+  end = off - off % OTA_SECTOR + OTA_SECTOR;
+  if (end > flash_ota_size())
+    end = flash_ota_size();
+  for (; off < end; off += n) {
+    n = end - off < DL_CHUNK ? end - off : DL_CHUNK;
+    flash_ota_read(off, dlchunk, n);
+    for (i = 0; i < n; ++i)
+      if ((unsigned char)dlchunk[i] != 0xff)
+        return 0;
+  }
+  return 1;
+}
+#endif
+
+/*
+ * Drops anything past off and returns how much of it is there.  Flash
+ * can only clear bits, so a resume inside a block that holds data past
+ * off goes back to the start of the block, which the write erases.
+ */
+static long mrb_yabm_dl_truncate(dl_sink *sink, long off)
+{
+#if defined(YABM_DUMMY)
+  long size;
+#endif
+
+  switch (sink->kind) {
+  case DL_BUFFER:
+    if (off > sink->buf->fill)
+      off = sink->buf->fill;
+    mrb_yabm_buffer_set(sink->buf, off);
+    break;
+#if defined(YABM_DUMMY) || defined(YABM_FLASH)
+  case DL_FLASH:
+    if (off > flash_ota_size())
+      off = flash_ota_size();
+    if (off % OTA_SECTOR != 0 && !mrb_yabm_dl_blank(off))
+      off -= off % OTA_SECTOR;
+    break;
+#endif
+#if defined(YABM_DUMMY)
+  case DL_FILE:
+    fseek(dlfile, 0, SEEK_END);
+    size = ftell(dlfile);
+    if (off > size)
+      off = size;
+    fflush(dlfile);
+    if (ftruncate(fileno(dlfile), off) != 0)
+      off = 0;
+    break;
+#endif
+  }
+  return off;
+}
+
+static void mrb_yabm_dl_hash(dl_sink *sink, mrb_yabm_sha256 *ctx, long len)
+{
+  long off;
+  int n;
+
+  mrb_yabm_sha256_init(ctx);
+  for (off = 0; off < len; off += n) {
+    n = len - off < DL_CHUNK ? len - off : DL_CHUNK;
+    n = mrb_yabm_dl_read(sink, off, dlchunk, n);
+    if (n <= 0)
+      break;
+    mrb_yabm_sha256_update(ctx, (unsigned char *)dlchunk, n);
+  }
+}
+
+/* Value of a header field, or NULL. */
+static const char *mrb_yabm_dl_field(const char *hdr, const char *name)
+{
+  const char *line, *p, *q;
+
+  for (line = strstr(hdr, "\r\n"); line != NULL;
+    line = strstr(line + 2, "\r\n")) {
+    for (q = name, p = line + 2; *q != '\0'; ++q, ++p)
+      if ((*p | 0x20) != (*q | 0x20))
+        break;
+    if (*q == '\0' && *p == ':') {
+      for (++p; *p == ' '; ++p)
+        ;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+static long mrb_yabm_dl_num(const char **p)
+{
+  long val;
+
+  if (**p < '0' || **p > '9')
+    return -1;
+  for (val = 0; **p >= '0' && **p <= '9'; ++*p)
+    val = val * 10 + (**p - '0');
+  return val;
+}
+
+static void mrb_yabm_dl_ltoa(char *p, long val)
+{
+  char tmp[12];
+  int i;
+
+  i = 0;
+  do {
+    tmp[i++] = '0' + val % 10;
+    val /= 10;
+  } while (val > 0);
+  while (i > 0)
+    *p++ = tmp[--i];
+  *p = '\0';
+}
+
+static mrb_value mrb_yabm_dl_progress(mrb_state *mrb, mrb_value arg)
+{
+  return mrb_yield_argv(mrb, RARRAY_PTR(arg)[0], 2, RARRAY_PTR(arg) + 1);
+}
+
+/*
+ * Parses the response header and sets where the body starts and the
+ * full length, -1 when unknown.  A server that ignores Range answers
+ * 200 and the download starts over.
+ */
+static int mrb_yabm_dl_response(const char *hdr, long *from, long *total)
+{
+  const char *p;
+  long len;
+  int status;
+
+  if (strncmp(hdr, "HTTP/", 5) != 0 || (p = strchr(hdr, ' ')) == NULL)
+    return 0;
+  ++p;
+  status = mrb_yabm_dl_num(&p);
+  p = mrb_yabm_dl_field(hdr, "Content-Length");
+  len = p != NULL ? mrb_yabm_dl_num(&p) : -1;
+  if (status == 200) {
+    *from = 0;
+    *total = len;
+  } else if (status == 206) {
+    p = mrb_yabm_dl_field(hdr, "Content-Range");
+    if (p == NULL || strncmp(p, "bytes ", 6) != 0)
+      return 0;
+    p += 6;
+    if (mrb_yabm_dl_num(&p) != *from)
+      return 0;
+    if (*p == '-')
+      ++p;
+    mrb_yabm_dl_num(&p);
+    *total = *p == '/' ? (++p, mrb_yabm_dl_num(&p)) : -1;
+    if (*total < 0 && len >= 0)
+      *total = *from + len;
+  }
+  return status;
+}
+
+/*
+ * download(addr, port, path, sink = nil, offset = 0, timeout = 0,
+ *   host = nil) { |done, total| }
+ * streams the body of GET path into the OTA flash area (nil), a
+ * Buffer, or on the dummy build a file named by a String, hashing it
+ * as it goes.  A non-zero offset resumes with a Range request after
+ * hashing what the sink already holds.  With host the request goes
+ * over https_*.  timeout is the longest wait for data.  The block gets
+ * the progress every DL_PROGRESS ms; an exception from it closes the
+ * connection before it propagates.  Returns [status, length, digest],
+ * the digest nil unless the body was complete, or nil when the
+ * connection failed.  A body larger than the sink raises.
+ */
+static mrb_value mrb_yabm_download(mrb_state *mrb, mrb_value self)
+{
+  mrb_value addr, path, res[3];
+  mrb_value dst = mrb_nil_value();
+  mrb_value host = mrb_nil_value();
+  mrb_value blk = mrb_nil_value();
+  mrb_value arg[3], exc;
+  mrb_int port, offset = 0, timeout = 0;
+  mrb_yabm_sha256 ctx;
+  dl_sink sink;
+  unsigned char digest[32];
+  uint32_t ip[8];
+  long from;
+  int len, hlen, status, tls, type, last, shown, complete, n, ai;
+  mrb_bool raised;
+  const char *err;
+  char *body;
+  mrb_get_args(mrb, "SiS|oiio&", &addr, &port, &path, &dst, &offset,
+    &timeout, &host, &blk);
+
+  tls = !mrb_nil_p(host);
+  if (tls)
+    mrb_str_to_cstr(mrb, host);
+  if (RSTRING_LEN(path) + (tls ? RSTRING_LEN(host) : RSTRING_LEN(addr)) >
+    DL_HDRMAX - 96)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "download path too long");
+  if (offset < 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "negative download offset");
+  type = mrb_yabm_cpaddr(mrb, ip, addr);
+  mrb_yabm_dl_open(mrb, &sink, dst);
+  from = mrb_yabm_dl_truncate(&sink, offset);
+  mrb_yabm_dl_hash(&sink, &ctx, from);
+
+  strcpy(dlhdr, "GET ");
+  strcat(dlhdr, mrb_str_to_cstr(mrb, path));
+  strcat(dlhdr, " HTTP/1.0\r\nHost: ");
+  if (tls) {
+    strcat(dlhdr, RSTRING_PTR(host));
+  } else if (type) {
+    strcat(dlhdr, "[");
+    strcat(dlhdr, RSTRING_PTR(addr));
+    strcat(dlhdr, "]");
+  } else {
+    strcat(dlhdr, RSTRING_PTR(addr));
+  }
+  strcat(dlhdr, "\r\n");
+  if (from > 0) {
+    strcat(dlhdr, "Range: bytes=");
+    mrb_yabm_dl_ltoa(dlhdr + strlen(dlhdr), from);
+    strcat(dlhdr, "-\r\n");
+  }
+  strcat(dlhdr, "\r\n");
+
+  dldone = dlfrom = from;
+  dltotal = -1;
+  dlstart = mrb_yabm_clock();
+  dlbusy = 1;
+  if (tls)
+    len = https_connect(RSTRING_PTR(host), ip, port, dlhdr, type);
+  else
+    len = http_connect(ip, port, dlhdr, type);
+  mrb_yabm_trace(TRACE_HTTP, TRACE_OP_CONNECT, port, len);
+  if (!len) {
+    dlbusy = 0;
+    mrb_yabm_dl_close();
+    return mrb_nil_value();
+  }
+
+  status = 0;
+  complete = 0;
+  hlen = 0;
+  exc = mrb_nil_value();
+  err = NULL;
+  last = shown = dlstart;
+  while (1) {
+    len = tls ? https_read(dlchunk, DL_CHUNK) : http_read(dlchunk, DL_CHUNK);
+    if (len < 0) {
+      complete = status != 0 && dltotal < 0;
+      break;
+    }
+    if (len == 0) {
+      if (timeout > 0 && mrb_yabm_clock() - last >= timeout) {
+        mrb_yabm_trace(TRACE_HTTP, TRACE_OP_TIMEOUT, port,
+          mrb_yabm_clock() - dlstart);
+        break;
+      }
+      delay_ms(1);
+      mrb_yabm_poll();
+      continue;
+    }
+    last = mrb_yabm_clock();
+    body = dlchunk;
+    if (status == 0) {
+      n = len < DL_HDRMAX - 1 - hlen ? len : DL_HDRMAX - 1 - hlen;
+      memcpy(dlhdr + hlen, dlchunk, n);
+      dlhdr[hlen + n] = '\0';
+      body = strstr(dlhdr, "\r\n\r\n");
+      if (body == NULL) {
+        hlen += n;
+        if (hlen == DL_HDRMAX - 1)
+          break;
+        continue;
+      }
+      body[2] = '\0';
+      n = body + 4 - dlhdr - hlen;
+      body = dlchunk + n;
+      len -= n;
+      status = mrb_yabm_dl_response(dlhdr, &from, &dltotal);
+      if (status != 200 && status != 206)
+        break;
+      if (dltotal >= 0 && mrb_yabm_dl_capa(&sink) >= 0 &&
+        dltotal > mrb_yabm_dl_capa(&sink)) {
+        err = "download does not fit the sink";
+        break;
+      }
+      if (from != dlfrom) {
+        dlfrom = from;
+        mrb_yabm_dl_truncate(&sink, 0);
+        mrb_yabm_sha256_init(&ctx);
+      }
+      dldone = from;
+    }
+    if (dltotal >= 0 && len > dltotal - dldone)
+      len = dltotal - dldone;
+    if (len > 0) {
+      n = mrb_yabm_dl_write(&sink, dldone, body, len);
+      if (n < 0) {
+        err = n == -2 ? "download does not fit the sink" :
+          "cannot write download sink";
+        break;
+      }
+      mrb_yabm_sha256_update(&ctx, (unsigned char *)body, len);
+      dldone += len;
+    }
+    if (dltotal >= 0 && dldone >= dltotal) {
+      complete = 1;
+      break;
+    }
+    if (!mrb_nil_p(blk) && last - shown >= DL_PROGRESS) {
+      shown = last;
+      arg[0] = blk;
+      arg[1] = mrb_fixnum_value(dldone);
+      arg[2] = mrb_fixnum_value(dltotal);
+      raised = 0;
+      ai = mrb_gc_arena_save(mrb);
+      exc = mrb_protect(mrb, mrb_yabm_dl_progress,
+        mrb_ary_new_from_values(mrb, 3, arg), &raised);
+      mrb_gc_arena_restore(mrb, ai);
+      if (raised) {
+        mrb_gc_protect(mrb, exc);
+        break;
+      }
+      exc = mrb_nil_value();
+      if (sink.kind == DL_BUFFER && DATA_PTR(dst) == NULL) {
+        err = "buffer released";
+        break;
+      }
+    }
+    mrb_yabm_poll();
+  }
+  if (tls)
+    https_close();
+  else
+    http_close();
+  dlend = mrb_yabm_clock();
+  dlbusy = 0;
+  mrb_yabm_trace(TRACE_HTTP, TRACE_OP_CLOSE, port, dldone - dlfrom);
+#if defined(YABM_DUMMY)
+  if (dlfile != NULL)
+    fflush(dlfile);
+#endif
+  mrb_yabm_dl_close();
+  if (!mrb_nil_p(exc))
+    mrb_exc_raise(mrb, exc);
+  if (err != NULL)
+    mrb_raise(mrb, E_RUNTIME_ERROR, err);
+  if (!mrb_nil_p(blk) && complete) {
+    arg[0] = mrb_fixnum_value(dldone);
+    arg[1] = mrb_fixnum_value(dltotal < 0 ? dldone : dltotal);
+    mrb_yield_argv(mrb, blk, 2, arg);
+  }
+
+  res[0] = mrb_fixnum_value(status);
+  res[1] = mrb_fixnum_value(dldone);
+  res[2] = mrb_nil_value();
+  if (complete) {
+    mrb_yabm_sha256_final(&ctx, digest);
+    res[2] = mrb_str_new(mrb, (char *)digest, sizeof(digest));
+  }
+  return mrb_ary_new_from_values(mrb, 3, res);
+}
+
+/* dlverify(sink, len) returns the SHA-256 of the first len bytes */
+static mrb_value mrb_yabm_dlverify(mrb_state *mrb, mrb_value self)
+{
+  mrb_value dst;
+  mrb_int len;
+  mrb_yabm_sha256 ctx;
+  dl_sink sink;
+  unsigned char digest[32];
+  mrb_get_args(mrb, "oi", &dst, &len);
+
+  mrb_yabm_dl_open(mrb, &sink, dst);
+  mrb_yabm_dl_hash(&sink, &ctx, len);
+  mrb_yabm_dl_close();
+  mrb_yabm_sha256_final(&ctx, digest);
+
+  return mrb_str_new(mrb, (char *)digest, sizeof(digest));
+}
+
+/*
+ * dlstat returns [done, total, bytes per second, ms] of the running or
+ * latest download, the rate over the bytes fetched this time.
+ */
+static mrb_value mrb_yabm_dlstat(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res[4];
+  int ms;
+
+  ms = (dlbusy ? mrb_yabm_clock() : dlend) - dlstart;
+  res[0] = mrb_fixnum_value(dldone);
+  res[1] = mrb_fixnum_value(dltotal);
+  res[2] = mrb_fixnum_value(ms > 0 ?
+    (long)((dldone - dlfrom) * 1000LL / ms) : 0);
+  res[3] = mrb_fixnum_value(ms);
+
+  return mrb_ary_new_from_values(mrb, 4, res);
+}
+
+#endif /* !YABM_NO_HTTP */
+
+void mrb_yabm_download_init(mrb_state *mrb, struct RClass *yabm)
+{
+#if !defined(YABM_NO_HTTP)
+  yabm_define_method(mrb, yabm, "download", mrb_yabm_download,
+    MRB_ARGS_ARG(3, 4) | MRB_ARGS_BLOCK());
+  yabm_define_method(mrb, yabm, "dlverify", mrb_yabm_dlverify,
+    MRB_ARGS_REQ(2));
+  yabm_define_method(mrb, yabm, "dlstat", mrb_yabm_dlstat, MRB_ARGS_NONE());
+#endif
+}
+
+void mrb_yabm_download_final(mrb_state *mrb)
+{
+#if !defined(YABM_NO_HTTP)
+  mrb_yabm_dl_close();
+  dldone = dltotal = dlfrom = 0;
+  dlstart = dlend = 0;
+  dlbusy = 0;
+#endif
+}
@@ -6,9 +6,8 @@
 ** See Copyright Notice in LICENSE
 */
 
-#include <stdio.h>
 #include <string.h>
-#include <unistd.h>
+#include <time.h>
 #include <sys/time.h>
 
 #include "mruby.h"
@@ -21,6 +20,14 @@
 
 #define DONE mrb_gc_arena_restore(mrb, 0);
 
+/* mrb_yabm_dummy_net.c */
+extern long sntpoffset;
+void mrb_yabm_net_final();
+
+/* mrb_yabm_dummy_dev.c */
+void mrb_yabm_dev_init(mrb_state *mrb, struct RClass *yabm);
+void mrb_yabm_dev_final();
+
 #if defined(YABM_DUMMY)
 
 typedef struct {
@@ -32,64 +39,6 @@ static const struct mrb_data_type mrb_yabm_data_type = {
   "mrb_yabm_data", mrb_free,
 };
 
-static uint32_t mrb_yabm_strtoip(mrb_state *mrb, mrb_value str)
-{
-  char *cstr;
-  uint32_t ip;
-  int pos, val;
-
-  ip = 0;
-  pos = 0;
-  val = 0;
-
-  cstr = mrb_str_to_cstr(mrb, str);
-  while (*cstr) {
-    if (*cstr == '.') {
-      ip |= val << (8 * (3 - pos));
-      val = 0;
-      ++pos;
-    } else {
-      val *= 10;
-      val += *cstr - '0';
-    }
-    ++cstr;
-  }
-  ip |= val;
-  return ip;
-}
-
-static mrb_value mrb_yabm_iptostr(mrb_state *mrb, uint32_t ip)
-{
-  char addr[16];
-  int i , val, c, div;
-
-  c = 0;
-  for(i = 0; i < 4; ++i ) {
-    val = (ip >> (8 * (3 - i))) & 0xff;
-    div = val / 100;
-    if (div != 0) {
-      addr[c] = '0' + div;
-      val -= 100 * div;
-      ++c;
-    }
-    div = val / 10;
-    if (div != 0) {
-      addr[c] = '0' + div;
-      val -= 10 * div;
-      ++c;
-    }
-    div = val % 10;
-    addr[c] = '0' + div;
-    ++c;
-    if(i != 3) {
-      addr[c] = '.';
-      ++c;
-    }
-   }
-   addr[c] = '\0';
-   return mrb_str_new_cstr(mrb, addr);
-}
-
 static mrb_value mrb_yabm_init(mrb_state *mrb, mrb_value self)
 {
   mrb_yabm_data *data;
@@ -118,15 +67,6 @@ static mrb_value mrb_yabm_getarch(mrb_state *mrb, mrb_value self)
   return mrb_fixnum_value(data->arch);
 }
 
-static mrb_value mrb_yabm_print(mrb_state *mrb, mrb_value self)
-{
-  mrb_value val;
-  mrb_get_args(mrb, "S", &val);
-  printf(RSTRING_PTR(val));
-  fflush(stdout);
-  return mrb_nil_value();
-}
-
 static mrb_value mrb_yabm_count(mrb_state *mrb, mrb_value self)
 {
   mrb_yabm_data *data = DATA_PTR(self);
@@ -140,75 +80,89 @@ static mrb_value mrb_yabm_count(mrb_state *mrb, mrb_value self)
 static mrb_value mrb_yabm_now(mrb_state *mrb, mrb_value self)
 {
 
-  return mrb_fixnum_value(time(NULL));
+  return mrb_fixnum_value(time(NULL) + sntpoffset);
 }
 
-static mrb_value mrb_yabm_dummy(mrb_state *mrb, mrb_value self)
+unsigned int mrb_yabm_uclock()
 {
-  return mrb_nil_value();
-}
+  struct timeval time_now;
 
-static mrb_value mrb_yabm_dummystr(mrb_state *mrb, mrb_value self)
-{
-  return mrb_str_new_cstr(mrb, "");
+  gettimeofday(&time_now,NULL);
+  return (unsigned int)time_now.tv_sec * 1000000u + time_now.tv_usec;
 }
 
-static mrb_value mrb_yabm_msleep(mrb_state *mrb, mrb_value self)
+static time_t clockbase;
+
+int mrb_yabm_clock()
 {
-  mrb_int val;
-  mrb_get_args(mrb, "i", &val);
-  usleep(val*1000);
+  struct timeval time_now;
 
-  return mrb_fixnum_value(0);
+  gettimeofday(&time_now,NULL);
+  if (clockbase == 0)
+    clockbase = time_now.tv_sec;
+  return (time_now.tv_sec - clockbase) * 1000 + time_now.tv_usec / 1000;
 }
 
 void mrb_mruby_yabm_gem_init(mrb_state *mrb)
 {
   struct RClass *yabm;
+  int start;
+  start = mrb_yabm_clock();
   yabm = mrb_define_class(mrb, "YABM", mrb->object_class);
   MRB_SET_INSTANCE_TT(yabm, MRB_TT_DATA);
 
-  mrb_define_const(mrb, yabm, "MODULE_UNKNOWN", mrb_fixnum_value(MODULE_UNKNOWN));
-  mrb_define_const(mrb, yabm, "MODULE_RTL8196C", mrb_fixnum_value(MODULE_RTL8196C));
-  mrb_define_const(mrb, yabm, "MODULE_BCM4712", mrb_fixnum_value(MODULE_BCM4712));
-  mrb_define_const(mrb, yabm, "MODULE_RTL8196E", mrb_fixnum_value(MODULE_RTL8196E));
-  mrb_define_const(mrb, yabm, "MODULE_BCM5350", mrb_fixnum_value(MODULE_BCM5350));
-  mrb_define_const(mrb, yabm, "MODULE_BCM5352", mrb_fixnum_value(MODULE_BCM5352));
-  mrb_define_const(mrb, yabm, "MODULE_BCM5354", mrb_fixnum_value(MODULE_BCM5354));
-  mrb_define_const(mrb, yabm, "MODULE_ADM5120", mrb_fixnum_value(MODULE_ADM5120));
-  mrb_define_const(mrb, yabm, "MODULE_ADM5120P", mrb_fixnum_value(MODULE_ADM5120P));
-  mrb_define_const(mrb, yabm, "MODULE_KS8695", mrb_fixnum_value(MODULE_KS8695));
-
-  mrb_define_method(mrb, yabm, "initialize", mrb_yabm_init, MRB_ARGS_NONE());
-  mrb_define_method(mrb, yabm, "getarch", mrb_yabm_getarch, MRB_ARGS_NONE());
-  mrb_define_method(mrb, yabm, "print", mrb_yabm_print, MRB_ARGS_REQ(1));
-  mrb_define_method(mrb, yabm, "count", mrb_yabm_count, MRB_ARGS_NONE());
-  mrb_define_method(mrb, yabm, "now", mrb_yabm_now, MRB_ARGS_NONE());
-
-  mrb_define_method(mrb, yabm, "netstart", mrb_yabm_dummy, MRB_ARGS_REQ(4));
-  mrb_define_method(mrb, yabm, "netstartdhcp", mrb_yabm_dummy, MRB_ARGS_NONE());
-  mrb_define_method(mrb, yabm, "getaddress", mrb_yabm_dummystr, MRB_ARGS_NONE());
-  mrb_define_method(mrb, yabm, "lookup", mrb_yabm_dummystr, MRB_ARGS_NONE());
-  mrb_define_method(mrb, yabm, "sntp", mrb_yabm_dummy, MRB_ARGS_REQ(1));
-
-  mrb_define_method(mrb, yabm, "gpiosetsel", mrb_yabm_dummy, MRB_ARGS_REQ(4));
-  mrb_define_method(mrb, yabm, "gpiosetled", mrb_yabm_dummy, MRB_ARGS_REQ(2));
-  mrb_define_method(mrb, yabm, "gpiogetctl", mrb_yabm_dummy, MRB_ARGS_NONE());
-  mrb_define_method(mrb, yabm, "gpiosetctl", mrb_yabm_dummy, MRB_ARGS_REQ(1));
-  mrb_define_method(mrb, yabm, "gpiogetdir", mrb_yabm_dummy, MRB_ARGS_NONE());
-  mrb_define_method(mrb, yabm, "gpiosetdir", mrb_yabm_dummy, MRB_ARGS_REQ(1));
-  mrb_define_method(mrb, yabm, "gpiogetdat", mrb_yabm_dummy, MRB_ARGS_NONE());
-  mrb_define_method(mrb, yabm, "gpiosetdat", mrb_yabm_dummy, MRB_ARGS_REQ(1));
-
-  mrb_define_method(mrb, yabm, "watchdogstart", mrb_yabm_dummy, MRB_ARGS_REQ(1));
-  mrb_define_method(mrb, yabm, "watchdogreset", mrb_yabm_dummy, MRB_ARGS_NONE());
-  mrb_define_method(mrb, yabm, "watchdogstop", mrb_yabm_dummy, MRB_ARGS_NONE());
-  mrb_define_method(mrb, yabm, "msleep", mrb_yabm_msleep, MRB_ARGS_REQ(1));
+
+  yabm_define_method(mrb, yabm, "initialize", mrb_yabm_init, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "getarch", mrb_yabm_getarch, MRB_ARGS_NONE());
+  mrb_yabm_stats_init(mrb, yabm);
+  mrb_yabm_trace_init(mrb, yabm);
+  mrb_yabm_console_init(mrb, yabm);
+  mrb_yabm_gc_init(mrb, yabm);
+  mrb_yabm_buffer_init(mrb, yabm);
+  mrb_yabm_telemetry_init(mrb, yabm);
+  mrb_yabm_mqtt_init(mrb, yabm);
+  yabm_define_method(mrb, yabm, "count", mrb_yabm_count, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "now", mrb_yabm_now, MRB_ARGS_NONE());
+
+  mrb_yabm_net_init(mrb, yabm);
+  mrb_yabm_download_init(mrb, yabm);
+  mrb_yabm_upload_init(mrb, yabm);
+
+  mrb_yabm_mib_init(mrb, yabm);
+  mrb_yabm_mmio_init(mrb, yabm);
+  mrb_yabm_snmp_init(mrb, yabm);
+
+  mrb_yabm_codec_init(mrb, yabm);
+  mrb_yabm_fixed_init(mrb, yabm);
+  mrb_yabm_kv_init(mrb, yabm);
+  mrb_yabm_uart_init(mrb, yabm);
+  mrb_yabm_i2c_init(mrb, yabm);
+  mrb_yabm_gpio_init(mrb, yabm);
+  mrb_yabm_spi_init(mrb, yabm);
+  mrb_yabm_dev_init(mrb, yabm);
+
+  mrb_yabm_wdt_init(mrb, yabm);
+  mrb_yabm_const_init(mrb, yabm, start);
   DONE;
 }
 
 void mrb_mruby_yabm_gem_final(mrb_state *mrb)
 {
+  mrb_yabm_net_final();
+  mrb_yabm_dev_final();
+  mrb_yabm_gc_final(mrb);
+  mrb_yabm_kv_final(mrb);
+  mrb_yabm_download_final(mrb);
+  mrb_yabm_mib_final(mrb);
+  mrb_yabm_snmp_final(mrb);
+  mrb_yabm_mqtt_final(mrb);
+  mrb_yabm_spi_final(mrb);
+  mrb_yabm_gpio_final(mrb);
+  mrb_yabm_buffer_final(mrb);
+  mrb_yabm_trace_final(mrb);
+  mrb_yabm_console_final(mrb);
+  mrb_yabm_uart_final(mrb);
+  mrb_yabm_stats_final(mrb);
 }
 
 #endif /* YABM_DUMMY */
@@ -0,0 +1,779 @@
+/*
+** mrb_yabm_dummy_dev.c - simulated peripherals for the dummy build
+**
+** Implements the bare metal I2C, GPIO, MDIO, MIB and flash entry points
+** on an in-process device model: I2C slaves with register maps and
+** per-byte latency, a GPIO register file that logs writes, PHY registers,
+** switch counters that advance at a configured line rate, NOR flash
+** kept in a file and a sparse file of SoC registers.
+**
+** See Copyright Notice in LICENSE
+*/
+
+#if defined(YABM_DUMMY)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+#define	I2C_SLAVES		8
+#define	GPIO_LOGSIZE		256
+#define	MDIO_PHYS		8
+#define	MIB_PORTS		8
+#define	MIB_SLOTS		(MIB_SIZE / 4)
+#define	MMIO_REGS		256
+
+/* mrb_yabm_dummy_net.c */
+int mrb_yabm_net_brokerstart(int port);
+void mrb_yabm_net_brokerstat(int *pings, int *acks);
+
+static unsigned long long mrb_yabm_dev_us()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void delay_ms(int ms)
+{
+  usleep(ms * 1000);
+}
+
+/* No timer to feed; the supervisor still counts missed windows. */
+void watchdog_start(int ms)
+{
+}
+
+void watchdog_reset()
+{
+}
+
+void watchdog_stop()
+{
+}
+
+void xprintf(const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+}
+
+/* I2C */
+
+typedef struct {
+  int addr;
+  int latency;
+  unsigned char ptr;
+  unsigned char regs[256];
+} i2c_slave;
+
+static i2c_slave slaves[I2C_SLAVES];
+static int i2cslaves;
+static i2c_slave *i2ccur;
+static int i2crd;
+static int i2cfirst;
+
+static i2c_slave *mrb_yabm_i2c_find(int addr)
+{
+  int i;
+
+  for (i = 0; i < i2cslaves; ++i)
+    if (slaves[i].addr == addr)
+      return &slaves[i];
+  return NULL;
+}
+
+static void mrb_yabm_i2c_byte(i2c_slave *dev)
+{
+  if (dev != NULL && dev->latency > 0)
+    usleep(dev->latency);
+}
+
+void i2c_init(int scl, int sda, int u)
+{
+  i2ccur = NULL;
+}
+
+/*
+ * The first byte after a write start sets the register pointer, later
+ * ones store and auto-increment, as on the usual sensor register maps.
+ */
+int i2c_write(unsigned char ch, int start, int stop)
+{
+  int ack;
+
+  if (start) {
+    i2ccur = mrb_yabm_i2c_find(ch >> 1);
+    i2crd = ch & 1;
+    i2cfirst = 1;
+  } else if (i2ccur != NULL && !i2crd) {
+    if (i2cfirst)
+      i2ccur->ptr = ch;
+    else
+      i2ccur->regs[i2ccur->ptr++] = ch;
+    i2cfirst = 0;
+  } else {
+    return 0;
+  }
+  mrb_yabm_i2c_byte(i2ccur);
+  ack = i2ccur != NULL;
+  if (stop)
+    i2ccur = NULL;
+  return ack;
+}
+
+unsigned char i2c_read(int stop)
+{
+  unsigned char val;
+
+  if (i2ccur == NULL || !i2crd)
+    return 0xff;
+  val = i2ccur->regs[i2ccur->ptr++];
+  mrb_yabm_i2c_byte(i2ccur);
+  if (stop)
+    i2ccur = NULL;
+  return val;
+}
+
+/* GPIO, direction bits set are outputs */
+
+typedef struct {
+  unsigned int time;
+  const char *reg;
+  unsigned long val;
+} gpio_write;
+
+static unsigned long gpioctl;
+static unsigned long gpiodir;
+static unsigned long gpiodat;
+static unsigned long gpioin;
+static unsigned long gpioloopout;
+static unsigned long gpioloopin;
+static gpio_write gpiolog[GPIO_LOGSIZE];
+static int gpiohead;
+static int gpiocount;
+
+static void mrb_yabm_gpio_log(const char *reg, unsigned long val)
+{
+  gpiolog[gpiohead].time = mrb_yabm_uclock();
+  gpiolog[gpiohead].reg = reg;
+  gpiolog[gpiohead].val = val;
+  gpiohead = (gpiohead + 1) % GPIO_LOGSIZE;
+  if (gpiocount < GPIO_LOGSIZE)
+    ++gpiocount;
+}
+
+void gpio_setsel(unsigned long sel, unsigned long selmask,
+  unsigned long sel2, unsigned long selmask2)
+{
+  mrb_yabm_gpio_log("sel", sel);
+}
+
+void gpio_setled(int port, unsigned long val)
+{
+  mrb_yabm_gpio_log("led", (port << 16) | (val & 0xffff));
+}
+
+unsigned long gpio_getctl()
+{
+  return gpioctl;
+}
+
+void gpio_setctl(unsigned long val)
+{
+  gpioctl = val;
+  mrb_yabm_gpio_log("ctl", val);
+}
+
+unsigned long gpio_getdir()
+{
+  return gpiodir;
+}
+
+void gpio_setdir(unsigned long val)
+{
+  gpiodir = val;
+  mrb_yabm_gpio_log("dir", val);
+}
+
+unsigned long gpio_getdat()
+{
+  if (gpioloopin != 0)
+    gpioin = (gpiodat & gpioloopout) ? gpioin | gpioloopin :
+      gpioin & ~gpioloopin;
+  return (gpiodat & gpiodir) | (gpioin & ~gpiodir);
+}
+
+void gpio_setdat(unsigned long val)
+{
+  gpiodat = val;
+  mrb_yabm_gpio_log("dat", val);
+}
+
+/* MDIO */
+
+static unsigned short phyregs[MDIO_PHYS][32];
+
+static void mrb_yabm_mdio_reset()
+{
+  int i;
+
+  memset(phyregs, 0, sizeof(phyregs));
+  for (i = 0; i < MDIO_PHYS; ++i) {
+    phyregs[i][0] = 0x3100;
+    phyregs[i][1] = 0x782d;
+    phyregs[i][2] = 0x001c;
+    phyregs[i][3] = 0xc912;
+    phyregs[i][4] = 0x01e1;
+    phyregs[i][5] = 0x45e1;
+  }
+}
+
+int readmdio(unsigned int addr, unsigned int reg, unsigned int *dat)
+{
+  if (addr >= MDIO_PHYS || reg >= 32) {
+    *dat = 0xffff;
+    return -1;
+  }
+  *dat = phyregs[addr][reg];
+  return 0;
+}
+
+/* MIB */
+
+typedef struct {
+  unsigned long base[MIB_SLOTS];
+  unsigned int bytes;
+  unsigned int pkts;
+  unsigned long long start;
+} mib_port;
+
+static mib_port mibs[MIB_PORTS][2];
+
+static int mrb_yabm_mib_sizeslot(unsigned int bytes, unsigned int pkts)
+{
+  unsigned int avg;
+
+  avg = bytes / pkts;
+  if (avg < 64)
+    return MIB_ETHERSTATSUNDERSIZEPKTS;
+  if (avg == 64)
+    return MIB_ETHERSTATSPKTS64OCTETS;
+  if (avg < 128)
+    return MIB_ETHERSTATSPKTS65TO127OCTETS;
+  if (avg < 256)
+    return MIB_ETHERSTATSPKTS128TO255OCTETS;
+  if (avg < 512)
+    return MIB_ETHERSTATSPKTS256TO511OCTETS;
+  if (avg < 1024)
+    return MIB_ETHERSTATSPKTS512TO1023OCTETS;
+  if (avg <= 1518)
+    return MIB_ETHERSTATSPKTS1024TO1518OCTETS;
+  return MIB_ETHERSTATSOVERSIZEPKTS;
+}
+
+/* Counter growth since start, for the slots the rates drive. */
+static unsigned long long mrb_yabm_mib_delta(mib_port *mp, int in, int type)
+{
+  unsigned long long us;
+
+  if (mp->bytes == 0 && mp->pkts == 0)
+    return 0;
+  us = mrb_yabm_dev_us() - mp->start;
+  if (type == MIB_IFINOCTETS || (in && type == MIB_ETHERSTATSOCTETS))
+    return mp->bytes * us / 1000000;
+  if (type == MIB_IFINUCASTPKTS ||
+    (in && mp->pkts != 0 && type == mrb_yabm_mib_sizeslot(mp->bytes, mp->pkts)))
+    return mp->pkts * us / 1000000;
+  return 0;
+}
+
+static mib_port *mrb_yabm_mib_port(int port, int dir)
+{
+  if (port < 0 || port >= MIB_PORTS)
+    return NULL;
+  if (dir == MIB_IN)
+    return &mibs[port][0];
+  if (dir == MIB_OUT)
+    return &mibs[port][1];
+  return NULL;
+}
+
+/* Registers are 32 bit, so the counters wrap like the hardware ones. */
+unsigned long mrb_yabm_mibread(int port, int dir, int type)
+{
+  mib_port *mp;
+
+  mp = mrb_yabm_mib_port(port, dir);
+  if (mp == NULL || type < 0 || type >= MIB_SIZE || (type & 3))
+    return 0;
+  return (mp->base[type / 4] +
+    mrb_yabm_mib_delta(mp, dir == MIB_IN, type)) & 0xffffffff;
+}
+
+static void mrb_yabm_mib_fold(mib_port *mp, int in)
+{
+  int i;
+
+  for (i = 0; i < MIB_SLOTS; ++i)
+    mp->base[i] += mrb_yabm_mib_delta(mp, in, i * 4);
+  mp->start = mrb_yabm_dev_us();
+}
+
+static mib_port *mrb_yabm_mib_arg(mrb_state *mrb, mrb_int port, mrb_int dir)
+{
+  mib_port *mp;
+
+  mp = mrb_yabm_mib_port(port, dir);
+  if (mp == NULL)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid MIB port or direction");
+  return mp;
+}
+
+/*
+ * Flash, the KV area in $YABM_FLASH or yabm_flash.bin and the OTA area
+ * in $YABM_OTA or yabm_ota.bin.  The files grow as they are written and
+ * read as erased past the end.
+ */
+
+#define	FLASH_OTA_SIZE		0x1000000
+
+typedef struct {
+  const char *env;
+  const char *name;
+  int sector;
+  FILE *fp;
+} flash_area;
+
+static flash_area flashkv = { "YABM_FLASH", "yabm_flash.bin", KV_SECTOR };
+static flash_area flashota = { "YABM_OTA", "yabm_ota.bin", OTA_SECTOR };
+
+static FILE *mrb_yabm_flash_file(flash_area *fa)
+{
+  const char *path;
+
+  if (fa->fp != NULL)
+    return fa->fp;
+  path = getenv(fa->env);
+  if (path == NULL)
+    path = fa->name;
+  fa->fp = fopen(path, "r+b");
+  if (fa->fp == NULL)
+    fa->fp = fopen(path, "w+b");
+  return fa->fp;
+}
+
+static int mrb_yabm_flash_read(flash_area *fa, int off, char *buf, int len)
+{
+  FILE *fp;
+
+  memset(buf, 0xff, len);
+  fp = mrb_yabm_flash_file(fa);
+  if (fp == NULL || fseek(fp, off, SEEK_SET) != 0)
+    return 0;
+  fread(buf, 1, len, fp);
+  return len;
+}
+
+/* Fills the file up to off with erased bytes. */
+static int mrb_yabm_flash_extend(FILE *fp, int off)
+{
+  char blank[512];
+  long size;
+  int n;
+
+  if (fseek(fp, 0, SEEK_END) != 0)
+    return -1;
+  memset(blank, 0xff, sizeof(blank));
+  for (size = ftell(fp); size < off; size += n) {
+    n = off - size < sizeof(blank) ? off - size : sizeof(blank);
+    if (fwrite(blank, 1, n, fp) != n)
+      return -1;
+  }
+  return 0;
+}
+
+/* Programming only clears bits, as on NOR flash. */
+static int mrb_yabm_flash_write(flash_area *fa, int off, char *buf, int len)
+{
+  char old[512];
+  FILE *fp;
+  int i, n;
+
+  fp = mrb_yabm_flash_file(fa);
+  if (fp == NULL || mrb_yabm_flash_extend(fp, off) < 0)
+    return -1;
+  for (; len > 0; off += n, buf += n, len -= n) {
+    n = len < sizeof(old) ? len : sizeof(old);
+    mrb_yabm_flash_read(fa, off, old, n);
+    for (i = 0; i < n; ++i)
+      old[i] &= buf[i];
+    if (fseek(fp, off, SEEK_SET) != 0)
+      return -1;
+    fwrite(old, 1, n, fp);
+  }
+  fflush(fp);
+  return 0;
+}
+
+static int mrb_yabm_flash_erase(flash_area *fa, int off)
+{
+  char blank[512];
+  FILE *fp;
+  int i;
+
+  off -= off % fa->sector;
+  fp = mrb_yabm_flash_file(fa);
+  if (fp == NULL || mrb_yabm_flash_extend(fp, off) < 0 ||
+    fseek(fp, off, SEEK_SET) != 0)
+    return -1;
+  memset(blank, 0xff, sizeof(blank));
+  for (i = 0; i < fa->sector; i += sizeof(blank))
+    fwrite(blank, 1, sizeof(blank), fp);
+  fflush(fp);
+  return 0;
+}
+
+int flash_kv_read(int off, char *buf, int len)
+{
+  return mrb_yabm_flash_read(&flashkv, off, buf, len);
+}
+
+int flash_kv_write(int off, char *buf, int len)
+{
+  return mrb_yabm_flash_write(&flashkv, off, buf, len);
+}
+
+int flash_kv_erase(int off)
+{
+  return mrb_yabm_flash_erase(&flashkv, off);
+}
+
+int flash_ota_size()
+{
+  return FLASH_OTA_SIZE;
+}
+
+int flash_ota_read(int off, char *buf, int len)
+{
+  return mrb_yabm_flash_read(&flashota, off, buf, len);
+}
+
+int flash_ota_write(int off, char *buf, int len)
+{
+  return mrb_yabm_flash_write(&flashota, off, buf, len);
+}
+
+int flash_ota_erase(int off)
+{
+  return mrb_yabm_flash_erase(&flashota, off);
+}
+
+#if !defined(YABM_NO_MMIO)
+/* MMIO */
+
+typedef struct {
+  uint32_t addr;
+  uint32_t val;
+  uint32_t next;
+  int at;
+  int pending;
+} mmio_reg;
+
+static mmio_reg mmioregs[MMIO_REGS];
+static int mmiocount;
+
+static mmio_reg *mrb_yabm_mmio_find(uint32_t addr, int add)
+{
+  int i;
+
+  for (i = 0; i < mmiocount; ++i)
+    if (mmioregs[i].addr == addr)
+      return &mmioregs[i];
+  if (!add || mmiocount == MMIO_REGS)
+    return NULL;
+  memset(&mmioregs[mmiocount], 0, sizeof(mmio_reg));
+  mmioregs[mmiocount].addr = addr;
+  return &mmioregs[mmiocount++];
+}
+
+/* registers never written read as 0 */
+uint32_t mmio_read(uint32_t addr)
+{
+  mmio_reg *reg;
+
+  reg = mrb_yabm_mmio_find(addr, 0);
+  if (reg == NULL)
+    return 0;
+  if (reg->pending && mrb_yabm_clock() - reg->at >= 0) {
+    reg->val = reg->next;
+    reg->pending = 0;
+  }
+  return reg->val;
+}
+
+void mmio_write(uint32_t addr, uint32_t val)
+{
+  mmio_reg *reg;
+
+  reg = mrb_yabm_mmio_find(addr, 1);
+  if (reg != NULL)
+    reg->val = val;
+}
+#endif
+
+/* i2csim(addr, regs, latency_us = 0) adds or replaces a slave */
+static mrb_value mrb_yabm_i2csim(mrb_state *mrb, mrb_value self)
+{
+  i2c_slave *dev;
+  mrb_value regs;
+  mrb_int addr, latency = 0;
+  int len;
+  mrb_get_args(mrb, "iS|i", &addr, &regs, &latency);
+
+  dev = mrb_yabm_i2c_find(addr);
+  if (dev == NULL) {
+    if (i2cslaves == I2C_SLAVES)
+      mrb_raise(mrb, E_RUNTIME_ERROR, "too many I2C slaves");
+    dev = &slaves[i2cslaves++];
+  }
+  memset(dev, 0, sizeof(i2c_slave));
+  dev->addr = addr;
+  dev->latency = latency;
+  len = RSTRING_LEN(regs);
+  if (len > sizeof(dev->regs))
+    len = sizeof(dev->regs);
+  memcpy(dev->regs, RSTRING_PTR(regs), len);
+
+  return mrb_fixnum_value(0);
+}
+
+static mrb_value mrb_yabm_i2csimregs(mrb_state *mrb, mrb_value self)
+{
+  i2c_slave *dev;
+  mrb_int addr;
+  mrb_get_args(mrb, "i", &addr);
+
+  dev = mrb_yabm_i2c_find(addr);
+  if (dev == NULL)
+    return mrb_nil_value();
+
+  return mrb_str_new(mrb, (char *)dev->regs, sizeof(dev->regs));
+}
+
+/* gpiosimin(val, mask = all) drives the input pins */
+static mrb_value mrb_yabm_gpiosimin(mrb_state *mrb, mrb_value self)
+{
+  mrb_int val, mask = -1;
+  mrb_get_args(mrb, "i|i", &val, &mask);
+
+  gpioin = (gpioin & ~mask) | (val & mask);
+
+  return mrb_fixnum_value(0);
+}
+
+/* gpiosimloop(out, in) wires output pin out to input pin in, -1 cuts it */
+static mrb_value mrb_yabm_gpiosimloop(mrb_state *mrb, mrb_value self)
+{
+  mrb_int out, in;
+  mrb_get_args(mrb, "ii", &out, &in);
+
+  if (out > 31 || in < 0 || in > 31)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid GPIO pin");
+  gpioloopout = out < 0 ? 0 : 1UL << out;
+  gpioloopin = out < 0 ? 0 : 1UL << in;
+
+  return mrb_fixnum_value(0);
+}
+
+/* gpiosimlog(clear = false) returns [[us, reg, val], ...], oldest first */
+static mrb_value mrb_yabm_gpiosimlog(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res, row;
+  mrb_bool clear = 0;
+  int i, pos;
+  mrb_get_args(mrb, "|b", &clear);
+
+  res = mrb_ary_new_capa(mrb, gpiocount);
+  pos = (gpiohead - gpiocount + GPIO_LOGSIZE) % GPIO_LOGSIZE;
+  for (i = 0; i < gpiocount; ++i) {
+    row = mrb_ary_new_capa(mrb, 3);
+    mrb_ary_push(mrb, row, mrb_fixnum_value(gpiolog[pos].time));
+    mrb_ary_push(mrb, row, mrb_str_new_cstr(mrb, gpiolog[pos].reg));
+    mrb_ary_push(mrb, row, mrb_fixnum_value(gpiolog[pos].val));
+    mrb_ary_push(mrb, res, row);
+    pos = (pos + 1) % GPIO_LOGSIZE;
+  }
+  if (clear) {
+    gpiohead = 0;
+    gpiocount = 0;
+  }
+
+  return res;
+}
+
+static mrb_value mrb_yabm_mdiosim(mrb_state *mrb, mrb_value self)
+{
+  mrb_int port, reg, val;
+  mrb_get_args(mrb, "iii", &port, &reg, &val);
+
+  if (port < 0 || port >= MDIO_PHYS || reg < 0 || reg >= 32)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid PHY register");
+  phyregs[port][reg] = val;
+
+  return mrb_fixnum_value(0);
+}
+
+/*
+ * mibsim(port, dir, bytes_per_sec, pkts_per_sec) sets the line rate.
+ * Octets, unicast packets and, for MIB_IN, the size bucket of the
+ * average frame advance from here on.
+ */
+static mrb_value mrb_yabm_mibsim(mrb_state *mrb, mrb_value self)
+{
+  mib_port *mp;
+  mrb_int port, dir, bytes, pkts;
+  mrb_get_args(mrb, "iiii", &port, &dir, &bytes, &pkts);
+
+  mp = mrb_yabm_mib_arg(mrb, port, dir);
+  mrb_yabm_mib_fold(mp, dir == MIB_IN);
+  mp->bytes = bytes;
+  mp->pkts = pkts;
+
+  return mrb_fixnum_value(0);
+}
+
+/*
+ * regsim(addr, val, after_ms = 0) sets a register, or makes it change
+ * to val after_ms from now as a status bit set by the hardware would.
+ */
+#if !defined(YABM_NO_MMIO)
+static mrb_value mrb_yabm_regsim(mrb_state *mrb, mrb_value self)
+{
+  mmio_reg *reg;
+  mrb_value addr, v;
+  mrb_int after = 0;
+  uint32_t val;
+  mrb_get_args(mrb, "oo|i", &addr, &v, &after);
+
+  val = mrb_yabm_reg_int(mrb, v);
+  reg = mrb_yabm_mmio_find(mrb_yabm_reg_int(mrb, addr), 1);
+  if (reg == NULL)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "register file full");
+  if (after > 0) {
+    reg->next = val;
+    reg->at = mrb_yabm_clock() + after;
+    reg->pending = 1;
+  } else {
+    reg->val = val;
+    reg->pending = 0;
+  }
+
+  return mrb_fixnum_value(0);
+}
+#endif
+
+/*
+ * mqttsim(port) runs a loopback MQTT broker on port, 0 stops it.  It
+ * acknowledges what the client sends but delivers nothing.
+ */
+static mrb_value mrb_yabm_mqttsim(mrb_state *mrb, mrb_value self)
+{
+  mrb_int port;
+  mrb_get_args(mrb, "i", &port);
+
+  if (!mrb_yabm_net_brokerstart(port))
+    mrb_raise(mrb, E_RUNTIME_ERROR, "cannot listen on broker port");
+
+  return mrb_fixnum_value(0);
+}
+
+/* mqttsimstat returns [pingreqs, pubacks] sent by the broker */
+static mrb_value mrb_yabm_mqttsimstat(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res;
+  int pings, acks;
+
+  mrb_yabm_net_brokerstat(&pings, &acks);
+  res = mrb_ary_new_capa(mrb, 2);
+  mrb_ary_push(mrb, res, mrb_fixnum_value(pings));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(acks));
+
+  return res;
+}
+
+/* mibsimset(port, dir, type, val) presets one counter, e.g. near wrap */
+static mrb_value mrb_yabm_mibsimset(mrb_state *mrb, mrb_value self)
+{
+  mib_port *mp;
+  mrb_int port, dir, type, val;
+  mrb_get_args(mrb, "iiii", &port, &dir, &type, &val);
+
+  mp = mrb_yabm_mib_arg(mrb, port, dir);
+  if (type < 0 || type >= MIB_SIZE || (type & 3))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid MIB counter");
+  mrb_yabm_mib_fold(mp, dir == MIB_IN);
+  mp->base[type / 4] = val;
+
+  return mrb_fixnum_value(0);
+}
+
+void mrb_yabm_dev_init(mrb_state *mrb, struct RClass *yabm)
+{
+  memset(mibs, 0, sizeof(mibs));
+  mrb_yabm_mdio_reset();
+
+  yabm_define_method(mrb, yabm, "i2csim", mrb_yabm_i2csim, MRB_ARGS_ARG(2, 1));
+  yabm_define_method(mrb, yabm, "i2csimregs", mrb_yabm_i2csimregs, MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "gpiosimin", mrb_yabm_gpiosimin, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "gpiosimloop", mrb_yabm_gpiosimloop, MRB_ARGS_REQ(2));
+  yabm_define_method(mrb, yabm, "gpiosimlog", mrb_yabm_gpiosimlog, MRB_ARGS_OPT(1));
+  yabm_define_method(mrb, yabm, "mdiosim", mrb_yabm_mdiosim, MRB_ARGS_REQ(3));
+  yabm_define_method(mrb, yabm, "mibsim", mrb_yabm_mibsim, MRB_ARGS_REQ(4));
+  yabm_define_method(mrb, yabm, "mibsimset", mrb_yabm_mibsimset, MRB_ARGS_REQ(4));
+#if !defined(YABM_NO_MMIO)
+  yabm_define_method(mrb, yabm, "regsim", mrb_yabm_regsim, MRB_ARGS_ARG(2, 1));
+#endif
+  yabm_define_method(mrb, yabm, "mqttsim", mrb_yabm_mqttsim, MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "mqttsimstat", mrb_yabm_mqttsimstat, MRB_ARGS_NONE());
+}
+
+void mrb_yabm_dev_final()
+{
+  i2cslaves = 0;
+  i2ccur = NULL;
+  gpioctl = 0;
+  gpiodir = 0;
+  gpiodat = 0;
+  gpioin = 0;
+  gpioloopout = 0;
+  gpioloopin = 0;
+  gpiohead = 0;
+  gpiocount = 0;
+#if !defined(YABM_NO_MMIO)
+  mmiocount = 0;
+#endif
+  if (flashkv.fp != NULL)
+    fclose(flashkv.fp);
+  flashkv.fp = NULL;
+  if (flashota.fp != NULL)
+    fclose(flashota.fp);
+  flashota.fp = NULL;
+}
+
+#endif /* YABM_DUMMY */
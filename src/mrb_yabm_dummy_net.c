@@ -0,0 +1,704 @@
+/*
+** mrb_yabm_dummy_net.c - POSIX socket network stack for the dummy build
+**
+** Implements the bare metal network entry points used by the YABM
+** class on top of real sockets, so scripts can talk to local stand-in
+** servers on a workstation.
+**
+** See Copyright Notice in LICENSE
+*/
+
+#if defined(YABM_DUMMY)
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "mruby.h"
+
+#include "mrb_yabm.h"
+
+#define	NET_CONNTIMEOUT		3000
+
+int netstat;
+long sntpoffset;
+
+static uint32_t myaddress;
+static int udpsock = -1;
+static int httpsock = -1;
+static int tcpsock = -1;
+static int svrsock = -1;
+static int svrclient = -1;
+static int brokersock = -1;
+static int brokerclient = -1;
+static unsigned char brokerbuf[512];
+static int brokerlen;
+static int brokerpings;
+static int brokeracks;
+static uint32_t lookupaddr[8];
+static int lookupstate;
+static int lookupstart;
+static int sntpsock = -1;
+static int sntpstart;
+
+static void mrb_yabm_net_nonblock(int s)
+{
+  fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static socklen_t mrb_yabm_net_sockaddr(struct sockaddr_storage *ss,
+  uint32_t *addr, int port, int type)
+{
+  struct sockaddr_in *sin;
+  struct sockaddr_in6 *sin6;
+  int i;
+
+  memset(ss, 0, sizeof(*ss));
+  if (type == 1) {
+    sin6 = (struct sockaddr_in6 *)ss;
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_port = htons(port);
+    for (i = 0; i < 8; ++i) {
+      sin6->sin6_addr.s6_addr[i * 2] = addr[i] >> 8;
+      sin6->sin6_addr.s6_addr[i * 2 + 1] = addr[i];
+    }
+    return sizeof(*sin6);
+  }
+  sin = (struct sockaddr_in *)ss;
+  sin->sin_family = AF_INET;
+  sin->sin_port = htons(port);
+  sin->sin_addr.s_addr = htonl(addr[0]);
+  return sizeof(*sin);
+}
+
+void net_start(uint32_t addr, uint32_t mask, uint32_t gw, uint32_t dns)
+{
+  myaddress = addr;
+  netstat = 1;
+}
+
+void net_startdhcp()
+{
+  myaddress = INADDR_LOOPBACK;
+  netstat = 1;
+}
+
+uint32_t getmyaddress()
+{
+  return myaddress;
+}
+
+void rtl_udp_init()
+{
+  if (udpsock >= 0)
+    close(udpsock);
+  udpsock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (udpsock >= 0)
+    mrb_yabm_net_nonblock(udpsock);
+}
+
+void rtl_udp_bind(int port)
+{
+  struct sockaddr_in sin;
+  int on = 1;
+
+  if (udpsock < 0)
+    rtl_udp_init();
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+  sin.sin_addr.s_addr = htonl(INADDR_ANY);
+  setsockopt(udpsock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  bind(udpsock, (struct sockaddr *)&sin, sizeof(sin));
+}
+
+int rtl_udp_recv(char *buf, int len)
+{
+  int n;
+
+  if (udpsock < 0)
+    return 0;
+  n = recv(udpsock, buf, len, 0);
+  return n < 0 ? 0 : n;
+}
+
+void rtl_udp_send(int addr, int port, char *buf, int len)
+{
+  struct sockaddr_storage ss;
+  socklen_t sl;
+  uint32_t ip;
+
+  if (udpsock < 0)
+    rtl_udp_init();
+  ip = addr;
+  sl = mrb_yabm_net_sockaddr(&ss, &ip, port, 0);
+  sendto(udpsock, buf, len, 0, (struct sockaddr *)&ss, sl);
+}
+
+/*
+ * Returns a connected, non-blocking TCP socket or -1.  The connect
+ * itself is bounded so a dead stand-in server cannot hang the script.
+ */
+static int mrb_yabm_net_connect(uint32_t *addr, int port, int type)
+{
+  struct sockaddr_storage ss;
+  struct pollfd pfd;
+  socklen_t sl, el;
+  int s, err, on = 1;
+
+  sl = mrb_yabm_net_sockaddr(&ss, addr, port, type);
+  s = socket(ss.ss_family, SOCK_STREAM, 0);
+  if (s < 0)
+    return -1;
+  mrb_yabm_net_nonblock(s);
+  setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  if (connect(s, (struct sockaddr *)&ss, sl) < 0) {
+    if (errno != EINPROGRESS) {
+      close(s);
+      return -1;
+    }
+    pfd.fd = s;
+    pfd.events = POLLOUT;
+    el = sizeof(err);
+    if (poll(&pfd, 1, NET_CONNTIMEOUT) != 1 ||
+      getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &el) < 0 || err != 0) {
+      close(s);
+      return -1;
+    }
+  }
+  return s;
+}
+
+static int mrb_yabm_net_sendall(int s, const char *buf, int len)
+{
+  struct pollfd pfd;
+  int n;
+
+  while (len > 0) {
+    n = send(s, buf, len, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        return -1;
+      pfd.fd = s;
+      pfd.events = POLLOUT;
+      if (poll(&pfd, 1, NET_CONNTIMEOUT) != 1)
+        return -1;
+      continue;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* 1 when some data was read, 0 when nothing is pending, -1 at EOF */
+static int mrb_yabm_net_read(int s, char *buf, int len)
+{
+  int n;
+
+  if (s < 0)
+    return -1;
+  n = recv(s, buf, len, 0);
+  if (n > 0)
+    return n;
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return 0;
+  return -1;
+}
+
+int http_connect(uint32_t *addr, int port, char *header, int type)
+{
+  if (httpsock >= 0)
+    close(httpsock);
+  httpsock = mrb_yabm_net_connect(addr, port, type);
+  if (httpsock < 0)
+    return 0;
+  if (mrb_yabm_net_sendall(httpsock, header, strlen(header)) < 0) {
+    close(httpsock);
+    httpsock = -1;
+    return 0;
+  }
+  return 1;
+}
+
+int http_write(char *buf, int len)
+{
+  int n;
+
+  if (httpsock < 0)
+    return -1;
+  n = send(httpsock, buf, len, MSG_NOSIGNAL);
+  if (n < 0)
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  return n;
+}
+
+/* waits up to 1 ms for data so that the http() loop does not spin */
+int http_read(char *buf, int len)
+{
+  struct pollfd pfd;
+
+  if (httpsock >= 0) {
+    pfd.fd = httpsock;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, 1);
+  }
+  return mrb_yabm_net_read(httpsock, buf, len);
+}
+
+void http_close()
+{
+  if (httpsock >= 0)
+    close(httpsock);
+  httpsock = -1;
+}
+
+/*
+ * Raw TCP connection expected from the firmware as tcp_*, used by the
+ * MQTT client.
+ */
+int tcp_connect(uint32_t *addr, int port, int type)
+{
+  if (tcpsock >= 0)
+    close(tcpsock);
+  tcpsock = mrb_yabm_net_connect(addr, port, type);
+  return tcpsock >= 0;
+}
+
+int tcp_write(char *buf, int len)
+{
+  int n;
+
+  if (tcpsock < 0)
+    return -1;
+  n = send(tcpsock, buf, len, MSG_NOSIGNAL);
+  if (n < 0)
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  return n;
+}
+
+/*
+ * Loopback MQTT broker for the tests, run from tcp_read so that it keeps
+ * up with the client.  It answers CONNECT, SUBSCRIBE, PINGREQ and QoS 1
+ * PUBLISH and drops everything else.
+ */
+static void mrb_yabm_net_brokerpkt(unsigned char *pkt, int hdr, int len)
+{
+  unsigned char res[5];
+  int n, tlen;
+
+  n = 0;
+  switch (pkt[0] & 0xf0) {
+  case 0x10:
+    res[0] = 0x20;
+    res[1] = 2;
+    res[2] = 0;
+    res[3] = 0;
+    n = 4;
+    break;
+  case 0x30:
+    if ((pkt[0] & 0x06) != 0x02 || len < 2)
+      break;
+    tlen = (pkt[hdr] << 8) | pkt[hdr + 1];
+    if (2 + tlen + 2 > len)
+      break;
+    res[0] = 0x40;
+    res[1] = 2;
+    res[2] = pkt[hdr + 2 + tlen];
+    res[3] = pkt[hdr + 3 + tlen];
+    n = 4;
+    ++brokeracks;
+    break;
+  case 0x80:
+    if (len < 2)
+      break;
+    res[0] = 0x90;
+    res[1] = 3;
+    res[2] = pkt[hdr];
+    res[3] = pkt[hdr + 1];
+    res[4] = 0;
+    n = 5;
+    break;
+  case 0xc0:
+    res[0] = 0xd0;
+    res[1] = 0;
+    n = 2;
+    ++brokerpings;
+    break;
+  }
+  if (n > 0)
+    send(brokerclient, res, n, MSG_NOSIGNAL);
+}
+
+static void mrb_yabm_net_broker()
+{
+  int n, i, len, shift, hdr;
+
+  if (brokersock < 0)
+    return;
+  if (brokerclient < 0) {
+    brokerclient = accept(brokersock, NULL, NULL);
+    if (brokerclient < 0)
+      return;
+    mrb_yabm_net_nonblock(brokerclient);
+    brokerlen = 0;
+  }
+  n = recv(brokerclient, brokerbuf + brokerlen, sizeof(brokerbuf) - brokerlen,
+    0);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    close(brokerclient);
+    brokerclient = -1;
+    return;
+  }
+  if (n > 0)
+    brokerlen += n;
+  while (brokerlen > 1) {
+    len = 0;
+    shift = 0;
+    for (i = 1; i < brokerlen && i < 5; ++i) {
+      len |= (brokerbuf[i] & 0x7f) << shift;
+      shift += 7;
+      if ((brokerbuf[i] & 0x80) == 0)
+        break;
+    }
+    hdr = i + 1;
+    if (i == 5 || hdr + len > (int)sizeof(brokerbuf)) {
+      brokerlen = 0;
+      break;
+    }
+    if (i >= brokerlen || hdr + len > brokerlen)
+      break;
+    mrb_yabm_net_brokerpkt(brokerbuf, hdr, len);
+    memmove(brokerbuf, brokerbuf + hdr + len, brokerlen - hdr - len);
+    brokerlen -= hdr + len;
+  }
+}
+
+/* Listens on the loopback port, 0 stops; returns 0 when bind failed. */
+int mrb_yabm_net_brokerstart(int port)
+{
+  struct sockaddr_in sin;
+  int on = 1;
+
+  if (brokerclient >= 0)
+    close(brokerclient);
+  if (brokersock >= 0)
+    close(brokersock);
+  brokerclient = -1;
+  brokersock = -1;
+  brokerpings = 0;
+  brokeracks = 0;
+  if (port == 0)
+    return 1;
+  brokersock = socket(AF_INET, SOCK_STREAM, 0);
+  if (brokersock < 0)
+    return 0;
+  setsockopt(brokersock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(brokersock, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+    listen(brokersock, 1) < 0) {
+    close(brokersock);
+    brokersock = -1;
+    return 0;
+  }
+  mrb_yabm_net_nonblock(brokersock);
+  return 1;
+}
+
+void mrb_yabm_net_brokerstat(int *pings, int *acks)
+{
+  *pings = brokerpings;
+  *acks = brokeracks;
+}
+
+int tcp_read(char *buf, int len)
+{
+  mrb_yabm_net_broker();
+  return mrb_yabm_net_read(tcpsock, buf, len);
+}
+
+void tcp_close()
+{
+  if (tcpsock >= 0)
+    close(tcpsock);
+  tcpsock = -1;
+}
+
+/*
+ * Datagram sockets with the peer address expected from the firmware as
+ * udp_*, used by the SNMP agent.
+ */
+int udp_open(int port)
+{
+  struct sockaddr_in sin;
+  int s, on = 1;
+
+  s = socket(AF_INET, SOCK_DGRAM, 0);
+  if (s < 0)
+    return -1;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+  sin.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(s, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+    close(s);
+    return -1;
+  }
+  mrb_yabm_net_nonblock(s);
+  return s;
+}
+
+int udp_recvfrom(int s, char *buf, int len, uint32_t *addr, int *port)
+{
+  struct sockaddr_in sin;
+  socklen_t slen = sizeof(sin);
+  int n;
+
+  n = recvfrom(s, buf, len, 0, (struct sockaddr *)&sin, &slen);
+  if (n < 0)
+    return 0;
+  *addr = ntohl(sin.sin_addr.s_addr);
+  *port = ntohs(sin.sin_port);
+  return n;
+}
+
+int udp_sendto(int s, uint32_t addr, int port, char *buf, int len)
+{
+  struct sockaddr_storage ss;
+  socklen_t slen;
+
+  slen = mrb_yabm_net_sockaddr(&ss, &addr, port, 0);
+  return sendto(s, buf, len, 0, (struct sockaddr *)&ss, slen);
+}
+
+void udp_close(int s)
+{
+  close(s);
+}
+
+/* No TLS on the dummy build: https talks plain TCP to the stand-in. */
+int https_connect(char *host, uint32_t *addr, int port, char *header,
+  int type)
+{
+  return http_connect(addr, port, header, type);
+}
+
+int https_write(char *buf, int len)
+{
+  return http_write(buf, len);
+}
+
+int https_read(char *buf, int len)
+{
+  return http_read(buf, len);
+}
+
+void https_close()
+{
+  http_close();
+}
+
+void httpsvr_init()
+{
+  if (svrclient >= 0)
+    close(svrclient);
+  if (svrsock >= 0)
+    close(svrsock);
+  svrclient = -1;
+  svrsock = -1;
+}
+
+void httpsvr_bind(int port)
+{
+  struct sockaddr_in sin;
+  int on = 1;
+
+  httpsvr_init();
+  svrsock = socket(AF_INET, SOCK_STREAM, 0);
+  if (svrsock < 0)
+    return;
+  setsockopt(svrsock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+  sin.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(svrsock, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+    listen(svrsock, 8) < 0) {
+    close(svrsock);
+    svrsock = -1;
+    return;
+  }
+  mrb_yabm_net_nonblock(svrsock);
+}
+
+/* The request buffer is 1024 bytes, as in the bare metal server. */
+int httpsvr_copyreq(char *buff)
+{
+  struct pollfd pfd;
+  int n, len;
+
+  if (svrsock < 0 || svrclient >= 0)
+    return 0;
+  svrclient = accept(svrsock, NULL, NULL);
+  if (svrclient < 0)
+    return 0;
+  len = 0;
+  pfd.fd = svrclient;
+  pfd.events = POLLIN;
+  while (len < 1023 && poll(&pfd, 1, NET_CONNTIMEOUT) == 1) {
+    n = recv(svrclient, buff + len, 1023 - len, 0);
+    if (n <= 0)
+      break;
+    len += n;
+    buff[len] = '\0';
+    if (strstr(buff, "\r\n\r\n") != NULL)
+      break;
+  }
+  if (len == 0) {
+    close(svrclient);
+    svrclient = -1;
+  }
+  return len;
+}
+
+void httpsvr_setres(char *buff, int len)
+{
+  if (svrclient < 0)
+    return;
+  mrb_yabm_net_sendall(svrclient, buff, len);
+  close(svrclient);
+  svrclient = -1;
+}
+
+/*
+ * Names are resolved by the host at once.  Names under .invalid are
+ * never answered, standing in for a resolver that has gone away, and
+ * fail after NET_CONNTIMEOUT like the firmware's own retries.
+ */
+int lookup_start(char *host, int type)
+{
+  struct addrinfo hints, *res;
+  unsigned char *p;
+  size_t len;
+  int i;
+
+  lookupstate = 0;
+  lookupstart = mrb_yabm_clock();
+  len = strlen(host);
+  if (len >= 8 && strcmp(host + len - 8, ".invalid") == 0) {
+    lookupstate = -1;
+    return 1;
+  }
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = type == 1 ? AF_INET6 : AF_INET;
+  if (getaddrinfo(host, NULL, &hints, &res) != 0)
+    return 1;
+  if (type == 1) {
+    p = ((struct sockaddr_in6 *)res->ai_addr)->sin6_addr.s6_addr;
+    for (i = 0; i < 8; ++i)
+      lookupaddr[i] = (p[i * 2] << 8) | p[i * 2 + 1];
+  } else {
+    lookupaddr[0] =
+      ntohl(((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr);
+  }
+  freeaddrinfo(res);
+  lookupstate = 1;
+  return 1;
+}
+
+int lookup_poll(uint32_t *addr)
+{
+  if (lookupstate < 0 && mrb_yabm_clock() - lookupstart >= NET_CONNTIMEOUT)
+    lookupstate = 0;
+  if (lookupstate > 0)
+    memcpy(addr, lookupaddr, sizeof(lookupaddr));
+  return lookupstate;
+}
+
+void lookup_cancel()
+{
+  lookupstate = 0;
+}
+
+void sntp_cancel()
+{
+  if (sntpsock >= 0)
+    close(sntpsock);
+  sntpsock = -1;
+}
+
+/* RFC 4330 client mode request; the reply sets the offset used by now */
+int sntp_start(uint32_t *addr, int type)
+{
+  struct sockaddr_storage ss;
+  unsigned char pkt[48];
+  socklen_t sl;
+
+  sntp_cancel();
+  sl = mrb_yabm_net_sockaddr(&ss, addr, 123, type);
+  sntpsock = socket(ss.ss_family, SOCK_DGRAM, 0);
+  if (sntpsock < 0)
+    return 0;
+  mrb_yabm_net_nonblock(sntpsock);
+  memset(pkt, 0, sizeof(pkt));
+  pkt[0] = 0x1b;
+  if (sendto(sntpsock, pkt, sizeof(pkt), 0, (struct sockaddr *)&ss, sl) !=
+    sizeof(pkt)) {
+    sntp_cancel();
+    return 0;
+  }
+  sntpstart = mrb_yabm_clock();
+  return 1;
+}
+
+int sntp_poll()
+{
+  unsigned char pkt[48];
+  uint32_t secs;
+  int n;
+
+  if (sntpsock < 0)
+    return 0;
+  n = recv(sntpsock, pkt, sizeof(pkt), 0);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+    mrb_yabm_clock() - sntpstart < NET_CONNTIMEOUT)
+    return -1;
+  sntp_cancel();
+  if (n != sizeof(pkt))
+    return 0;
+  secs = (pkt[40] << 24) | (pkt[41] << 16) | (pkt[42] << 8) | pkt[43];
+  if (secs == 0)
+    return 0;
+  sntpoffset = (long)(secs - 2208988800U) - (long)time(NULL);
+  return 1;
+}
+
+void mrb_yabm_net_final()
+{
+  http_close();
+  tcp_close();
+  httpsvr_init();
+  mrb_yabm_net_brokerstart(0);
+  lookup_cancel();
+  sntp_cancel();
+  if (udpsock >= 0)
+    close(udpsock);
+  udpsock = -1;
+  netstat = 0;
+}
+
+#endif /* YABM_DUMMY */
@@ -0,0 +1,549 @@
+/*
+** mrb_yabm_fixed.c - fixed-point sample conversion kernels
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+/*
+ * Sample arguments are an Array of Integers, or a String or Buffer of
+ * big-endian samples of width 1, 2 or 4 bytes, negative for signed, as
+ * in tmsamples.  They are copied into a scratch String, which the GC
+ * arena keeps alive for the call, as 64-bit values whatever the size
+ * of mrb_int.  An embedded String is not 8-byte aligned, so the values
+ * start at the first aligned byte of one spare slot.
+ */
+static long long *mrb_yabm_fx_scratch(mrb_state *mrb, mrb_int len)
+{
+  uintptr_t ptr;
+
+  ptr = (uintptr_t)RSTRING_PTR(mrb_str_new(mrb, NULL,
+    (len + 1) * sizeof(long long)));
+  ptr = (ptr + sizeof(long long) - 1) & ~(uintptr_t)(sizeof(long long) - 1);
+  return (long long *)ptr;
+}
+
+static long long *mrb_yabm_fx_samples(mrb_state *mrb, mrb_value data,
+  mrb_int width, mrb_int *count)
+{
+  mrb_value v;
+  unsigned char *ptr;
+  unsigned long val;
+  long long *res;
+  mrb_int i, len;
+  int n, size;
+
+  if (mrb_array_p(data)) {
+    len = RARRAY_LEN(data);
+    res = mrb_yabm_fx_scratch(mrb, len);
+    for (i = 0; i < len; ++i) {
+      v = mrb_ary_ref(mrb, data, i);
+      if (!mrb_integer_p(v))
+        mrb_raise(mrb, E_TYPE_ERROR, "sample is not an Integer");
+      res[i] = mrb_integer(v);
+    }
+    *count = len;
+    return res;
+  }
+
+  size = width < 0 ? -width : width;
+  if (size != 1 && size != 2 && size != 4)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid sample width");
+  ptr = (unsigned char *)mrb_yabm_bytes(mrb, data, &len);
+  len /= size;
+  res = mrb_yabm_fx_scratch(mrb, len);
+  for (i = 0; i < len; ++i) {
+    val = 0;
+    for (n = 0; n < size; ++n)
+      val = (val << 8) | *ptr++;
+    if (width < 0 && (val & (1UL << (size * 8 - 1))))
+      res[i] = -(long long)((~val + 1) & (0xffffffffUL >> (32 - size * 8)));
+    else
+      res[i] = val;
+  }
+  *count = len;
+  return res;
+}
+
+/* x >> shift rounded to nearest, half away from zero */
+static long long mrb_yabm_fx_round(long long x, int shift)
+{
+  if (shift <= 0)
+    return x;
+  if (x < 0)
+    return -((-x + (1LL << (shift - 1))) >> shift);
+  return (x + (1LL << (shift - 1))) >> shift;
+}
+
+static long long mrb_yabm_fx_div(long long x, long long d)
+{
+  if (x < 0)
+    return -((-x + d / 2) / d);
+  return (x + d / 2) / d;
+}
+
+/* Results are worked out in 64 bits and must fit mrb_int. */
+static mrb_value mrb_yabm_fx_value(mrb_state *mrb, long long x)
+{
+  if (x < MRB_INT_MIN || x > MRB_INT_MAX)
+    mrb_raise(mrb, E_RANGE_ERROR, "fixed-point result out of range");
+  return mrb_int_value(mrb, (mrb_int)x);
+}
+
+static int mrb_yabm_fx_shift(mrb_state *mrb, mrb_int shift)
+{
+  if (shift < 0 || shift > 62)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid shift");
+  return shift;
+}
+
+/*
+ * fxscale(data, mul, shift = 0, add = 0, width = 0) returns
+ * (x * mul >> shift) + add for each sample, e.g. a 12-bit ADC count
+ * to millivolts with mul = 3300 * 65536 / 4095 and shift = 16.  An
+ * Integer data gives an Integer.
+ */
+static mrb_value mrb_yabm_fxscale(mrb_state *mrb, mrb_value self)
+{
+  mrb_value data, res;
+  mrb_int mul, shift = 0, add = 0, width = 0;
+  long long *v;
+  mrb_int i, n;
+  int sh;
+  mrb_get_args(mrb, "oi|iii", &data, &mul, &shift, &add, &width);
+
+  sh = mrb_yabm_fx_shift(mrb, shift);
+  if (mrb_integer_p(data))
+    return mrb_yabm_fx_value(mrb, mrb_yabm_fx_round(
+      (long long)mrb_integer(data) * mul, sh) + add);
+  v = mrb_yabm_fx_samples(mrb, data, width, &n);
+  res = mrb_ary_new_capa(mrb, n);
+  for (i = 0; i < n; ++i)
+    mrb_ary_push(mrb, res, mrb_yabm_fx_value(mrb,
+      mrb_yabm_fx_round(v[i] * mul, sh) + add));
+
+  return res;
+}
+
+/*
+ * fxpoly(data, [c0, c1, ...], shift, width = 0) evaluates
+ * c0 + c1 * x + c2 * x**2 ... for each sample, with the coefficients
+ * in Q(shift) and a 64-bit accumulator, and returns it rounded to an
+ * integer.
+ */
+static mrb_value mrb_yabm_fxpoly(mrb_state *mrb, mrb_value self)
+{
+  mrb_value data, coeffs, res, c;
+  mrb_int shift, width = 0;
+  long long *v, acc, k[8];
+  mrb_int i, j, n, nc;
+  int sh;
+  mrb_get_args(mrb, "oAi|i", &data, &coeffs, &shift, &width);
+
+  sh = mrb_yabm_fx_shift(mrb, shift);
+  nc = RARRAY_LEN(coeffs);
+  if (nc < 1 || nc > sizeof(k) / sizeof(k[0]))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "1 to 8 coefficients expected");
+  for (j = 0; j < nc; ++j) {
+    c = mrb_ary_ref(mrb, coeffs, j);
+    if (!mrb_integer_p(c))
+      mrb_raise(mrb, E_TYPE_ERROR, "coefficient is not an Integer");
+    k[j] = mrb_integer(c);
+  }
+  if (mrb_integer_p(data)) {
+    acc = k[nc - 1];
+    for (j = nc - 2; j >= 0; --j)
+      acc = acc * mrb_integer(data) + k[j];
+    return mrb_yabm_fx_value(mrb, mrb_yabm_fx_round(acc, sh));
+  }
+  v = mrb_yabm_fx_samples(mrb, data, width, &n);
+  res = mrb_ary_new_capa(mrb, n);
+  for (i = 0; i < n; ++i) {
+    acc = k[nc - 1];
+    for (j = nc - 2; j >= 0; --j)
+      acc = acc * v[i] + k[j];
+    mrb_ary_push(mrb, res, mrb_yabm_fx_value(mrb, mrb_yabm_fx_round(acc, sh)));
+  }
+
+  return res;
+}
+
+static unsigned long long mrb_yabm_fx_isqrt(unsigned long long x)
+{
+  unsigned long long r, b;
+
+  r = 0;
+  for (b = 1ULL << 62; b > x; b >>= 2)
+    ;
+  while (b != 0) {
+    if (x >= r + b) {
+      x -= r + b;
+      r = (r >> 1) + b;
+    } else {
+      r >>= 1;
+    }
+    b >>= 2;
+  }
+  return r;
+}
+
+/*
+ * fxstats(data, width = 0) returns [count, min, max, mean, stddev],
+ * the mean and the population standard deviation rounded.
+ * An empty data gives [0, nil, nil, nil, nil].
+ */
+static mrb_value mrb_yabm_fxstats(mrb_state *mrb, mrb_value self)
+{
+  mrb_value data, res[5];
+  mrb_int width = 0;
+  long long *v, min, max, sum, mean, d;
+  mrb_int i, n;
+  unsigned long long var, sd;
+  mrb_get_args(mrb, "o|i", &data, &width);
+
+  v = mrb_yabm_fx_samples(mrb, data, width, &n);
+  res[0] = mrb_fixnum_value(n);
+  if (n == 0) {
+    res[1] = res[2] = res[3] = res[4] = mrb_nil_value();
+    return mrb_ary_new_from_values(mrb, 5, res);
+  }
+  min = max = v[0];
+  sum = 0;
+  for (i = 0; i < n; ++i) {
+    if (v[i] < min)
+      min = v[i];
+    if (v[i] > max)
+      max = v[i];
+    sum += v[i];
+  }
+  mean = mrb_yabm_fx_div(sum, n);
+  var = 0;
+  for (i = 0; i < n; ++i) {
+    d = v[i] - mean;
+    var += (unsigned long long)(d * d);
+  }
+  /* taken about the rounded mean, less what that adds */
+  d = sum - mean * n;
+  var = (var - (unsigned long long)(d * d) / n + n / 2) / n;
+  sd = mrb_yabm_fx_isqrt(var);
+  if (var - sd * sd > sd)
+    ++sd;
+  res[1] = mrb_yabm_fx_value(mrb, min);
+  res[2] = mrb_yabm_fx_value(mrb, max);
+  res[3] = mrb_yabm_fx_value(mrb, mean);
+  res[4] = mrb_yabm_fx_value(mrb, (long long)sd);
+
+  return mrb_ary_new_from_values(mrb, 5, res);
+}
+
+static void mrb_yabm_fx_sift(long long *v, mrb_int root, mrb_int n)
+{
+  mrb_int child;
+  long long t;
+
+  while ((child = root * 2 + 1) < n) {
+    if (child + 1 < n && v[child] < v[child + 1])
+      ++child;
+    if (v[root] >= v[child])
+      return;
+    t = v[root];
+    v[root] = v[child];
+    v[child] = t;
+    root = child;
+  }
+}
+
+/* heapsort, the samples are a private copy */
+static void mrb_yabm_fx_sort(long long *v, mrb_int n)
+{
+  mrb_int i;
+  long long t;
+
+  for (i = n / 2 - 1; i >= 0; --i)
+    mrb_yabm_fx_sift(v, i, n);
+  for (i = n - 1; i > 0; --i) {
+    t = v[0];
+    v[0] = v[i];
+    v[i] = t;
+    mrb_yabm_fx_sift(v, 0, i);
+  }
+}
+
+static mrb_value mrb_yabm_fx_rank(mrb_state *mrb, long long *v, mrb_int n,
+  mrb_value p)
+{
+  mrb_int pct, idx;
+
+  if (!mrb_integer_p(p) || mrb_integer(p) < 0 || mrb_integer(p) > 100)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "percentile is not 0 to 100");
+  if (n == 0)
+    return mrb_nil_value();
+  pct = mrb_integer(p);
+  /* nearest rank: the smallest sample with pct% at or below it */
+  idx = (pct * n + 99) / 100;
+  return mrb_yabm_fx_value(mrb, v[idx > 0 ? idx - 1 : 0]);
+}
+
+/*
+ * fxpercentile(data, p, width = 0) returns the nearest-rank p-th
+ * percentile, or an Array of them for an Array of p, sorting once.
+ */
+static mrb_value mrb_yabm_fxpercentile(mrb_state *mrb, mrb_value self)
+{
+  mrb_value data, p, res;
+  mrb_int width = 0;
+  long long *v;
+  mrb_int i, n;
+  mrb_get_args(mrb, "oo|i", &data, &p, &width);
+
+  v = mrb_yabm_fx_samples(mrb, data, width, &n);
+  mrb_yabm_fx_sort(v, n);
+  if (!mrb_array_p(p))
+    return mrb_yabm_fx_rank(mrb, v, n, p);
+  res = mrb_ary_new_capa(mrb, RARRAY_LEN(p));
+  for (i = 0; i < RARRAY_LEN(p); ++i)
+    mrb_ary_push(mrb, res, mrb_yabm_fx_rank(mrb, v, n, mrb_ary_ref(mrb, p, i)));
+
+  return res;
+}
+
+/*
+ * fxdecimate(data, factor, width = 0) returns the rounded mean of each
+ * block of factor samples; an incomplete last block is dropped.
+ */
+static mrb_value mrb_yabm_fxdecimate(mrb_state *mrb, mrb_value self)
+{
+  mrb_value data, res;
+  mrb_int factor, width = 0;
+  long long *v, sum;
+  mrb_int i, j, n;
+  mrb_get_args(mrb, "oi|i", &data, &factor, &width);
+
+  if (factor < 1)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid factor");
+  v = mrb_yabm_fx_samples(mrb, data, width, &n);
+  res = mrb_ary_new_capa(mrb, n / factor);
+  for (i = 0; i + factor <= n; i += factor) {
+    sum = 0;
+    for (j = 0; j < factor; ++j)
+      sum += v[i + j];
+    mrb_ary_push(mrb, res, mrb_yabm_fx_value(mrb, mrb_yabm_fx_div(sum, factor)));
+  }
+
+  return res;
+}
+
+/*
+ * fxmovavg(data, window, width = 0) returns the rounded mean of the last
+ * window samples at each sample, of fewer while the window fills.
+ */
+static mrb_value mrb_yabm_fxmovavg(mrb_state *mrb, mrb_value self)
+{
+  mrb_value data, res;
+  mrb_int window, width = 0;
+  long long *v, sum;
+  mrb_int i, n;
+  mrb_get_args(mrb, "oi|i", &data, &window, &width);
+
+  if (window < 1)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid window");
+  v = mrb_yabm_fx_samples(mrb, data, width, &n);
+  res = mrb_ary_new_capa(mrb, n);
+  sum = 0;
+  for (i = 0; i < n; ++i) {
+    sum += v[i];
+    if (i >= window)
+      sum -= v[i - window];
+    mrb_ary_push(mrb, res, mrb_yabm_fx_value(mrb, mrb_yabm_fx_div(sum,
+      i < window ? i + 1 : window)));
+  }
+
+  return res;
+}
+
+/*
+ * BME280 compensation, the integer formulas of the Bosch datasheet.
+ */
+typedef struct {
+  unsigned short t1;
+  short t2, t3;
+  unsigned short p1;
+  short p2, p3, p4, p5, p6, p7, p8, p9;
+  unsigned char h1, h3;
+  short h2, h4, h5;
+  signed char h6;
+} bme280_calib;
+
+static void mrb_yabm_fx_octets(mrb_state *mrb, mrb_value val, unsigned char *buf,
+  mrb_int len)
+{
+  mrb_value v;
+  unsigned char *ptr;
+  mrb_int i, n;
+
+  if (mrb_array_p(val)) {
+    if (RARRAY_LEN(val) < len)
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "too few bytes");
+    for (i = 0; i < len; ++i) {
+      v = mrb_ary_ref(mrb, val, i);
+      if (!mrb_integer_p(v))
+        mrb_raise(mrb, E_TYPE_ERROR, "byte is not an Integer");
+      buf[i] = mrb_integer(v);
+    }
+    return;
+  }
+  ptr = (unsigned char *)mrb_yabm_bytes(mrb, val, &n);
+  if (n < len)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "too few bytes");
+  memcpy(buf, ptr, len);
+}
+
+#define	LE16(p)	((p)[0] | ((p)[1] << 8))
+
+/* calib is registers 0x88-0xa1 followed by 0xe1-0xe7 */
+static void mrb_yabm_bme280_calib(const unsigned char *c, bme280_calib *cal)
+{
+  cal->t1 = LE16(c);
+  cal->t2 = LE16(c + 2);
+  cal->t3 = LE16(c + 4);
+  cal->p1 = LE16(c + 6);
+  cal->p2 = LE16(c + 8);
+  cal->p3 = LE16(c + 10);
+  cal->p4 = LE16(c + 12);
+  cal->p5 = LE16(c + 14);
+  cal->p6 = LE16(c + 16);
+  cal->p7 = LE16(c + 18);
+  cal->p8 = LE16(c + 20);
+  cal->p9 = LE16(c + 22);
+  cal->h1 = c[25];
+  cal->h2 = LE16(c + 26);
+  cal->h3 = c[28];
+  cal->h4 = (short)((signed char)c[29] * 16) | (c[30] & 0x0f);
+  cal->h5 = (short)((signed char)c[31] * 16) | (c[30] >> 4);
+  cal->h6 = c[32];
+}
+
+static int32_t mrb_yabm_bme280_temp(const bme280_calib *cal, int32_t adc,
+  int32_t *fine)
+{
+  int32_t var1, var2;
+
+  var1 = ((((adc >> 3) - ((int32_t)cal->t1 << 1))) * cal->t2) >> 11;
+  var2 = (((((adc >> 4) - (int32_t)cal->t1) * ((adc >> 4) -
+    (int32_t)cal->t1)) >> 12) * cal->t3) >> 14;
+  *fine = var1 + var2;
+  return (*fine * 5 + 128) >> 8;
+}
+
+/* Pa in Q24.8 */
+static uint32_t mrb_yabm_bme280_press(const bme280_calib *cal, int32_t adc,
+  int32_t fine)
+{
+  long long var1, var2, p;
+
+  var1 = (long long)fine - 128000;
+  var2 = var1 * var1 * cal->p6;
+  var2 = var2 + ((var1 * cal->p5) << 17);
+  var2 = var2 + ((long long)cal->p4 << 35);
+  var1 = ((var1 * var1 * cal->p3) >> 8) + ((var1 * cal->p2) << 12);
+  var1 = ((1LL << 47) + var1) * cal->p1 >> 33;
+  if (var1 == 0)
+    return 0;
+  p = 1048576 - adc;
+  p = (((p << 31) - var2) * 3125) / var1;
+  var1 = ((long long)cal->p9 * (p >> 13) * (p >> 13)) >> 25;
+  var2 = ((long long)cal->p8 * p) >> 19;
+  return ((p + var1 + var2) >> 8) + ((long long)cal->p7 << 4);
+}
+
+/* %RH in Q22.10 */
+static uint32_t mrb_yabm_bme280_hum(const bme280_calib *cal, int32_t adc,
+  int32_t fine)
+{
+  int32_t v;
+
+  v = fine - 76800;
+  v = (((((adc << 14) - ((int32_t)cal->h4 << 20) - ((int32_t)cal->h5 * v)) +
+    16384) >> 15) * (((((((v * (int32_t)cal->h6) >> 10) *
+    (((v * (int32_t)cal->h3) >> 11) + 32768)) >> 10) + 2097152) *
+    (int32_t)cal->h2 + 8192) >> 14));
+  v = v - (((((v >> 15) * (v >> 15)) >> 7) * (int32_t)cal->h1) >> 4);
+  if (v < 0)
+    v = 0;
+  if (v > 419430400)
+    v = 419430400;
+  return v >> 12;
+}
+
+static mrb_value mrb_yabm_bme280_frame(mrb_state *mrb, const bme280_calib *cal,
+  const unsigned char *r)
+{
+  mrb_value res[3];
+  int32_t fine;
+
+  res[0] = mrb_int_value(mrb, mrb_yabm_bme280_temp(cal,
+    (r[3] << 12) | (r[4] << 4) | (r[5] >> 4), &fine));
+  res[1] = mrb_int_value(mrb, mrb_yabm_fx_round(mrb_yabm_bme280_press(cal,
+    (r[0] << 12) | (r[1] << 4) | (r[2] >> 4), fine), 8));
+  res[2] = mrb_int_value(mrb, mrb_yabm_fx_round((long long)
+    mrb_yabm_bme280_hum(cal, (r[6] << 8) | r[7], fine) * 1000, 10));
+
+  return mrb_ary_new_from_values(mrb, 3, res);
+}
+
+/*
+ * bme280(calib, raw) compensates a burst read of registers 0xf7-0xfe
+ * and returns [0.01 degC, Pa, 0.001 %RH].  calib holds the 26 bytes at
+ * 0x88 and the 7 at 0xe1; both may be i2cread Arrays or Strings.  A raw
+ * String of several whole bursts gives an Array of results.
+ */
+static mrb_value mrb_yabm_bme280(mrb_state *mrb, mrb_value self)
+{
+  mrb_value calv, raw, res;
+  bme280_calib cal;
+  unsigned char c[33], r[8];
+  char *ptr;
+  mrb_int i, len;
+  mrb_get_args(mrb, "oo", &calv, &raw);
+
+  mrb_yabm_fx_octets(mrb, calv, c, sizeof(c));
+  mrb_yabm_bme280_calib(c, &cal);
+  ptr = NULL;
+  if (!mrb_array_p(raw))
+    ptr = mrb_yabm_bytes(mrb, raw, &len);
+  if (ptr == NULL || len <= sizeof(r)) {
+    mrb_yabm_fx_octets(mrb, raw, r, sizeof(r));
+    return mrb_yabm_bme280_frame(mrb, &cal, r);
+  }
+  if (len % sizeof(r) != 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "raw is not whole 8 byte bursts");
+  res = mrb_ary_new_capa(mrb, len / sizeof(r));
+  for (i = 0; i + sizeof(r) <= len; i += sizeof(r))
+    mrb_ary_push(mrb, res, mrb_yabm_bme280_frame(mrb, &cal,
+      (unsigned char *)ptr + i));
+
+  return res;
+}
+
+void mrb_yabm_fixed_init(mrb_state *mrb, struct RClass *yabm)
+{
+  yabm_define_method(mrb, yabm, "fxscale", mrb_yabm_fxscale, MRB_ARGS_ARG(2, 3));
+  yabm_define_method(mrb, yabm, "fxpoly", mrb_yabm_fxpoly, MRB_ARGS_ARG(3, 1));
+  yabm_define_method(mrb, yabm, "fxstats", mrb_yabm_fxstats, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "fxpercentile", mrb_yabm_fxpercentile,
+    MRB_ARGS_ARG(2, 1));
+  yabm_define_method(mrb, yabm, "fxdecimate", mrb_yabm_fxdecimate,
+    MRB_ARGS_ARG(2, 1));
+  yabm_define_method(mrb, yabm, "fxmovavg", mrb_yabm_fxmovavg, MRB_ARGS_ARG(2, 1));
+  yabm_define_method(mrb, yabm, "bme280", mrb_yabm_bme280, MRB_ARGS_REQ(2));
+}
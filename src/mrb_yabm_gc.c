@@ -0,0 +1,204 @@
+/*
+** mrb_yabm_gc.c - GC telemetry and idle-time collection
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+#include "mruby/gc.h"
+
+#include "mrb_yabm.h"
+
+#define	GC_DEFBUDGET		1000
+#define	GC_DEFERLIVE		1024
+
+static size_t gclivemax;
+static int gcarenamax;
+static unsigned int gcsteps;
+static unsigned int gcstepmax;
+static unsigned int gccycles;
+static unsigned int gcfulls;
+static unsigned int gcfullmax;
+static unsigned int gctotal;
+static int gcidlebudget;
+static int gcdefer;
+
+static void mrb_yabm_gc_sample(mrb_state *mrb)
+{
+  if (mrb->gc.live > gclivemax)
+    gclivemax = mrb->gc.live;
+  if (mrb->gc.arena_idx > gcarenamax)
+    gcarenamax = mrb->gc.arena_idx;
+}
+
+/*
+ * Hold automatic collection off until GC_DEFERLIVE more objects are
+ * live, so a script that stops sleeping is still collected.
+ */
+static void mrb_yabm_gc_defer(mrb_state *mrb)
+{
+  if (mrb->gc.state == MRB_GC_STATE_ROOT &&
+    mrb->gc.threshold < mrb->gc.live + GC_DEFERLIVE)
+    mrb->gc.threshold = mrb->gc.live + GC_DEFERLIVE;
+}
+
+/*
+ * Run incremental steps until the cycle completes or budget_us is used.
+ * Automatic collection may be disabled, so it is enabled meanwhile.
+ * Returns 1 when the cycle finished.
+ */
+static int mrb_yabm_gc_run(mrb_state *mrb, int budget)
+{
+  unsigned int start, us;
+  mrb_bool disabled;
+
+  if (mrb->gc.iterating)
+    return 0;
+  mrb_yabm_gc_sample(mrb);
+  disabled = mrb->gc.disabled;
+  mrb->gc.disabled = FALSE;
+  start = mrb_yabm_uclock();
+  do {
+    mrb_incremental_gc(mrb);
+    ++gcsteps;
+    us = mrb_yabm_uclock() - start;
+  } while (mrb->gc.state != MRB_GC_STATE_ROOT && us < budget);
+  mrb->gc.disabled = disabled;
+  if (us > gcstepmax)
+    gcstepmax = us;
+  gctotal += us;
+  if (mrb->gc.state != MRB_GC_STATE_ROOT)
+    return 0;
+  ++gccycles;
+  if (gcdefer)
+    mrb_yabm_gc_defer(mrb);
+  return 1;
+}
+
+/*
+ * Called from msleep before each slice.  A cycle is continued, or
+ * started once live objects are half way to the next automatic one.
+ */
+void mrb_yabm_gc_idle(mrb_state *mrb)
+{
+  mrb_yabm_gc_sample(mrb);
+  if (gcidlebudget == 0)
+    return;
+  if (mrb->gc.state != MRB_GC_STATE_ROOT ||
+    mrb->gc.live * 2 >= mrb->gc.live_after_mark + mrb->gc.threshold)
+    mrb_yabm_gc_run(mrb, gcidlebudget);
+}
+
+/*
+ * gcstat(clear = false) returns
+ * [live, live_max, live_after_mark, threshold, arena, arena_max,
+ *  steps, step_us_max, cycles, fulls, full_us_max, gc_us]
+ * The pause figures cover collections run through YABM.
+ */
+static mrb_value mrb_yabm_gcstat(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res;
+  mrb_bool clear = 0;
+  mrb_get_args(mrb, "|b", &clear);
+
+  mrb_yabm_gc_sample(mrb);
+  res = mrb_ary_new_capa(mrb, 12);
+  mrb_ary_push(mrb, res, mrb_fixnum_value(mrb->gc.live));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(gclivemax));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(mrb->gc.live_after_mark));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(mrb->gc.threshold));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(mrb->gc.arena_idx));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(gcarenamax));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(gcsteps));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(gcstepmax));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(gccycles));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(gcfulls));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(gcfullmax));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(gctotal));
+  if (clear) {
+    gclivemax = mrb->gc.live;
+    gcarenamax = mrb->gc.arena_idx;
+    gcsteps = 0;
+    gcstepmax = 0;
+    gccycles = 0;
+    gcfulls = 0;
+    gcfullmax = 0;
+    gctotal = 0;
+  }
+
+  return res;
+}
+
+/* gcstep(budget_us = 1000) */
+static mrb_value mrb_yabm_gcstep(mrb_state *mrb, mrb_value self)
+{
+  mrb_int budget = GC_DEFBUDGET;
+  mrb_get_args(mrb, "|i", &budget);
+
+  return mrb_fixnum_value(mrb_yabm_gc_run(mrb, budget));
+}
+
+static mrb_value mrb_yabm_gcfull(mrb_state *mrb, mrb_value self)
+{
+  unsigned int start, us;
+
+  mrb_yabm_gc_sample(mrb);
+  start = mrb_yabm_uclock();
+  mrb_full_gc(mrb);
+  us = mrb_yabm_uclock() - start;
+  ++gcfulls;
+  if (us > gcfullmax)
+    gcfullmax = us;
+  gctotal += us;
+
+  return mrb_fixnum_value(us);
+}
+
+/*
+ * gcidle(budget_us, defer = false) lets msleep spend up to budget_us
+ * per slice on GC.  With defer, automatic collection waits for
+ * GC_DEFERLIVE new objects after each idle cycle; budget 0 stops it.
+ */
+static mrb_value mrb_yabm_gcidle(mrb_state *mrb, mrb_value self)
+{
+  mrb_int budget;
+  mrb_bool defer = 0;
+  mrb_get_args(mrb, "i|b", &budget, &defer);
+
+  if (budget < 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid GC budget");
+  if (budget == 0)
+    defer = 0;
+  gcidlebudget = budget;
+  gcdefer = defer;
+  if (defer)
+    mrb_yabm_gc_defer(mrb);
+
+  return mrb_fixnum_value(0);
+}
+
+void mrb_yabm_gc_init(mrb_state *mrb, struct RClass *yabm)
+{
+  yabm_define_method(mrb, yabm, "gcstat", mrb_yabm_gcstat, MRB_ARGS_OPT(1));
+  yabm_define_method(mrb, yabm, "gcstep", mrb_yabm_gcstep, MRB_ARGS_OPT(1));
+  yabm_define_method(mrb, yabm, "gcfull", mrb_yabm_gcfull, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "gcidle", mrb_yabm_gcidle, MRB_ARGS_ARG(1, 1));
+}
+
+void mrb_yabm_gc_final(mrb_state *mrb)
+{
+  gcidlebudget = 0;
+  gcdefer = 0;
+  gclivemax = 0;
+  gcarenamax = 0;
+  gcsteps = 0;
+  gcstepmax = 0;
+  gccycles = 0;
+  gcfulls = 0;
+  gcfullmax = 0;
+  gctotal = 0;
+}
@@ -0,0 +1,317 @@
+/*
+** mrb_yabm_gpio.c - GPIO register methods
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+#if defined(YABM_REALTEK) || defined(YABM_DUMMY)
+void gpio_setsel(unsigned long sel, unsigned long selmask,
+unsigned long sel2, unsigned long selmask2);
+#endif
+unsigned long gpio_getctl();
+void gpio_setctl(unsigned long val);
+unsigned long gpio_getdir();
+void gpio_setdir(unsigned long val);
+unsigned long gpio_getdat();
+void gpio_setdat(unsigned long val);
+void delay_ms(int ms);
+
+#if !defined(YABM_NO_GPIO)
+
+#if defined(YABM_REALTEK) || defined(YABM_DUMMY)
+static mrb_value mrb_yabm_gpiosetsel(mrb_state *mrb, mrb_value self)
+{
+  mrb_int sel, selmask, sel2, selmask2;
+  mrb_get_args(mrb, "iiii", &sel, &selmask, &sel2, &selmask2);
+
+  gpio_setsel(sel, selmask, sel2, selmask2);
+
+  return mrb_fixnum_value(0);
+}
+#endif
+
+#if defined(YABM_ADMTEK) || defined(YABM_DUMMY)
+void gpio_setled(int port, unsigned long val);
+
+static mrb_value mrb_yabm_gpiosetled(mrb_state *mrb, mrb_value self)
+{
+  mrb_int port, val;
+  mrb_get_args(mrb, "ii", &port, &val);
+
+  gpio_setled(port, val);
+
+  return mrb_fixnum_value(0);
+}
+#endif
+
+static mrb_value mrb_yabm_gpiogetctl(mrb_state *mrb, mrb_value self)
+{
+  return mrb_fixnum_value(gpio_getctl());
+}
+
+static mrb_value mrb_yabm_gpiosetctl(mrb_state *mrb, mrb_value self)
+{
+  mrb_int val;
+  mrb_get_args(mrb, "i", &val);
+  gpio_setctl(val);
+  mrb_yabm_trace(TRACE_GPIO, TRACE_OP_SETCTL, val, 0);
+
+  return mrb_fixnum_value(0);
+}
+
+static mrb_value mrb_yabm_gpiogetdir(mrb_state *mrb, mrb_value self)
+{
+  return mrb_fixnum_value(gpio_getdir());
+}
+
+static mrb_value mrb_yabm_gpiosetdir(mrb_state *mrb, mrb_value self)
+{
+  mrb_int val;
+  mrb_get_args(mrb, "i", &val);
+  gpio_setdir(val);
+  mrb_yabm_trace(TRACE_GPIO, TRACE_OP_SETDIR, val, 0);
+
+  return mrb_fixnum_value(0);
+}
+
+static mrb_value mrb_yabm_gpiogetdat(mrb_state *mrb, mrb_value self)
+{
+  return mrb_fixnum_value(gpio_getdat());
+}
+
+static mrb_value mrb_yabm_gpiosetdat(mrb_state *mrb, mrb_value self)
+{
+  mrb_int val;
+  mrb_get_args(mrb, "i", &val);
+  gpio_setdat(val);
+  mrb_yabm_trace(TRACE_GPIO, TRACE_OP_WRITE, val, 0);
+
+  return mrb_fixnum_value(0);
+}
+
+#define	GPIO_PINS		32
+#define	GPIO_EVENTS		64
+
+typedef struct {
+  int time;
+  unsigned char pin;
+  unsigned char level;
+} gpio_event;
+
+static unsigned long monmask;
+static unsigned long monstate;
+static unsigned long monpending;
+static unsigned int moninterval;
+static unsigned int monlast;
+static unsigned long monfixed;
+static unsigned char monthresh[GPIO_PINS];
+static unsigned char moncnt[GPIO_PINS];
+static unsigned int moncount[GPIO_PINS];
+static gpio_event monq[GPIO_EVENTS];
+static int monhead;
+static int monqcount;
+static unsigned int monlost;
+
+/*
+ * A pin changes state after its threshold of consecutive samples at the
+ * new level.  Only pins that differ from their state, or were about to
+ * change, are looked at.
+ */
+static void mrb_yabm_gpio_sample()
+{
+  unsigned long raw, diff, bit;
+  int pin;
+
+  raw = gpio_getdat() & monmask;
+  diff = (raw ^ monstate) | monpending;
+  if (diff == 0)
+    return;
+  for (pin = 0; pin < GPIO_PINS; ++pin) {
+    bit = 1UL << pin;
+    if ((diff & bit) == 0)
+      continue;
+    if (((raw ^ monstate) & bit) == 0) {
+      moncnt[pin] = 0;
+      monpending &= ~bit;
+      continue;
+    }
+    if (++moncnt[pin] < monthresh[pin]) {
+      monpending |= bit;
+      continue;
+    }
+    moncnt[pin] = 0;
+    monpending &= ~bit;
+    monstate ^= bit;
+    if (raw & bit)
+      ++moncount[pin];
+    monq[monhead].time = mrb_yabm_clock();
+    monq[monhead].pin = pin;
+    monq[monhead].level = (raw & bit) != 0;
+    monhead = (monhead + 1) % GPIO_EVENTS;
+    if (monqcount < GPIO_EVENTS)
+      ++monqcount;
+    else
+      ++monlost;
+  }
+}
+
+/*
+ * Called from mrb_yabm_poll.  Returns 1 while pins are watched so msleep
+ * uses short slices; samples are only taken at these wait points.
+ */
+int mrb_yabm_gpio_poll()
+{
+  unsigned int now;
+
+  if (monmask == 0)
+    return 0;
+  now = mrb_yabm_uclock();
+  if (now - monlast >= moninterval) {
+    monlast = now;
+    mrb_yabm_gpio_sample();
+  }
+  return 1;
+}
+
+/*
+ * gpiowatch(mask, interval_us = 1000, debounce = 3) samples the masked
+ * input pins at most every interval_us and reports a level after
+ * debounce equal samples, or the count set with gpiodebounce for that
+ * pin.  mask 0 stops watching.
+ */
+static mrb_value mrb_yabm_gpiowatch(mrb_state *mrb, mrb_value self)
+{
+  mrb_int mask, interval = 1000, debounce = 3;
+  int pin;
+  mrb_get_args(mrb, "i|ii", &mask, &interval, &debounce);
+
+  if (interval < 0 || debounce < 1 || debounce > 255)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid GPIO watch parameter");
+  for (pin = 0; pin < GPIO_PINS; ++pin) {
+    if ((monfixed & (1UL << pin)) == 0)
+      monthresh[pin] = debounce;
+    moncnt[pin] = 0;
+    moncount[pin] = 0;
+  }
+  monmask = mask;
+  monstate = gpio_getdat() & monmask;
+  monpending = 0;
+  moninterval = interval;
+  monlast = mrb_yabm_uclock();
+  monhead = 0;
+  monqcount = 0;
+  monlost = 0;
+
+  return mrb_fixnum_value(monstate);
+}
+
+/* gpiodebounce(pin, samples) sets a per-pin threshold, kept by gpiowatch */
+static mrb_value mrb_yabm_gpiodebounce(mrb_state *mrb, mrb_value self)
+{
+  mrb_int pin, debounce;
+  mrb_get_args(mrb, "ii", &pin, &debounce);
+
+  if (pin < 0 || pin >= GPIO_PINS || debounce < 1 || debounce > 255)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid GPIO debounce");
+  monthresh[pin] = debounce;
+  monfixed |= 1UL << pin;
+
+  return mrb_fixnum_value(0);
+}
+
+/*
+ * gpioevents(timeout = 0) returns [[ms, pin, level], ...] oldest first,
+ * waiting up to timeout ms for the first one.
+ */
+static mrb_value mrb_yabm_gpioevents(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res, ev;
+  mrb_int timeout = 0;
+  int i, pos, start;
+  mrb_get_args(mrb, "|i", &timeout);
+
+  start = mrb_yabm_clock();
+  mrb_yabm_poll();
+  while (monqcount == 0 && monmask != 0 && timeout > 0 &&
+    mrb_yabm_clock() - start < timeout) {
+    delay_ms(1);
+    mrb_yabm_poll();
+  }
+  res = mrb_ary_new_capa(mrb, monqcount);
+  pos = (monhead - monqcount + GPIO_EVENTS) % GPIO_EVENTS;
+  for (i = 0; i < monqcount; ++i) {
+    ev = mrb_ary_new_capa(mrb, 3);
+    mrb_ary_push(mrb, ev, mrb_fixnum_value(monq[pos].time));
+    mrb_ary_push(mrb, ev, mrb_fixnum_value(monq[pos].pin));
+    mrb_ary_push(mrb, ev, mrb_fixnum_value(monq[pos].level));
+    mrb_ary_push(mrb, res, ev);
+    pos = (pos + 1) % GPIO_EVENTS;
+  }
+  monqcount = 0;
+
+  return res;
+}
+
+/* gpiopulses(pin, clear = false) counts debounced rising edges */
+static mrb_value mrb_yabm_gpiopulses(mrb_state *mrb, mrb_value self)
+{
+  mrb_int pin;
+  mrb_bool clear = 0;
+  unsigned int n;
+  mrb_get_args(mrb, "i|b", &pin, &clear);
+
+  if (pin < 0 || pin >= GPIO_PINS)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid GPIO pin");
+  mrb_yabm_poll();
+  n = moncount[pin];
+  if (clear)
+    moncount[pin] = 0;
+
+  return mrb_fixnum_value(n);
+}
+
+#else
+int mrb_yabm_gpio_poll()
+{
+  return 0;
+}
+#endif /* !YABM_NO_GPIO */
+
+void mrb_yabm_gpio_init(mrb_state *mrb, struct RClass *yabm)
+{
+#if !defined(YABM_NO_GPIO)
+#if defined(YABM_REALTEK) || defined(YABM_DUMMY)
+  yabm_define_method(mrb, yabm, "gpiosetsel", mrb_yabm_gpiosetsel, MRB_ARGS_REQ(4));
+#endif
+#if defined(YABM_ADMTEK) || defined(YABM_DUMMY)
+  yabm_define_method(mrb, yabm, "gpiosetled", mrb_yabm_gpiosetled, MRB_ARGS_REQ(2));
+#endif
+  yabm_define_method(mrb, yabm, "gpiogetctl", mrb_yabm_gpiogetctl, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "gpiosetctl", mrb_yabm_gpiosetctl, MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "gpiogetdir", mrb_yabm_gpiogetdir, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "gpiosetdir", mrb_yabm_gpiosetdir, MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "gpiogetdat", mrb_yabm_gpiogetdat, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "gpiosetdat", mrb_yabm_gpiosetdat, MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "gpiowatch", mrb_yabm_gpiowatch, MRB_ARGS_ARG(1, 2));
+  yabm_define_method(mrb, yabm, "gpiodebounce", mrb_yabm_gpiodebounce, MRB_ARGS_REQ(2));
+  yabm_define_method(mrb, yabm, "gpioevents", mrb_yabm_gpioevents, MRB_ARGS_OPT(1));
+  yabm_define_method(mrb, yabm, "gpiopulses", mrb_yabm_gpiopulses, MRB_ARGS_ARG(1, 1));
+#endif
+}
+
+void mrb_yabm_gpio_final(mrb_state *mrb)
+{
+#if !defined(YABM_NO_GPIO)
+  monmask = 0;
+  monfixed = 0;
+  monqcount = 0;
+#endif
+}
@@ -0,0 +1,248 @@
+/*
+** mrb_yabm_i2c.c - I2C master methods
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+void delay_ms(int);
+void xprintf (const char* fmt, ...);
+
+void i2c_init(int scl, int sda, int u);
+int i2c_write(unsigned char ch, int start, int stop);
+unsigned char i2c_read(int stop);
+
+#if !defined(YABM_NO_I2C)
+
+/*
+ * Probes only the devices in the bus map stored by the last scan, and
+ * returns 1 when all of them answer.
+ */
+static int mrb_yabm_i2c_cached(const char *key, unsigned char *map)
+{
+  int i;
+
+  if (mrb_yabm_kv_get(key, 6, (char *)map, 16) != 16)
+    return 0;
+  for (i = 0; i < 0x80; ++i)
+    if ((map[i / 8] & (1 << (i % 8))) && !i2c_write(i << 1, 1, 1))
+      return 0;
+  for (i = 0; i < 0x80; ++i)
+    if (map[i / 8] & (1 << (i % 8)))
+      xprintf("I2C find %x\r\n", i);
+  return 1;
+}
+
+/*
+ * i2cinit(scl, sda, u, cached = false) scans the bus, which takes over a
+ * second, and keeps the map in the KV store.  With cached a stored map
+ * whose devices all answer replaces the scan.
+ */
+static mrb_value mrb_yabm_i2cinit(mrb_state *mrb, mrb_value self)
+{
+  int res, i;
+  mrb_int scl, sda, u;
+  mrb_bool cached = 0;
+  unsigned char map[16];
+  char key[6];
+  mrb_get_args(mrb, "iii|b", &scl, &sda, &u, &cached);
+
+  res = 0;
+  i2c_init(scl, sda, u);
+  memcpy(key, "i2c:", 4);
+  key[4] = scl;
+  key[5] = sda;
+  if (cached && mrb_yabm_i2c_cached(key, map)) {
+    for (i = 0; i < 16; ++i)
+      if (map[i])
+        res = 1;
+    mrb_yabm_trace(TRACE_I2C, TRACE_OP_START, (scl << 8) | sda, res);
+    return mrb_fixnum_value(res);
+  }
+  memset(map, 0, sizeof(map));
+  for(i = 0; i < 0x80; ++i) {
+    if(i2c_write(i << 1, 1, 1)) {
+      res = 1;
+      map[i / 8] |= 1 << (i % 8);
+      xprintf("I2C find %x\r\n", i);
+     }
+     delay_ms(10);
+     mrb_yabm_poll();
+   }
+  mrb_yabm_kv_put(key, 6, (char *)map, sizeof(map));
+  mrb_yabm_trace(TRACE_I2C, TRACE_OP_START, (scl << 8) | sda, res);
+
+  return mrb_fixnum_value(res);
+}
+
+static mrb_value mrb_yabm_i2cchk(mrb_state *mrb, mrb_value self)
+{
+  int res;
+  mrb_int addr;
+  mrb_get_args(mrb, "i", &addr);
+
+ if(i2c_write(addr << 1, 1, 1))
+   res = 1;
+  else
+   res = 0;
+  mrb_yabm_trace(TRACE_I2C, TRACE_OP_PROBE, addr, res);
+
+  return mrb_fixnum_value(res);
+}
+
+static mrb_value mrb_yabm_i2cread(mrb_state *mrb, mrb_value self)
+{
+  int i, size, val, err;
+  mrb_int addr, len;
+  mrb_value arg, arr, res;
+
+  err = 0;
+  mrb_get_args(mrb, "ii|o", &addr, &len, &arg);
+  if (mrb_get_argc(mrb) == 3) {
+    if (mrb_type(arg) == MRB_TT_INTEGER) {
+      arr = mrb_ary_new(mrb);
+      mrb_ary_push(mrb, arr, mrb_fixnum_value(mrb_integer(arg)));
+    } else {
+      arr = arg;
+    }
+    size = RARRAY_LEN( arr );
+    if (i2c_write((addr << 1) | 0, 1, 0)) {
+      for (i = 0;i < size - 1; ++i) {
+        if (!i2c_write(mrb_fixnum( mrb_ary_ref( mrb, arr, i ) ), 0, 0)) {
+          err = 1;
+          break;
+        }
+      }
+      i2c_write(mrb_fixnum( mrb_ary_ref( mrb, arr, i ) ),  0, 1);
+    } else {
+      err = 1;
+    }
+  }
+  delay_ms(10);
+  if(err == 0 && i2c_write((addr << 1) | 1, 1, 0)) {
+    if (len == 1) {
+      res = mrb_fixnum_value(i2c_read(1));
+    } else {
+      res = mrb_ary_new(mrb);
+      for (i = 0;i < len; ++i) {
+        val = i2c_read(i == len - 1 ? 1 : 0);
+        mrb_ary_push(mrb, res, mrb_fixnum_value(val));
+      }
+    }
+  } else {
+    err = 1;
+  }
+
+  mrb_yabm_trace(TRACE_I2C, TRACE_OP_READ, addr, err ? -1 : len);
+  if (err)
+    return mrb_nil_value();
+  else
+    return res;
+}
+
+static mrb_value mrb_yabm_i2cwrite(mrb_state *mrb, mrb_value self)
+{
+  int res, len, i;
+  mrb_int addr, reg, val;
+  mrb_value arr;
+
+  res = 0;
+  if (mrb_get_argc(mrb) == 3) {
+    mrb_get_args(mrb, "ii|i", &addr, &reg, &val);
+    if(i2c_write((addr << 1) | 0, 1, 0)) {
+      if(i2c_write(reg, 0, 0)) {
+        if(i2c_write(val, 0, 1)) {
+          res = 1;
+        }
+      }
+    }
+  } else {
+    mrb_get_args(mrb, "iA", &addr, &arr);
+    len = RARRAY_LEN( arr );
+    if (i2c_write((addr << 1) | 0, 1, 0)) {
+      for (i = 0;i < len - 1; ++i) {
+        if (!i2c_write(mrb_fixnum( mrb_ary_ref( mrb, arr, i ) ), 0, 0)) {
+          break;
+        }
+        ++res;
+      }
+      if (i == len - 1 &&
+        i2c_write(mrb_fixnum( mrb_ary_ref( mrb, arr, i ) ), 0, 1))
+        ++res;
+    }
+  }
+  mrb_yabm_trace(TRACE_I2C, TRACE_OP_WRITE, addr, res);
+  return mrb_fixnum_value(res);
+}
+
+#if 0
+static mrb_value mrb_yabm_i2cwrites(mrb_state *mrb, mrb_value self)
+{
+  mrb_int addr, rep;
+  mrb_value arr;
+  int len;
+  int i;
+  int res;
+
+  res = 0;
+  mrb_get_args(mrb, "iAi", &addr, &arr, &rep);
+  len = RARRAY_LEN( arr );
+  if (i2c_write((addr << 1) | 0, 1, 0)) {
+    for (i = 0;i < len - 1; ++i) {
+      if (!i2c_write(mrb_fixnum( mrb_ary_ref( mrb, arr, i ) ), 0, 0)) {
+        break;
+      }
+    }
+    if (i2c_write(mrb_fixnum( mrb_ary_ref( mrb, arr, i ) ), rep ? 0 : 1, 1))
+      res = 1;
+  }
+
+  return mrb_fixnum_value(res);
+}
+
+static mrb_value mrb_yabm_i2creads(mrb_state *mrb, mrb_value self)
+{
+  mrb_int addr, len;
+  mrb_value arr;
+  int i;
+  int val;
+
+  mrb_get_args(mrb, "ii", &addr, &len);
+  if(i2c_write((addr << 1) | 1, 1, 0)) {
+    arr = mrb_ary_new(mrb);
+    for (i = 0;i < len; ++i) {
+      val = i2c_read(i == len - 1 ? 1 : 0);
+      mrb_ary_push(mrb, arr, mrb_fixnum_value(val));
+    }
+  } else {
+    return mrb_nil_value();
+  }
+
+  return arr;
+}
+#endif
+
+#endif /* !YABM_NO_I2C */
+
+void mrb_yabm_i2c_init(mrb_state *mrb, struct RClass *yabm)
+{
+#if !defined(YABM_NO_I2C)
+  yabm_define_method(mrb, yabm, "i2cinit", mrb_yabm_i2cinit, MRB_ARGS_ARG(3, 1));
+  yabm_define_method(mrb, yabm, "i2cchk", mrb_yabm_i2cchk, MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "i2cread", mrb_yabm_i2cread, MRB_ARGS_ARG(2, 1));
+  yabm_define_method(mrb, yabm, "i2cwrite", mrb_yabm_i2cwrite, MRB_ARGS_ARG(2, 1));
+#if 0
+  yabm_define_method(mrb, yabm, "i2cwrites", mrb_yabm_i2cwrites, MRB_ARGS_REQ(3));
+  yabm_define_method(mrb, yabm, "i2creads", mrb_yabm_i2creads, MRB_ARGS_REQ(2));
+#endif
+#endif
+}
@@ -0,0 +1,505 @@
+/*
+** mrb_yabm_kv.c - key-value store on flash with wear leveling
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+#if defined(YABM_DUMMY) || defined(YABM_FLASH)
+
+/*
+ * KV_SECTORS erase blocks of KV_SECTOR bytes set aside for the store,
+ * from the firmware as flash_kv_*.  Offsets are relative to the area.
+ * Erased flash reads 0xff and a write can only clear bits.
+ */
+int flash_kv_read(int off, char *buf, int len);
+int flash_kv_write(int off, char *buf, int len);
+int flash_kv_erase(int off);
+
+/*
+ * Each sector starts with "YKV" 1 and a big-endian sequence number,
+ * the highest valid one being the active sector.  Records follow, 4
+ * byte aligned: magic, key length, value length (2), CRC-32 (4) over
+ * the first 4 bytes, key and value, then the key and the value.  A
+ * delete is a record with KV_DELETE magic and no value.  When the active sector is
+ * full, the live records are copied to the next sector in turn and its
+ * header is written last, so a power cut keeps the old sector.
+ */
+#define	KV_HDRSIZE		8
+#define	KV_RECORD		0x5a
+#define	KV_DELETE		0xa5
+
+typedef struct {
+  unsigned long hash;
+  int off;
+  int size;
+} kv_entry;
+
+static kv_entry kvindex[KV_KEYS];
+static int kvcount;
+static int kvmounted;
+static int kvactive;
+static unsigned long kvseq;
+static int kvfree;
+static int kvlive;
+static unsigned int kverases;
+static unsigned int kvcompactions;
+static char kvbuf[KV_HDRSIZE + KV_KEYMAX + KV_VALMAX];
+
+static int mrb_yabm_kv_size(int klen, int vlen)
+{
+  return (KV_HDRSIZE + klen + vlen + 3) & ~3;
+}
+
+static unsigned long mrb_yabm_kv_crc(const char *rec, int klen, int vlen)
+{
+  unsigned long crc;
+
+  crc = mrb_yabm_crc32(0, (const unsigned char *)rec, 4);
+  return mrb_yabm_crc32(crc, (const unsigned char *)rec + KV_HDRSIZE,
+    klen + vlen);
+}
+
+/*
+ * Reads the record at off into kvbuf.  Returns its size, 0 at erased
+ * space, or -1 for a torn or corrupt record.
+ */
+static int mrb_yabm_kv_load(int off)
+{
+  unsigned char *rec = (unsigned char *)kvbuf;
+  unsigned long crc;
+  int klen, vlen;
+
+  if (off + KV_HDRSIZE > KV_SECTOR)
+    return 0;
+  flash_kv_read(kvactive * KV_SECTOR + off, kvbuf, KV_HDRSIZE);
+  if (rec[0] == 0xff)
+    return 0;
+  klen = rec[1];
+  vlen = (rec[2] << 8) | rec[3];
+  if ((rec[0] != KV_RECORD && rec[0] != KV_DELETE) || klen == 0 ||
+    klen > KV_KEYMAX || vlen > KV_VALMAX ||
+    off + mrb_yabm_kv_size(klen, vlen) > KV_SECTOR)
+    return -1;
+  flash_kv_read(kvactive * KV_SECTOR + off + KV_HDRSIZE,
+    kvbuf + KV_HDRSIZE, klen + vlen);
+  crc = ((unsigned long)rec[4] << 24) | (rec[5] << 16) | (rec[6] << 8) |
+    rec[7];
+  if (crc != mrb_yabm_kv_crc(kvbuf, klen, vlen))
+    return -1;
+  return mrb_yabm_kv_size(klen, vlen);
+}
+
+static unsigned long mrb_yabm_kv_hash(const char *key, int klen)
+{
+  return mrb_yabm_crc32(0, (const unsigned char *)key, klen);
+}
+
+/* Index slot of key, with its record left in kvbuf, or -1. */
+static int mrb_yabm_kv_find(const char *key, int klen)
+{
+  unsigned long hash;
+  int i;
+
+  hash = mrb_yabm_kv_hash(key, klen);
+  for (i = 0; i < kvcount; ++i) {
+    if (kvindex[i].hash != hash || mrb_yabm_kv_load(kvindex[i].off) <= 0)
+      continue;
+    if ((unsigned char)kvbuf[1] == klen &&
+      memcmp(kvbuf + KV_HDRSIZE, key, klen) == 0)
+      return i;
+  }
+  return -1;
+}
+
+/* Indexes the record of size bytes at off, which is in kvbuf. */
+static void mrb_yabm_kv_index(int off, int size)
+{
+  char key[KV_KEYMAX];
+  int i, klen, magic;
+
+  magic = (unsigned char)kvbuf[0];
+  klen = (unsigned char)kvbuf[1];
+  memcpy(key, kvbuf + KV_HDRSIZE, klen);
+  i = mrb_yabm_kv_find(key, klen);
+  if (i >= 0)
+    kvlive -= kvindex[i].size;
+  if (magic == KV_DELETE) {
+    if (i >= 0)
+      kvindex[i] = kvindex[--kvcount];
+    return;
+  }
+  if (i < 0) {
+    if (kvcount == KV_KEYS)
+      return;
+    i = kvcount++;
+  }
+  kvindex[i].hash = mrb_yabm_kv_hash(key, klen);
+  kvindex[i].off = off;
+  kvindex[i].size = size;
+  kvlive += size;
+}
+
+static unsigned long mrb_yabm_kv_sector(int sector)
+{
+  unsigned char hdr[KV_HDRSIZE];
+
+  flash_kv_read(sector * KV_SECTOR, (char *)hdr, KV_HDRSIZE);
+  if (memcmp(hdr, "YKV\1", 4) != 0)
+    return 0;
+  return ((unsigned long)hdr[4] << 24) | (hdr[5] << 16) | (hdr[6] << 8) |
+    hdr[7];
+}
+
+static void mrb_yabm_kv_sethdr(int sector, unsigned long seq)
+{
+  unsigned char hdr[KV_HDRSIZE];
+
+  memcpy(hdr, "YKV\1", 4);
+  hdr[4] = seq >> 24;
+  hdr[5] = seq >> 16;
+  hdr[6] = seq >> 8;
+  hdr[7] = seq;
+  flash_kv_write(sector * KV_SECTOR, (char *)hdr, KV_HDRSIZE);
+}
+
+static void mrb_yabm_kv_erase(int sector)
+{
+  flash_kv_erase(sector * KV_SECTOR);
+  ++kverases;
+}
+
+/* Finds the active sector and indexes it; formats a blank area. */
+static void mrb_yabm_kv_mount()
+{
+  unsigned long seq;
+  int i, off, n;
+
+  if (kvmounted)
+    return;
+  kvmounted = 1;
+  kvcount = 0;
+  kvlive = 0;
+  kvseq = 0;
+  for (i = 0; i < KV_SECTORS; ++i) {
+    seq = mrb_yabm_kv_sector(i);
+    if (seq != 0 && seq != 0xffffffffUL && seq > kvseq) {
+      kvseq = seq;
+      kvactive = i;
+    }
+  }
+  if (kvseq == 0) {
+    kvactive = 0;
+    kvseq = 1;
+    mrb_yabm_kv_erase(0);
+    mrb_yabm_kv_sethdr(0, kvseq);
+    kvfree = KV_HDRSIZE;
+    return;
+  }
+  for (off = KV_HDRSIZE; (n = mrb_yabm_kv_load(off)) > 0; off += n)
+    mrb_yabm_kv_index(off, n);
+  /* Nothing more is written after a torn record until compaction. */
+  kvfree = n < 0 ? KV_SECTOR : off;
+}
+
+/*
+ * Copies the live records to the next sector in turn, so erases rotate,
+ * and returns it.  Its header is left to mrb_yabm_kv_switch.
+ */
+static int mrb_yabm_kv_compact()
+{
+  int i, n, to, off;
+
+  to = (kvactive + 1) % KV_SECTORS;
+  mrb_yabm_kv_erase(to);
+  off = KV_HDRSIZE;
+  kvlive = 0;
+  for (i = 0; i < kvcount; ++i) {
+    n = mrb_yabm_kv_load(kvindex[i].off);
+    if (n <= 0) {
+      kvindex[i--] = kvindex[--kvcount];
+      continue;
+    }
+    flash_kv_write(to * KV_SECTOR + off, kvbuf, n);
+    kvindex[i].off = off;
+    kvlive += n;
+    off += n;
+  }
+  kvfree = off;
+  return to;
+}
+
+static void mrb_yabm_kv_switch(int to)
+{
+  kvactive = to;
+  mrb_yabm_kv_sethdr(to, ++kvseq);
+  ++kvcompactions;
+}
+
+/*
+ * A record that does not fit triggers a compaction which leaves out the
+ * one it supersedes, so a full store can still take a delete or an
+ * overwrite.  A delete then needs no record at all.
+ */
+static int mrb_yabm_kv_append(int magic, const char *key, int klen,
+  const char *val, int vlen)
+{
+  unsigned char *rec = (unsigned char *)kvbuf;
+  unsigned long crc;
+  int i, n, old, to;
+
+  n = mrb_yabm_kv_size(klen, vlen);
+  i = mrb_yabm_kv_find(key, klen);
+  old = i >= 0 ? kvindex[i].size : 0;
+  to = kvactive;
+  if (kvfree + n > KV_SECTOR) {
+    if (magic == KV_DELETE)
+      n = 0;
+    if (KV_HDRSIZE + kvlive - old + n > KV_SECTOR)
+      return 0;
+    if (i >= 0) {
+      kvlive -= old;
+      kvindex[i] = kvindex[--kvcount];
+    }
+    to = mrb_yabm_kv_compact();
+  }
+  if (n > 0) {
+    memset(kvbuf, 0xff, n);
+    rec[0] = magic;
+    rec[1] = klen;
+    rec[2] = vlen >> 8;
+    rec[3] = vlen;
+    memcpy(kvbuf + KV_HDRSIZE, key, klen);
+    memcpy(kvbuf + KV_HDRSIZE + klen, val, vlen);
+    crc = mrb_yabm_kv_crc(kvbuf, klen, vlen);
+    rec[4] = crc >> 24;
+    rec[5] = crc >> 16;
+    rec[6] = crc >> 8;
+    rec[7] = crc;
+    flash_kv_write(to * KV_SECTOR + kvfree, kvbuf, n);
+  }
+  /* The new sector's header goes last, so a power cut keeps the old. */
+  if (to != kvactive)
+    mrb_yabm_kv_switch(to);
+  if (n > 0) {
+    mrb_yabm_kv_index(kvfree, n);
+    kvfree += n;
+  }
+  return 1;
+}
+
+/* Value length copied into buf, up to len bytes, or -1 when absent. */
+int mrb_yabm_kv_get(const char *key, int klen, char *buf, int len)
+{
+  int vlen;
+
+  mrb_yabm_kv_mount();
+  if (mrb_yabm_kv_find(key, klen) < 0)
+    return -1;
+  vlen = ((unsigned char)kvbuf[2] << 8) | (unsigned char)kvbuf[3];
+  memcpy(buf, kvbuf + KV_HDRSIZE + klen, vlen < len ? vlen : len);
+  return vlen;
+}
+
+/*
+ * Returns 1 once stored, 0 when the store is full or a length is out
+ * of range.  An unchanged value is not written again.
+ */
+int mrb_yabm_kv_put(const char *key, int klen, const char *val, int vlen)
+{
+  int i;
+
+  if (klen < 1 || klen > KV_KEYMAX || vlen < 0 || vlen > KV_VALMAX)
+    return 0;
+  mrb_yabm_kv_mount();
+  i = mrb_yabm_kv_find(key, klen);
+  if (i >= 0 && kvbuf[0] == (char)KV_RECORD &&
+    (((unsigned char)kvbuf[2] << 8) | (unsigned char)kvbuf[3]) == vlen &&
+    memcmp(kvbuf + KV_HDRSIZE + klen, val, vlen) == 0)
+    return 1;
+  if (i < 0 && kvcount == KV_KEYS)
+    return 0;
+  return mrb_yabm_kv_append(KV_RECORD, key, klen, val, vlen);
+}
+
+int mrb_yabm_kv_del(const char *key, int klen)
+{
+  mrb_yabm_kv_mount();
+  if (mrb_yabm_kv_find(key, klen) < 0)
+    return 0;
+  return mrb_yabm_kv_append(KV_DELETE, key, klen, NULL, 0);
+}
+
+static mrb_value mrb_yabm_kvget(mrb_state *mrb, mrb_value self)
+{
+  mrb_value key, res;
+  int len;
+  mrb_get_args(mrb, "S", &key);
+
+  len = mrb_yabm_kv_get(RSTRING_PTR(key), RSTRING_LEN(key), NULL, 0);
+  if (len < 0)
+    return mrb_nil_value();
+  res = mrb_str_new(mrb, NULL, len);
+  mrb_yabm_kv_get(RSTRING_PTR(key), RSTRING_LEN(key), RSTRING_PTR(res), len);
+
+  return res;
+}
+
+/* kvput(key, value) returns 1, or 0 when the store is full */
+static mrb_value mrb_yabm_kvput(mrb_state *mrb, mrb_value self)
+{
+  mrb_value key, val;
+  mrb_int len;
+  char *ptr;
+  mrb_get_args(mrb, "So", &key, &val);
+
+  ptr = mrb_yabm_bytes(mrb, val, &len);
+  if (RSTRING_LEN(key) < 1 || RSTRING_LEN(key) > KV_KEYMAX ||
+    len > KV_VALMAX)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "key or value too long");
+
+  return mrb_fixnum_value(mrb_yabm_kv_put(RSTRING_PTR(key),
+    RSTRING_LEN(key), ptr, len));
+}
+
+static mrb_value mrb_yabm_kvdel(mrb_state *mrb, mrb_value self)
+{
+  mrb_value key;
+  mrb_get_args(mrb, "S", &key);
+
+  return mrb_fixnum_value(mrb_yabm_kv_del(RSTRING_PTR(key),
+    RSTRING_LEN(key)));
+}
+
+static mrb_value mrb_yabm_kvkeys(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res;
+  int i;
+
+  mrb_yabm_kv_mount();
+  res = mrb_ary_new_capa(mrb, kvcount);
+  for (i = 0; i < kvcount; ++i)
+    if (mrb_yabm_kv_load(kvindex[i].off) > 0)
+      mrb_ary_push(mrb, res, mrb_str_new(mrb, kvbuf + KV_HDRSIZE,
+        (unsigned char)kvbuf[1]));
+
+  return res;
+}
+
+/* kvstat returns [keys, live, free, sequence, erases, compactions] */
+static mrb_value mrb_yabm_kvstat(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res;
+
+  mrb_yabm_kv_mount();
+  res = mrb_ary_new_capa(mrb, 6);
+  mrb_ary_push(mrb, res, mrb_fixnum_value(kvcount));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(kvlive));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(KV_SECTOR - kvfree));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(kvseq));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(kverases));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(kvcompactions));
+
+  return res;
+}
+
+/* kvformat erases every sector of the store */
+static mrb_value mrb_yabm_kvformat(mrb_state *mrb, mrb_value self)
+{
+  int i;
+
+  for (i = 0; i < KV_SECTORS; ++i)
+    mrb_yabm_kv_erase(i);
+  kvmounted = 0;
+  mrb_yabm_kv_mount();
+
+  return mrb_fixnum_value(0);
+}
+#else
+int mrb_yabm_kv_get(const char *key, int klen, char *buf, int len)
+{
+  return -1;
+}
+
+int mrb_yabm_kv_put(const char *key, int klen, const char *val, int vlen)
+{
+  return 0;
+}
+
+int mrb_yabm_kv_del(const char *key, int klen)
+{
+  return 0;
+}
+#endif /* YABM_DUMMY || YABM_FLASH */
+
+/* Warm start cache of name lookups, as "dns:" host. */
+static int mrb_yabm_kv_dnskey(char *key, const char *host)
+{
+  int len;
+
+  len = strlen(host);
+  if (len == 0 || len > KV_KEYMAX - 4)
+    return 0;
+  memcpy(key, "dns:", 4);
+  memcpy(key + 4, host, len);
+  return len + 4;
+}
+
+int mrb_yabm_kv_dnsget(const char *host, uint32_t *addr)
+{
+  char key[KV_KEYMAX];
+  unsigned char val[4];
+  int klen;
+
+  klen = mrb_yabm_kv_dnskey(key, host);
+  if (klen == 0 || mrb_yabm_kv_get(key, klen, (char *)val, 4) != 4)
+    return 0;
+  *addr = ((uint32_t)val[0] << 24) | (val[1] << 16) | (val[2] << 8) | val[3];
+  return 1;
+}
+
+void mrb_yabm_kv_dnsput(const char *host, uint32_t addr)
+{
+  char key[KV_KEYMAX];
+  unsigned char val[4];
+  int klen;
+
+  klen = mrb_yabm_kv_dnskey(key, host);
+  if (klen == 0)
+    return;
+  val[0] = addr >> 24;
+  val[1] = addr >> 16;
+  val[2] = addr >> 8;
+  val[3] = addr;
+  mrb_yabm_kv_put(key, klen, (char *)val, 4);
+}
+
+void mrb_yabm_kv_init(mrb_state *mrb, struct RClass *yabm)
+{
+#if defined(YABM_DUMMY) || defined(YABM_FLASH)
+  yabm_define_method(mrb, yabm, "kvget", mrb_yabm_kvget, MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "kvput", mrb_yabm_kvput, MRB_ARGS_REQ(2));
+  yabm_define_method(mrb, yabm, "kvdel", mrb_yabm_kvdel, MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "kvkeys", mrb_yabm_kvkeys, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "kvstat", mrb_yabm_kvstat, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "kvformat", mrb_yabm_kvformat, MRB_ARGS_NONE());
+#endif
+}
+
+void mrb_yabm_kv_final(mrb_state *mrb)
+{
+#if defined(YABM_DUMMY) || defined(YABM_FLASH)
+  kvmounted = 0;
+  kverases = 0;
+  kvcompactions = 0;
+#endif
+}
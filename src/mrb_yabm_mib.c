@@ -0,0 +1,361 @@
+/*
+** mrb_yabm_mib.c - switch MIB counters and PHY registers
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+#if defined(YABM_REALTEK) && !defined(YABM_NO_MIB)
+#define	MIBBASE		0xbb801000
+
+unsigned long mrb_yabm_mibread(int port, int dir, int type)
+{
+  unsigned long *lptr;
+
+  lptr = (unsigned long *)(MIBBASE + (unsigned long)dir +
+    port * MIB_SIZE + type);
+/* 64 bit not support
+  if ((mrb_fixnum(dir) == MIB_IN && (mrb_fixnum(type) == MIB_IFINOCTETS ||
+    mrb_fixnum(type) == MIB_ETHERSTATSOCTETS)) ||
+    (mrb_fixnum(dir) == MIB_OUT && mrb_fixnum(type) == MIB_IFOUTOCTETS)) {
+  }
+*/
+
+  return *lptr;
+}
+#endif /* YABM_REALTEK */
+
+#if (defined(YABM_REALTEK) || defined(YABM_DUMMY)) && !defined(YABM_NO_MIB)
+static mrb_value mrb_yabm_getmib(mrb_state *mrb, mrb_value self)
+{
+  mrb_int port, dir, type;
+  mrb_get_args(mrb, "iii", &port, &dir, &type);
+
+  return mrb_fixnum_value(mrb_yabm_mibread(port, dir, type));
+}
+
+static const struct {
+  const char *key;
+  int dir;
+  int type;
+} mibfields[] = {
+  { "in_octets", MIB_IN, MIB_IFINOCTETS },
+  { "in_ucast", MIB_IN, MIB_IFINUCASTPKTS },
+  { "in_bcast", MIB_IN, MIB_ETHERSTATSBROADCASTPKTS },
+  { "in_discards", MIB_IN, MIB_DOT1DTPPORTINDISCARDS },
+  { "in_fcs_errors", MIB_IN, MIB_DOT3STATSFCSERRORS },
+  { "out_octets", MIB_OUT, MIB_IFOUTOCTETS },
+  { "out_ucast", MIB_OUT, MIB_IFOUTUCASTPKTS },
+  { "out_mcast", MIB_OUT, MIB_IFOUTMULTICASTPKTS },
+  { "out_bcast", MIB_OUT, MIB_IFOUTBROADCASTPKTS },
+  { "out_discards", MIB_OUT, MIB_IFOUTDISCARDS },
+  { "collisions", MIB_OUT, MIB_ETHERSTATSCOLLISIONS },
+};
+
+/*
+ * mibencode(buf, format, name, portmask, tags = "", time = 0) appends a
+ * record of the main counters per port and returns the records written.
+ */
+static mrb_value mrb_yabm_mibencode(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_tm tm;
+  mrb_yabm_buffer *buf;
+  mrb_value bufv, name, tags = mrb_nil_value();
+  mrb_int format, mask, sec = 0;
+  int port, i, count;
+  mrb_get_args(mrb, "oiSi|Si", &bufv, &format, &name, &mask, &tags, &sec);
+
+  buf = mrb_yabm_tm_buffer(mrb, bufv);
+  count = 0;
+  for (port = 0; port < 8; ++port) {
+    if ((mask & (1 << port)) == 0)
+      continue;
+    mrb_yabm_tm_begin(&tm, buf, format, RSTRING_PTR(name), RSTRING_LEN(name),
+      mrb_nil_p(tags) ? "" : RSTRING_PTR(tags),
+      mrb_nil_p(tags) ? 0 : RSTRING_LEN(tags));
+    mrb_yabm_tm_tag(&tm, "port", port);
+    for (i = 0; i < sizeof(mibfields) / sizeof(mibfields[0]); ++i)
+      mrb_yabm_tm_ufield(&tm, mibfields[i].key, mrb_yabm_mibread(port,
+        mibfields[i].dir, mibfields[i].type) & 0xffffffff);
+    if (!mrb_yabm_tm_end(&tm, sec, 0))
+      break;
+    ++count;
+  }
+
+  return mrb_fixnum_value(count);
+}
+#endif /* YABM_REALTEK || YABM_DUMMY */
+
+#if defined(YABM_ADMTEK) && !defined(YABM_NO_MDIO)
+unsigned long physt();
+
+static mrb_value mrb_yabm_getphyst(mrb_state *mrb, mrb_value self)
+{
+  return mrb_fixnum_value(physt());
+}
+#endif /* YABM_ADMTEK */
+
+#if (defined(YABM_REALTEK) || defined(YABM_ADMTEK) || defined(YABM_DUMMY)) && \
+  !defined(YABM_NO_MDIO)
+int readmdio(unsigned int addr, unsigned int reg, unsigned int *dat);
+
+static mrb_value mrb_yabm_readmdio(mrb_state *mrb, mrb_value self)
+{
+  unsigned int data;
+  mrb_int port, reg;
+  mrb_get_args(mrb, "ii", &port, &reg);
+  readmdio(port, reg, &data);
+  mrb_yabm_trace(TRACE_MDIO, TRACE_OP_READ, (port << 8) | reg, data);
+
+  return mrb_fixnum_value(data);
+}
+
+/* mdiodump(port, reg = 0, count = 32) reads a register range at once */
+static mrb_value mrb_yabm_mdiodump(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res;
+  unsigned int data;
+  mrb_int port, reg = 0, count = 32;
+  int i;
+  mrb_get_args(mrb, "i|ii", &port, &reg, &count);
+
+  if (reg < 0 || count < 0 || reg + count > 32)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid PHY register range");
+  res = mrb_ary_new_capa(mrb, count);
+  for (i = 0; i < count; ++i) {
+    readmdio(port, reg + i, &data);
+    mrb_ary_push(mrb, res, mrb_fixnum_value(data & 0xffff));
+  }
+  mrb_yabm_trace(TRACE_MDIO, TRACE_OP_READ, (port << 8) | reg, count);
+
+  return res;
+}
+
+#define	LINK_PORTS		8
+#define	LINK_EVENTS		16
+
+#define	PHY_BMCR		0
+#define	PHY_BMSR		1
+#define	PHY_ANAR		4
+#define	PHY_ANLPAR		5
+
+typedef struct {
+  int time;
+  unsigned short bmsr;
+  unsigned char port;
+  unsigned char up;
+  unsigned char speed;
+  unsigned char duplex;
+} link_event;
+
+static unsigned int linkmask;
+static int linkinterval;
+static int linklast;
+static link_event linkstate[LINK_PORTS];
+static link_event linkq[LINK_EVENTS];
+static int linkhead;
+static int linkcount;
+
+/*
+ * Only BMSR is read while it is unchanged.  Speed and duplex come from
+ * BMCR, or from the common autonegotiation abilities, and are read
+ * again whenever the status word changes with the link up.
+ */
+static void mrb_yabm_link_read(int port, link_event *ev)
+{
+  unsigned int bmsr, bmcr, anar, anlpar, common;
+
+  readmdio(port, PHY_BMSR, &bmsr);
+  ev->port = port;
+  ev->bmsr = bmsr;
+  ev->up = (bmsr & 0x0004) != 0;
+  if (ev->up && (linkmask & (1 << port)) && linkstate[port].bmsr == bmsr) {
+    ev->speed = linkstate[port].speed;
+    ev->duplex = linkstate[port].duplex;
+    return;
+  }
+  ev->speed = 0;
+  ev->duplex = 0;
+  if (!ev->up)
+    return;
+  readmdio(port, PHY_BMCR, &bmcr);
+  if (bmcr & 0x1000) {
+    readmdio(port, PHY_ANAR, &anar);
+    readmdio(port, PHY_ANLPAR, &anlpar);
+    common = anar & anlpar;
+    ev->speed = (common & 0x0180) ? 100 : 10;
+    ev->duplex = (common & 0x0140) != 0;
+  } else {
+    ev->speed = (bmcr & 0x2000) ? 100 : 10;
+    ev->duplex = (bmcr & 0x0100) != 0;
+  }
+}
+
+static void mrb_yabm_link_sample()
+{
+  link_event ev;
+  int port;
+
+  for (port = 0; port < LINK_PORTS; ++port) {
+    if ((linkmask & (1 << port)) == 0)
+      continue;
+    mrb_yabm_link_read(port, &ev);
+    if (ev.bmsr == linkstate[port].bmsr)
+      continue;
+    ev.time = mrb_yabm_clock();
+    linkstate[port] = ev;
+    linkq[linkhead] = ev;
+    linkhead = (linkhead + 1) % LINK_EVENTS;
+    if (linkcount < LINK_EVENTS)
+      ++linkcount;
+    mrb_yabm_trace(TRACE_MDIO, TRACE_OP_READ, (port << 8) | PHY_BMSR, ev.up);
+  }
+  linklast = mrb_yabm_clock();
+}
+
+static mrb_value mrb_yabm_link_value(mrb_state *mrb, link_event *ev, int time)
+{
+  mrb_value row;
+
+  row = mrb_ary_new_capa(mrb, 5);
+  mrb_ary_push(mrb, row, mrb_fixnum_value(ev->port));
+  mrb_ary_push(mrb, row, mrb_fixnum_value(ev->up));
+  mrb_ary_push(mrb, row, mrb_fixnum_value(ev->speed));
+  mrb_ary_push(mrb, row, mrb_fixnum_value(ev->duplex));
+  if (time)
+    mrb_ary_push(mrb, row, mrb_fixnum_value(ev->time));
+  return row;
+}
+
+/*
+ * linkencode(buf, format, name, tags = "", time = 0) appends the state
+ * of each watched port and returns the records written.
+ */
+static mrb_value mrb_yabm_linkencode(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_tm tm;
+  mrb_yabm_buffer *buf;
+  mrb_value bufv, name, tags = mrb_nil_value();
+  mrb_int format, sec = 0;
+  int port, count;
+  mrb_get_args(mrb, "oiS|Si", &bufv, &format, &name, &tags, &sec);
+
+  buf = mrb_yabm_tm_buffer(mrb, bufv);
+  if (linkmask != 0)
+    mrb_yabm_link_sample();
+  count = 0;
+  for (port = 0; port < LINK_PORTS; ++port) {
+    if ((linkmask & (1 << port)) == 0)
+      continue;
+    mrb_yabm_tm_begin(&tm, buf, format, RSTRING_PTR(name), RSTRING_LEN(name),
+      mrb_nil_p(tags) ? "" : RSTRING_PTR(tags),
+      mrb_nil_p(tags) ? 0 : RSTRING_LEN(tags));
+    mrb_yabm_tm_tag(&tm, "port", port);
+    mrb_yabm_tm_field(&tm, "up", linkstate[port].up);
+    mrb_yabm_tm_field(&tm, "speed", linkstate[port].speed);
+    mrb_yabm_tm_field(&tm, "duplex", linkstate[port].duplex);
+    if (!mrb_yabm_tm_end(&tm, sec, 0))
+      break;
+    ++count;
+  }
+
+  return mrb_fixnum_value(count);
+}
+
+/*
+ * linkwatch(portmask, interval_ms = 0) starts watching and returns the
+ * current [[port, up, speed, duplex], ...].  With an interval the ports
+ * are also sampled in the background, from msleep and the I/O waits.
+ */
+static mrb_value mrb_yabm_linkwatch(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res;
+  mrb_int mask, interval = 0;
+  int port;
+  mrb_get_args(mrb, "i|i", &mask, &interval);
+
+  if (mask < 0 || mask >= (1 << LINK_PORTS))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid port mask");
+  linkmask = 0;
+  linkinterval = interval;
+  linkhead = 0;
+  linkcount = 0;
+  res = mrb_ary_new(mrb);
+  for (port = 0; port < LINK_PORTS; ++port) {
+    if ((mask & (1 << port)) == 0)
+      continue;
+    mrb_yabm_link_read(port, &linkstate[port]);
+    linkstate[port].time = mrb_yabm_clock();
+    mrb_ary_push(mrb, res, mrb_yabm_link_value(mrb, &linkstate[port], 0));
+  }
+  linkmask = mask;
+  linklast = mrb_yabm_clock();
+
+  return res;
+}
+
+/* linkevents returns [[port, up, speed, duplex, time_ms], ...] */
+static mrb_value mrb_yabm_linkevents(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res;
+  int i, pos;
+
+  if (linkmask != 0)
+    mrb_yabm_link_sample();
+  res = mrb_ary_new_capa(mrb, linkcount);
+  pos = (linkhead - linkcount + LINK_EVENTS) % LINK_EVENTS;
+  for (i = 0; i < linkcount; ++i) {
+    mrb_ary_push(mrb, res, mrb_yabm_link_value(mrb, &linkq[pos], 1));
+    pos = (pos + 1) % LINK_EVENTS;
+  }
+  linkcount = 0;
+
+  return res;
+}
+#endif /* YABM_REALTEK || YABM_ADMTEK || YABM_DUMMY */
+
+void mrb_yabm_mib_poll()
+{
+#if (defined(YABM_REALTEK) || defined(YABM_ADMTEK) || defined(YABM_DUMMY)) && \
+  !defined(YABM_NO_MDIO)
+  if (linkmask != 0 && linkinterval > 0 &&
+    mrb_yabm_clock() - linklast >= linkinterval)
+    mrb_yabm_link_sample();
+#endif
+}
+
+void mrb_yabm_mib_init(mrb_state *mrb, struct RClass *yabm)
+{
+#if (defined(YABM_REALTEK) || defined(YABM_DUMMY)) && !defined(YABM_NO_MIB)
+  yabm_define_method(mrb, yabm, "getmib", mrb_yabm_getmib, MRB_ARGS_REQ(3));
+  yabm_define_method(mrb, yabm, "mibencode", mrb_yabm_mibencode, MRB_ARGS_ARG(4, 2));
+#endif
+#if defined(YABM_ADMTEK) && !defined(YABM_NO_MDIO)
+  yabm_define_method(mrb, yabm, "getphyst", mrb_yabm_getphyst, MRB_ARGS_NONE());
+#endif
+#if (defined(YABM_REALTEK) || defined(YABM_ADMTEK) || defined(YABM_DUMMY)) && \
+  !defined(YABM_NO_MDIO)
+  yabm_define_method(mrb, yabm, "readmdio", mrb_yabm_readmdio, MRB_ARGS_REQ(2));
+  yabm_define_method(mrb, yabm, "mdiodump", mrb_yabm_mdiodump, MRB_ARGS_ARG(1, 2));
+  yabm_define_method(mrb, yabm, "linkwatch", mrb_yabm_linkwatch, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "linkevents", mrb_yabm_linkevents, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "linkencode", mrb_yabm_linkencode, MRB_ARGS_ARG(3, 2));
+#endif
+}
+
+void mrb_yabm_mib_final(mrb_state *mrb)
+{
+#if (defined(YABM_REALTEK) || defined(YABM_ADMTEK) || defined(YABM_DUMMY)) && \
+  !defined(YABM_NO_MDIO)
+  linkmask = 0;
+  linkinterval = 0;
+  linkcount = 0;
+#endif
+}
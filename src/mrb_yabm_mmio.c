@@ -0,0 +1,327 @@
+/*
+** mrb_yabm_mmio.c - batched SoC register access
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+#if !defined(YABM_NO_MMIO)
+
+void delay_ms(int ms);
+
+#if defined(YABM_DUMMY)
+/* register file of mrb_yabm_dummy_dev.c */
+uint32_t mmio_read(uint32_t addr);
+void mmio_write(uint32_t addr, uint32_t val);
+#else
+#define	mmio_read(addr)		(*(volatile uint32_t *)(unsigned long)(addr))
+#define	mmio_write(addr, val)	(*(volatile uint32_t *)(unsigned long)(addr) = (val))
+#endif
+
+/*
+ * A compiled script is a String of these records in host byte order,
+ * checked again when it runs since it may come back from the KV store.
+ */
+typedef struct {
+  uint32_t op;
+  uint32_t addr;
+  uint32_t mask;
+  uint32_t val;
+  uint32_t arg;
+} reg_op;
+
+/*
+ * Register values are uint32.  Where mrb_int is 32 bits, those with
+ * bit 31 set come back negative and are taken as such.
+ */
+uint32_t mrb_yabm_reg_int(mrb_state *mrb, mrb_value v)
+{
+  if (!mrb_integer_p(v))
+    mrb_raise(mrb, E_TYPE_ERROR, "register value is not an Integer");
+  return (uint32_t)mrb_integer(v);
+}
+
+static mrb_value mrb_yabm_reg_value(mrb_state *mrb, uint32_t val)
+{
+  return mrb_int_value(mrb, (mrb_int)val);
+}
+
+static uint32_t mrb_yabm_reg_addr(mrb_state *mrb, mrb_value v)
+{
+  uint32_t addr;
+
+  addr = mrb_yabm_reg_int(mrb, v);
+  if (addr & 3)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "unaligned register address");
+  return addr;
+}
+
+/*
+ * Waits for (reg & mask) == val, spinning for the first millisecond and
+ * then polling once per millisecond.  Returns the us waited or -1.
+ */
+static long mrb_yabm_reg_wait(uint32_t addr, uint32_t mask, uint32_t val,
+  int timeout)
+{
+  unsigned int start, us;
+  int ms;
+
+  start = mrb_yabm_uclock();
+  ms = mrb_yabm_clock();
+  while ((mmio_read(addr) & mask) != val) {
+    us = mrb_yabm_uclock() - start;
+    if (mrb_yabm_clock() - ms >= timeout)
+      return -1;
+    if (us >= 1000) {
+      delay_ms(1);
+      mrb_yabm_poll();
+    }
+  }
+  return mrb_yabm_uclock() - start;
+}
+
+/*
+ * regread(addr) returns one register, regread(addr, n) n consecutive
+ * ones and regread([addr, ...]) those listed, as an Array.
+ */
+static mrb_value mrb_yabm_regread(mrb_state *mrb, mrb_value self)
+{
+  mrb_value arg, res;
+  mrb_int i, n = -1;
+  uint32_t addr;
+  mrb_get_args(mrb, "o|i", &arg, &n);
+
+  if (mrb_array_p(arg)) {
+    n = RARRAY_LEN(arg);
+    res = mrb_ary_new_capa(mrb, n);
+    for (i = 0; i < n; ++i) {
+      addr = mrb_yabm_reg_addr(mrb, mrb_ary_ref(mrb, arg, i));
+      mrb_ary_push(mrb, res, mrb_yabm_reg_value(mrb, mmio_read(addr)));
+    }
+    return res;
+  }
+  addr = mrb_yabm_reg_addr(mrb, arg);
+  if (n < 0)
+    return mrb_yabm_reg_value(mrb, mmio_read(addr));
+  res = mrb_ary_new_capa(mrb, n);
+  for (i = 0; i < n; ++i)
+    mrb_ary_push(mrb, res, mrb_yabm_reg_value(mrb, mmio_read(addr + i * 4)));
+
+  return res;
+}
+
+/*
+ * regwrite(addr, val), regwrite(addr, [val, ...]) for consecutive
+ * registers or regwrite([addr, ...], [val, ...]).  Returns the count.
+ */
+static mrb_value mrb_yabm_regwrite(mrb_state *mrb, mrb_value self)
+{
+  mrb_value arg, val;
+  mrb_int i, n;
+  uint32_t addr, base;
+  mrb_bool list;
+  mrb_get_args(mrb, "oo", &arg, &val);
+
+  if (!mrb_array_p(val)) {
+    addr = mrb_yabm_reg_addr(mrb, arg);
+    mmio_write(addr, mrb_yabm_reg_int(mrb, val));
+    return mrb_fixnum_value(1);
+  }
+  n = RARRAY_LEN(val);
+  list = mrb_array_p(arg);
+  if (list && RARRAY_LEN(arg) != n)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "address and value counts differ");
+  base = list ? 0 : mrb_yabm_reg_addr(mrb, arg);
+  /* nothing is written unless every argument is valid */
+  for (i = 0; i < n; ++i) {
+    if (list)
+      mrb_yabm_reg_addr(mrb, mrb_ary_ref(mrb, arg, i));
+    mrb_yabm_reg_int(mrb, mrb_ary_ref(mrb, val, i));
+  }
+  for (i = 0; i < n; ++i) {
+    addr = list ? mrb_yabm_reg_int(mrb, mrb_ary_ref(mrb, arg, i)) :
+      base + i * 4;
+    mmio_write(addr, mrb_yabm_reg_int(mrb, mrb_ary_ref(mrb, val, i)));
+  }
+
+  return mrb_fixnum_value(n);
+}
+
+/* regmodify(addr, mask, val) sets the masked bits and returns the old value */
+static mrb_value mrb_yabm_regmodify(mrb_state *mrb, mrb_value self)
+{
+  mrb_value arg, m, v;
+  uint32_t addr, mask, val, old;
+  mrb_get_args(mrb, "ooo", &arg, &m, &v);
+
+  addr = mrb_yabm_reg_addr(mrb, arg);
+  mask = mrb_yabm_reg_int(mrb, m);
+  val = mrb_yabm_reg_int(mrb, v);
+  old = mmio_read(addr);
+  mmio_write(addr, (old & ~mask) | (val & mask));
+
+  return mrb_yabm_reg_value(mrb, old);
+}
+
+/*
+ * regwait(addr, mask, val, timeout) returns the microseconds until the
+ * masked bits read val, or nil after timeout ms.
+ */
+static mrb_value mrb_yabm_regwait(mrb_state *mrb, mrb_value self)
+{
+  mrb_value arg, m, v;
+  mrb_int timeout;
+  uint32_t addr, mask, val;
+  long us;
+  mrb_get_args(mrb, "oooi", &arg, &m, &v, &timeout);
+
+  addr = mrb_yabm_reg_addr(mrb, arg);
+  mask = mrb_yabm_reg_int(mrb, m);
+  val = mrb_yabm_reg_int(mrb, v);
+  us = mrb_yabm_reg_wait(addr, mask, val, timeout);
+  if (us < 0)
+    return mrb_nil_value();
+
+  return mrb_int_value(mrb, us);
+}
+
+/*
+ * regcompile([[op, addr, ...], ...]) packs a script for regrun:
+ *   [REG_READ, addr]               value read
+ *   [REG_WRITE, addr, val]
+ *   [REG_MODIFY, addr, mask, val]  old value
+ *   [REG_WAIT, addr, mask, val, ms]  us waited
+ *   [REG_DELAY, ms]
+ */
+static mrb_value mrb_yabm_regcompile(mrb_state *mrb, mrb_value self)
+{
+  mrb_value ops, op, str;
+  mrb_int i, j, n;
+  reg_op rec;
+  uint32_t f[5];
+  mrb_get_args(mrb, "A", &ops);
+
+  n = RARRAY_LEN(ops);
+  str = mrb_str_new_capa(mrb, n * sizeof(reg_op));
+  for (i = 0; i < n; ++i) {
+    op = mrb_ary_ref(mrb, ops, i);
+    if (!mrb_array_p(op) || RARRAY_LEN(op) < 1 || RARRAY_LEN(op) > 5)
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid register operation");
+    memset(f, 0, sizeof(f));
+    for (j = 0; j < RARRAY_LEN(op); ++j)
+      f[j] = mrb_yabm_reg_int(mrb, mrb_ary_ref(mrb, op, j));
+    memset(&rec, 0, sizeof(rec));
+    rec.op = f[0];
+    switch (rec.op) {
+    case REG_READ:
+      rec.addr = f[1];
+      break;
+    case REG_WRITE:
+      rec.addr = f[1];
+      rec.val = f[2];
+      break;
+    case REG_MODIFY:
+      rec.addr = f[1];
+      rec.mask = f[2];
+      rec.val = f[3];
+      break;
+    case REG_WAIT:
+      rec.addr = f[1];
+      rec.mask = f[2];
+      rec.val = f[3];
+      rec.arg = f[4];
+      break;
+    case REG_DELAY:
+      rec.arg = f[1];
+      break;
+    default:
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid register operation");
+    }
+    if (rec.addr & 3)
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "unaligned register address");
+    mrb_str_cat(mrb, str, (char *)&rec, sizeof(rec));
+  }
+
+  return str;
+}
+
+/*
+ * regrun(script) runs a regcompile script in one call and returns the
+ * results of its read, modify and wait steps.  A wait that times out
+ * adds nil and ends the script.
+ */
+static mrb_value mrb_yabm_regrun(mrb_state *mrb, mrb_value self)
+{
+  mrb_value script, res;
+  reg_op rec;
+  uint32_t old;
+  long us;
+  mrb_int i, n;
+  int start;
+  mrb_get_args(mrb, "S", &script);
+
+  if (RSTRING_LEN(script) % sizeof(reg_op) != 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid register script");
+  n = RSTRING_LEN(script) / sizeof(reg_op);
+  for (i = 0; i < n; ++i) {
+    memcpy(&rec, RSTRING_PTR(script) + i * sizeof(reg_op), sizeof(rec));
+    if (rec.op < REG_READ || rec.op > REG_DELAY || (rec.addr & 3))
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid register script");
+  }
+
+  res = mrb_ary_new(mrb);
+  for (i = 0; i < n; ++i) {
+    memcpy(&rec, RSTRING_PTR(script) + i * sizeof(reg_op), sizeof(rec));
+    switch (rec.op) {
+    case REG_READ:
+      mrb_ary_push(mrb, res, mrb_yabm_reg_value(mrb, mmio_read(rec.addr)));
+      break;
+    case REG_WRITE:
+      mmio_write(rec.addr, rec.val);
+      break;
+    case REG_MODIFY:
+      old = mmio_read(rec.addr);
+      mmio_write(rec.addr, (old & ~rec.mask) | (rec.val & rec.mask));
+      mrb_ary_push(mrb, res, mrb_yabm_reg_value(mrb, old));
+      break;
+    case REG_WAIT:
+      us = mrb_yabm_reg_wait(rec.addr, rec.mask, rec.val, rec.arg);
+      mrb_ary_push(mrb, res, us < 0 ? mrb_nil_value() : mrb_int_value(mrb, us));
+      if (us < 0)
+        return res;
+      break;
+    case REG_DELAY:
+      start = mrb_yabm_clock();
+      while (mrb_yabm_clock() - start < (long)rec.arg) {
+        delay_ms(1);
+        mrb_yabm_poll();
+      }
+      break;
+    }
+  }
+
+  return res;
+}
+
+#endif /* !YABM_NO_MMIO */
+
+void mrb_yabm_mmio_init(mrb_state *mrb, struct RClass *yabm)
+{
+#if !defined(YABM_NO_MMIO)
+  yabm_define_method(mrb, yabm, "regread", mrb_yabm_regread, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "regwrite", mrb_yabm_regwrite, MRB_ARGS_REQ(2));
+  yabm_define_method(mrb, yabm, "regmodify", mrb_yabm_regmodify, MRB_ARGS_REQ(3));
+  yabm_define_method(mrb, yabm, "regwait", mrb_yabm_regwait, MRB_ARGS_REQ(4));
+  yabm_define_method(mrb, yabm, "regcompile", mrb_yabm_regcompile, MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "regrun", mrb_yabm_regrun, MRB_ARGS_REQ(1));
+#endif
+}
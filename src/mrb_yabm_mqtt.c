@@ -0,0 +1,694 @@
+/*
+** mrb_yabm_mqtt.c - MQTT 3.1.1 client on one persistent TCP connection
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+#if defined(YABM_DUMMY) || defined(YABM_TCP)
+
+/*
+ * Raw TCP from the firmware, one connection like http_*.  tcp_write
+ * returns the bytes taken, which may be fewer than len, or -1, and
+ * tcp_read returns the bytes read, 0 when nothing is pending or -1
+ * once the peer closed.
+ */
+int tcp_connect(uint32_t *addr, int port, int type);
+int tcp_write(char *buf, int len);
+int tcp_read(char *buf, int len);
+void tcp_close();
+void delay_ms(int ms);
+
+#define	MQTT_TXSIZE		4096
+#define	MQTT_RXSIZE		2048
+#define	MQTT_INSIZE		4096
+#define	MQTT_INFLIGHT		8
+
+#define	MQTT_CLOSED		0
+#define	MQTT_CONNECTING		1
+#define	MQTT_CONNECTED		2
+
+#define	MQTT_CONNECT		0x10
+#define	MQTT_CONNACK		0x20
+#define	MQTT_PUBLISH		0x30
+#define	MQTT_PUBACK		0x40
+#define	MQTT_SUBSCRIBE		0x82
+#define	MQTT_SUBACK		0x90
+#define	MQTT_PINGREQ		0xc0
+#define	MQTT_PINGRESP		0xd0
+#define	MQTT_DISCONNECT		0xe0
+
+typedef struct {
+  unsigned short id;
+  unsigned short sent;
+  int len;
+  char *pkt;
+} mqtt_inflight;
+
+static mrb_state *mqttmrb;
+static int mqttstate;
+static int mqttconnack;
+static int mqttkeepalive;
+static int mqttlastsend;
+static int mqttlastrecv;
+static int mqttpinging;
+static int mqttbatchdelay;
+static int mqttbatchbytes;
+static int mqttqueued;
+static unsigned short mqttid;
+
+static char txq[MQTT_TXSIZE];
+static int txlen;
+static char rxbuf[MQTT_RXSIZE];
+static int rxlen;
+static int rxskip;
+static char inq[MQTT_INSIZE];
+static int inoff;
+static int inlen;
+static mqtt_inflight inflight[MQTT_INFLIGHT];
+
+static unsigned int mqttpublished;
+static unsigned int mqttacked;
+static unsigned int mqttreceived;
+static unsigned int mqttdropped;
+
+static char *mrb_yabm_mqtt_put16(char *ptr, int val)
+{
+  *ptr++ = val >> 8;
+  *ptr++ = val;
+  return ptr;
+}
+
+/* Fixed header; returns its size, at most 5 bytes. */
+static int mrb_yabm_mqtt_header(char *ptr, int type, int len)
+{
+  int n;
+
+  ptr[0] = type;
+  n = 1;
+  do {
+    ptr[n] = len & 0x7f;
+    len >>= 7;
+    if (len)
+      ptr[n] |= 0x80;
+    ++n;
+  } while (len);
+  return n;
+}
+
+/* The queue belongs to the connection; QoS 1 messages stay in flight. */
+static void mrb_yabm_mqtt_close()
+{
+  if (mqttstate != MQTT_CLOSED)
+    tcp_close();
+  mqttstate = MQTT_CLOSED;
+  mqttpinging = 0;
+  txlen = 0;
+  rxlen = 0;
+  rxskip = 0;
+}
+
+/* Push out as much of the queue as the stack takes now. */
+static void mrb_yabm_mqtt_flush()
+{
+  int n;
+
+  if (mqttstate != MQTT_CONNECTED || txlen == 0)
+    return;
+  n = tcp_write(txq, txlen);
+  if (n < 0) {
+    mrb_yabm_trace(TRACE_MQTT, TRACE_OP_CLOSE, 0, -1);
+    mrb_yabm_mqtt_close();
+    return;
+  }
+  if (n == 0)
+    return;
+  mrb_yabm_trace(TRACE_MQTT, TRACE_OP_SEND, 0, n);
+  memmove(txq, txq + n, txlen - n);
+  txlen -= n;
+  mqttlastsend = mrb_yabm_clock();
+}
+
+static int mrb_yabm_mqtt_queue(const char *ptr, int len)
+{
+  if (mqttstate != MQTT_CONNECTED)
+    return 0;
+  if (len > MQTT_TXSIZE - txlen)
+    mrb_yabm_mqtt_flush();
+  if (len > MQTT_TXSIZE - txlen)
+    return 0;
+  if (txlen == 0)
+    mqttqueued = mrb_yabm_clock();
+  memcpy(txq + txlen, ptr, len);
+  txlen += len;
+  return 1;
+}
+
+static void mrb_yabm_mqtt_ack(int type, int id)
+{
+  char pkt[4];
+
+  pkt[0] = type;
+  pkt[1] = 2;
+  mrb_yabm_mqtt_put16(pkt + 2, id);
+  mrb_yabm_mqtt_queue(pkt, 4);
+}
+
+/* Received messages are kept as u16 topic length, topic, u16 length, data. */
+static void mrb_yabm_mqtt_deliver(const char *topic, int tlen,
+  const char *data, int len)
+{
+  char *ptr;
+
+  if (inoff > 0 && tlen + len + 4 > MQTT_INSIZE - inlen) {
+    memmove(inq, inq + inoff, inlen - inoff);
+    inlen -= inoff;
+    inoff = 0;
+  }
+  if (tlen + len + 4 > MQTT_INSIZE - inlen) {
+    ++mqttdropped;
+    return;
+  }
+  ptr = mrb_yabm_mqtt_put16(inq + inlen, tlen);
+  memcpy(ptr, topic, tlen);
+  ptr = mrb_yabm_mqtt_put16(ptr + tlen, len);
+  memcpy(ptr, data, len);
+  inlen += tlen + len + 4;
+  ++mqttreceived;
+}
+
+static void mrb_yabm_mqtt_packet(unsigned char *pkt, int hdr, int len)
+{
+  unsigned char *body = pkt + hdr;
+  int i, id, tlen, qos;
+
+  switch (pkt[0] & 0xf0) {
+  case MQTT_CONNACK:
+    if (len < 2)
+      break;
+    mqttconnack = body[1];
+    if (mqttconnack != 0) {
+      mrb_yabm_mqtt_close();
+      break;
+    }
+    mqttstate = MQTT_CONNECTED;
+    for (i = 0; i < MQTT_INFLIGHT; ++i) {
+      if (inflight[i].pkt != NULL) {
+        if (inflight[i].sent)
+          inflight[i].pkt[0] |= 0x08;
+        inflight[i].sent = mrb_yabm_mqtt_queue(inflight[i].pkt,
+          inflight[i].len);
+      }
+    }
+    break;
+  case MQTT_PUBACK:
+    if (len < 2)
+      break;
+    id = (body[0] << 8) | body[1];
+    for (i = 0; i < MQTT_INFLIGHT; ++i) {
+      if (inflight[i].pkt != NULL && inflight[i].id == id) {
+        mrb_free(mqttmrb, inflight[i].pkt);
+        inflight[i].pkt = NULL;
+        ++mqttacked;
+      }
+    }
+    break;
+  case MQTT_PUBLISH:
+    qos = (pkt[0] >> 1) & 3;
+    if (len < 2)
+      break;
+    tlen = (body[0] << 8) | body[1];
+    if (2 + tlen + (qos ? 2 : 0) > len)
+      break;
+    i = 2 + tlen;
+    if (qos) {
+      id = (body[i] << 8) | body[i + 1];
+      i += 2;
+      mrb_yabm_mqtt_ack(MQTT_PUBACK, id);
+    }
+    mrb_yabm_mqtt_deliver((char *)body + 2, tlen, (char *)body + i, len - i);
+    break;
+  }
+}
+
+/*
+ * Called from mrb_yabm_poll: read and dispatch packets, keep the
+ * connection alive and send the queue when the batch is due.
+ */
+void mrb_yabm_mqtt_poll()
+{
+  unsigned char *ptr;
+  char ping[2];
+  int n, i, len, shift, hdr, now;
+
+  if (mqttstate == MQTT_CLOSED)
+    return;
+  n = tcp_read(rxbuf + rxlen, MQTT_RXSIZE - rxlen);
+  if (n < 0) {
+    mrb_yabm_trace(TRACE_MQTT, TRACE_OP_CLOSE, 0, 0);
+    mrb_yabm_mqtt_close();
+    return;
+  }
+  now = mrb_yabm_clock();
+  if (n > 0) {
+    mrb_yabm_trace(TRACE_MQTT, TRACE_OP_RECV, 0, n);
+    mqttlastrecv = now;
+    mqttpinging = 0;
+    rxlen += n;
+  }
+  while (rxlen > 0) {
+    if (rxskip > 0) {
+      n = rxskip < rxlen ? rxskip : rxlen;
+      memmove(rxbuf, rxbuf + n, rxlen - n);
+      rxlen -= n;
+      rxskip -= n;
+      continue;
+    }
+    ptr = (unsigned char *)rxbuf;
+    len = 0;
+    shift = 0;
+    for (i = 1; i < rxlen && i < 5; ++i) {
+      len |= (ptr[i] & 0x7f) << shift;
+      shift += 7;
+      if ((ptr[i] & 0x80) == 0)
+        break;
+    }
+    if (i == 5) {
+      mrb_yabm_mqtt_close();
+      return;
+    }
+    if (i >= rxlen)
+      break;
+    hdr = i + 1;
+    if (hdr + len > MQTT_RXSIZE) {
+      ++mqttdropped;
+      rxskip = hdr + len;
+      continue;
+    }
+    if (hdr + len > rxlen)
+      break;
+    mrb_yabm_mqtt_packet(ptr, hdr, len);
+    if (mqttstate == MQTT_CLOSED)
+      return;
+    memmove(rxbuf, rxbuf + hdr + len, rxlen - hdr - len);
+    rxlen -= hdr + len;
+  }
+  if (mqttstate != MQTT_CONNECTED)
+    return;
+  if (mqttkeepalive > 0) {
+    if (now - mqttlastrecv > mqttkeepalive * 1500) {
+      mrb_yabm_trace(TRACE_MQTT, TRACE_OP_TIMEOUT, 0, now - mqttlastrecv);
+      mrb_yabm_mqtt_close();
+      return;
+    }
+    /* the broker must answer before we give up on it at 1.5 keepalive */
+    if (!mqttpinging && (now - mqttlastrecv >= mqttkeepalive * 500 ||
+      now - mqttlastsend >= mqttkeepalive * 500)) {
+      ping[0] = MQTT_PINGREQ;
+      ping[1] = 0;
+      mqttpinging = mrb_yabm_mqtt_queue(ping, 2);
+      mrb_yabm_mqtt_flush();
+      if (mqttstate != MQTT_CONNECTED)
+        return;
+    }
+  }
+  /* QoS 1 messages that did not fit the queue when published */
+  for (i = 0; i < MQTT_INFLIGHT; ++i)
+    if (inflight[i].pkt != NULL && !inflight[i].sent)
+      inflight[i].sent = mrb_yabm_mqtt_queue(inflight[i].pkt,
+        inflight[i].len);
+  if (txlen > 0 && (txlen >= mqttbatchbytes ||
+    now - mqttqueued >= mqttbatchdelay))
+    mrb_yabm_mqtt_flush();
+}
+
+static int mrb_yabm_mqtt_nextid()
+{
+  if (++mqttid == 0)
+    mqttid = 1;
+  return mqttid;
+}
+
+static void mrb_yabm_mqtt_reset()
+{
+  int i;
+
+  for (i = 0; i < MQTT_INFLIGHT; ++i) {
+    mrb_free(mqttmrb, inflight[i].pkt);
+    inflight[i].pkt = NULL;
+  }
+  txlen = 0;
+  inoff = 0;
+  inlen = 0;
+}
+
+/* One ms of waiting for the broker; 0 once timeout ms have passed. */
+static int mrb_yabm_mqtt_wait(int start, int timeout, int port)
+{
+  if (timeout > 0 && mrb_yabm_clock() - start >= timeout) {
+    mrb_yabm_trace(TRACE_MQTT, TRACE_OP_TIMEOUT, port,
+      mrb_yabm_clock() - start);
+    mrb_yabm_mqtt_close();
+    return 0;
+  }
+  delay_ms(1);
+  mrb_yabm_poll();
+  return 1;
+}
+
+static char *mrb_yabm_mqtt_putstr(char *ptr, mrb_value str)
+{
+  ptr = mrb_yabm_mqtt_put16(ptr, RSTRING_LEN(str));
+  memcpy(ptr, RSTRING_PTR(str), RSTRING_LEN(str));
+  return ptr + RSTRING_LEN(str);
+}
+
+/*
+ * mqttconnect(addr, port, client_id, keepalive = 60, user = nil,
+ * pass = nil, timeout = 3000) opens a clean session.  Returns the
+ * CONNACK code, 0 when accepted, -1 when TCP failed, nil on timeout.
+ * Messages queued meanwhile, and unacknowledged QoS 1 ones, go out once
+ * connected.
+ */
+static mrb_value mrb_yabm_mqttconnect(mrb_state *mrb, mrb_value self)
+{
+  mrb_value addr, id, user = mrb_nil_value(), pass = mrb_nil_value();
+  mrb_int port, keepalive = 60, timeout = 3000;
+  char pkt[MQTT_RXSIZE], *ptr;
+  uint32_t ip[8];
+  int len, hdr, start;
+  mrb_get_args(mrb, "SiS|iS!S!i", &addr, &port, &id, &keepalive, &user,
+    &pass, &timeout);
+
+  len = 10 + 2 + RSTRING_LEN(id);
+  if (!mrb_nil_p(user))
+    len += 2 + RSTRING_LEN(user);
+  if (!mrb_nil_p(pass))
+    len += 2 + RSTRING_LEN(pass);
+  if (len + 5 > sizeof(pkt))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "connect parameters too long");
+  mrb_yabm_mqtt_close();
+  ip[0] = mrb_yabm_strtoip(mrb, addr);
+  start = mrb_yabm_clock();
+  if (!tcp_connect(ip, port, 0)) {
+    mrb_yabm_trace(TRACE_MQTT, TRACE_OP_CONNECT, port, 0);
+    return mrb_fixnum_value(-1);
+  }
+  mrb_yabm_trace(TRACE_MQTT, TRACE_OP_CONNECT, port, 1);
+  mqttstate = MQTT_CONNECTING;
+  mqttconnack = -1;
+  mqttkeepalive = keepalive;
+
+  hdr = mrb_yabm_mqtt_header(pkt, MQTT_CONNECT, len);
+  ptr = mrb_yabm_mqtt_put16(pkt + hdr, 4);
+  memcpy(ptr, "MQTT", 4);
+  ptr += 4;
+  *ptr++ = 4;
+  *ptr++ = 0x02 | (mrb_nil_p(user) ? 0 : 0x80) | (mrb_nil_p(pass) ? 0 : 0x40);
+  ptr = mrb_yabm_mqtt_put16(ptr, keepalive);
+  ptr = mrb_yabm_mqtt_putstr(ptr, id);
+  if (!mrb_nil_p(user))
+    ptr = mrb_yabm_mqtt_putstr(ptr, user);
+  if (!mrb_nil_p(pass))
+    ptr = mrb_yabm_mqtt_putstr(ptr, pass);
+  len = ptr - pkt;
+  for (ptr = pkt; len > 0; ) {
+    hdr = tcp_write(ptr, len);
+    if (hdr < 0) {
+      mrb_yabm_mqtt_close();
+      return mrb_fixnum_value(-1);
+    }
+    if (hdr == 0 && !mrb_yabm_mqtt_wait(start, timeout, port))
+      return mrb_nil_value();
+    ptr += hdr;
+    len -= hdr;
+  }
+  mqttlastsend = mrb_yabm_clock();
+  mqttlastrecv = mqttlastsend;
+
+  while (mqttstate == MQTT_CONNECTING)
+    if (!mrb_yabm_mqtt_wait(start, timeout, port))
+      return mrb_nil_value();
+  mrb_yabm_mqtt_flush();
+
+  return mrb_fixnum_value(mqttconnack);
+}
+
+/*
+ * mqttpublish(topic, payload, qos = 0, retain = false) queues a message;
+ * payload is a String or Buffer.  Returns the packet id for QoS 1, 0 for
+ * QoS 0, or nil when it was dropped: the queue (QoS 0) or the in-flight
+ * table (QoS 1) is full, or QoS 0 while not connected.  QoS 1 messages
+ * that find the queue full or the client not connected are queued from
+ * the poll once there is room.
+ */
+static mrb_value mrb_yabm_mqttpublish(mrb_state *mrb, mrb_value self)
+{
+  mrb_value topic, payload;
+  mrb_int qos = 0, plen;
+  mrb_bool retain = 0;
+  char *pkt, *ptr, *data;
+  int n, len, id, slot;
+  mrb_get_args(mrb, "So|ib", &topic, &payload, &qos, &retain);
+
+  if (qos != 0 && qos != 1)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "QoS 0 or 1 only");
+  data = mrb_yabm_bytes(mrb, payload, &plen);
+  len = 2 + RSTRING_LEN(topic) + (qos ? 2 : 0) + plen;
+  if (len + 5 > MQTT_TXSIZE)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "message too long");
+  slot = 0;
+  if (qos) {
+    for (slot = 0; slot < MQTT_INFLIGHT; ++slot)
+      if (inflight[slot].pkt == NULL)
+        break;
+  } else if (mqttstate != MQTT_CONNECTED) {
+    slot = MQTT_INFLIGHT;
+  } else if (len + 5 > MQTT_TXSIZE - txlen) {
+    mrb_yabm_mqtt_flush();
+    if (len + 5 > MQTT_TXSIZE - txlen)
+      slot = MQTT_INFLIGHT;
+  }
+  if (slot == MQTT_INFLIGHT) {
+    ++mqttdropped;
+    return mrb_nil_value();
+  }
+
+  /* QoS 0 is built in the queue, QoS 1 in its in-flight copy */
+  if (qos)
+    pkt = (char *)mrb_malloc(mrb, len + 5);
+  else
+    pkt = txq + txlen;
+  id = qos ? mrb_yabm_mqtt_nextid() : 0;
+  n = mrb_yabm_mqtt_header(pkt, MQTT_PUBLISH | (qos << 1) | (retain ? 1 : 0),
+    len);
+  ptr = mrb_yabm_mqtt_putstr(pkt + n, topic);
+  if (qos)
+    ptr = mrb_yabm_mqtt_put16(ptr, id);
+  memcpy(ptr, data, plen);
+  ++mqttpublished;
+  if (qos) {
+    inflight[slot].pkt = pkt;
+    inflight[slot].len = n + len;
+    inflight[slot].id = id;
+    inflight[slot].sent = mrb_yabm_mqtt_queue(pkt, n + len);
+  } else {
+    if (txlen == 0)
+      mqttqueued = mrb_yabm_clock();
+    txlen += n + len;
+  }
+  if (txlen >= mqttbatchbytes || mqttbatchdelay == 0)
+    mrb_yabm_mqtt_flush();
+
+  return mrb_fixnum_value(id);
+}
+
+/* mqttsubscribe(topic, qos = 0) returns the packet id, nil if queue full */
+static mrb_value mrb_yabm_mqttsubscribe(mrb_state *mrb, mrb_value self)
+{
+  mrb_value topic;
+  mrb_int qos = 0;
+  char pkt[MQTT_RXSIZE], *ptr;
+  int n, id;
+  mrb_get_args(mrb, "S|i", &topic, &qos);
+
+  if (RSTRING_LEN(topic) + 10 > sizeof(pkt))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "topic too long");
+  id = mrb_yabm_mqtt_nextid();
+  n = mrb_yabm_mqtt_header(pkt, MQTT_SUBSCRIBE, 2 + 2 + RSTRING_LEN(topic) + 1);
+  ptr = mrb_yabm_mqtt_put16(pkt + n, id);
+  ptr = mrb_yabm_mqtt_putstr(ptr, topic);
+  *ptr++ = qos ? 1 : 0;
+  if (!mrb_yabm_mqtt_queue(pkt, ptr - pkt))
+    return mrb_nil_value();
+  mrb_yabm_mqtt_flush();
+
+  return mrb_fixnum_value(id);
+}
+
+/*
+ * mqttpoll(timeout = 0) { |topic, payload| ... } yields the received
+ * messages, waiting up to timeout ms for the first, and returns their
+ * count.  Without a block it returns [[topic, payload], ...].
+ */
+static mrb_value mrb_yabm_mqttpoll(mrb_state *mrb, mrb_value self)
+{
+  mrb_value blk, res, msg[2];
+  mrb_int timeout = 0;
+  unsigned char *ptr;
+  int start, count, tlen, len, ai;
+  mrb_get_args(mrb, "|i&", &timeout, &blk);
+
+  start = mrb_yabm_clock();
+  mrb_yabm_poll();
+  while (inoff == inlen && timeout > 0 &&
+    mrb_yabm_clock() - start < timeout) {
+    delay_ms(1);
+    mrb_yabm_poll();
+  }
+  res = mrb_ary_new(mrb);
+  count = 0;
+  while (inoff < inlen) {
+    ai = mrb_gc_arena_save(mrb);
+    ptr = (unsigned char *)inq + inoff;
+    tlen = (ptr[0] << 8) | ptr[1];
+    len = (ptr[tlen + 2] << 8) | ptr[tlen + 3];
+    msg[0] = mrb_str_new(mrb, (char *)ptr + 2, tlen);
+    msg[1] = mrb_str_new(mrb, (char *)ptr + tlen + 4, len);
+    inoff += tlen + len + 4;
+    if (inoff == inlen) {
+      inoff = 0;
+      inlen = 0;
+    }
+    ++count;
+    if (mrb_nil_p(blk))
+      mrb_ary_push(mrb, res, mrb_ary_new_from_values(mrb, 2, msg));
+    else
+      mrb_yield_argv(mrb, blk, 2, msg);
+    mrb_gc_arena_restore(mrb, ai);
+  }
+
+  return mrb_nil_p(blk) ? res : mrb_fixnum_value(count);
+}
+
+/* mqttflush(timeout = 0) returns the bytes still queued */
+static mrb_value mrb_yabm_mqttflush(mrb_state *mrb, mrb_value self)
+{
+  mrb_int timeout = 0;
+  int start;
+  mrb_get_args(mrb, "|i", &timeout);
+
+  start = mrb_yabm_clock();
+  mrb_yabm_mqtt_flush();
+  while (txlen > 0 && mqttstate == MQTT_CONNECTED && timeout > 0 &&
+    mrb_yabm_clock() - start < timeout) {
+    delay_ms(1);
+    mrb_yabm_poll();
+    mrb_yabm_mqtt_flush();
+  }
+
+  return mrb_fixnum_value(txlen);
+}
+
+/*
+ * mqttbatch(delay_ms, bytes = 1460) holds publishes until delay_ms has
+ * passed since the first queued one or bytes are queued, so several go
+ * out in one segment.  0 sends each at once.
+ */
+static mrb_value mrb_yabm_mqttbatch(mrb_state *mrb, mrb_value self)
+{
+  mrb_int delay, bytes = 1460;
+  mrb_get_args(mrb, "i|i", &delay, &bytes);
+
+  mqttbatchdelay = delay;
+  mqttbatchbytes = bytes < MQTT_TXSIZE ? bytes : MQTT_TXSIZE;
+
+  return mrb_fixnum_value(0);
+}
+
+/* [state, queued, inflight, published, acked, received, dropped] */
+static mrb_value mrb_yabm_mqttstat(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res;
+  int i, n;
+
+  n = 0;
+  for (i = 0; i < MQTT_INFLIGHT; ++i)
+    if (inflight[i].pkt != NULL)
+      ++n;
+  res = mrb_ary_new_capa(mrb, 7);
+  mrb_ary_push(mrb, res, mrb_fixnum_value(mqttstate));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(txlen));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(n));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(mqttpublished));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(mqttacked));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(mqttreceived));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(mqttdropped));
+
+  return res;
+}
+
+/* Sends DISCONNECT and drops everything queued or in flight. */
+static mrb_value mrb_yabm_mqttdisconnect(mrb_state *mrb, mrb_value self)
+{
+  char pkt[2];
+
+  if (mqttstate == MQTT_CONNECTED) {
+    mrb_yabm_mqtt_flush();
+    pkt[0] = MQTT_DISCONNECT;
+    pkt[1] = 0;
+    tcp_write(pkt, 2);
+  }
+  mrb_yabm_trace(TRACE_MQTT, TRACE_OP_CLOSE, 0, txlen);
+  mrb_yabm_mqtt_close();
+  mrb_yabm_mqtt_reset();
+
+  return mrb_fixnum_value(0);
+}
+#else
+void mrb_yabm_mqtt_poll()
+{
+}
+#endif /* YABM_DUMMY || YABM_TCP */
+
+void mrb_yabm_mqtt_init(mrb_state *mrb, struct RClass *yabm)
+{
+#if defined(YABM_DUMMY) || defined(YABM_TCP)
+  mqttmrb = mrb;
+  mqttbatchbytes = 1460;
+  mrb_define_const(mrb, yabm, "MQTT_CLOSED", mrb_fixnum_value(MQTT_CLOSED));
+  mrb_define_const(mrb, yabm, "MQTT_CONNECTING", mrb_fixnum_value(MQTT_CONNECTING));
+  mrb_define_const(mrb, yabm, "MQTT_CONNECTED", mrb_fixnum_value(MQTT_CONNECTED));
+
+  yabm_define_method(mrb, yabm, "mqttconnect", mrb_yabm_mqttconnect, MRB_ARGS_ARG(3, 4));
+  yabm_define_method(mrb, yabm, "mqttpublish", mrb_yabm_mqttpublish, MRB_ARGS_ARG(2, 2));
+  yabm_define_method(mrb, yabm, "mqttsubscribe", mrb_yabm_mqttsubscribe, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "mqttpoll", mrb_yabm_mqttpoll, MRB_ARGS_OPT(1) | MRB_ARGS_BLOCK());
+  yabm_define_method(mrb, yabm, "mqttflush", mrb_yabm_mqttflush, MRB_ARGS_OPT(1));
+  yabm_define_method(mrb, yabm, "mqttbatch", mrb_yabm_mqttbatch, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "mqttstat", mrb_yabm_mqttstat, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "mqttdisconnect", mrb_yabm_mqttdisconnect, MRB_ARGS_NONE());
+#endif
+}
+
+void mrb_yabm_mqtt_final(mrb_state *mrb)
+{
+#if defined(YABM_DUMMY) || defined(YABM_TCP)
+  mrb_yabm_mqtt_close();
+  mrb_yabm_mqtt_reset();
+  mqttpublished = 0;
+  mqttacked = 0;
+  mqttreceived = 0;
+  mqttdropped = 0;
+  mqttbatchdelay = 0;
+#endif
+}
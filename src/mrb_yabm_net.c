@@ -0,0 +1,562 @@
+/*
+** mrb_yabm_net.c - YABM network methods
+**
+** Shared by the hardware and dummy builds; only the network stack
+** entry points below differ, the dummy ones live in mrb_yabm_dummy_net.c.
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/string.h"
+
+#include "mrb_yabm.h"
+
+extern int netstat;
+void net_start(uint32_t, uint32_t, uint32_t, uint32_t);
+void net_startdhcp();
+uint32_t getmyaddress();
+void delay_ms(int);
+
+uint32_t mrb_yabm_strtoip(mrb_state *mrb, mrb_value str)
+{
+  char *cstr;
+  uint32_t ip;
+  int pos, val;
+
+  ip = 0;
+  pos = 0;
+  val = 0;
+
+  cstr = mrb_str_to_cstr(mrb, str);
+  while (*cstr) {
+    if (*cstr == '.') {
+      ip |= val << (8 * (3 - pos));
+      val = 0;
+      ++pos;
+    } else {
+      val *= 10;
+      val += *cstr - '0';
+    }
+    ++cstr;
+  }
+  ip |= val;
+  return ip;
+}
+
+static int addr16(char *ptr)
+{
+  int i, r, n;
+
+  r = 0;
+  for(i = 0; i < 4; ++i) {
+    if(ptr[i] <= '9') {
+      n = ptr[i] - '0';
+    } else {
+      n = ptr[i] - 'a' + 10;
+    }
+    r = (r << 4) | n;
+  }
+  return r;
+
+}
+
+static void mrb_yabm_strtoip6(mrb_state *mrb, mrb_value str, uint32_t *addr)
+{
+  char *cstr;
+  int i;
+
+  cstr = mrb_str_to_cstr(mrb, str);
+  for (i = 0; i < 8; ++i) {
+    addr[i] = addr16(cstr + i * 5);
+  }
+}
+
+mrb_value mrb_yabm_iptostr(mrb_state *mrb, uint32_t ip)
+{
+  char addr[16];
+  int i , val, c, div;
+  int han;
+
+  c = 0;
+  for(i = 0; i < 4; ++i ) {
+    han = 0;
+    val = (ip >> (8 * (3 - i))) & 0xff;
+    div = val / 100;
+    if (div != 0) {
+      addr[c] = '0' + div;
+      val -= 100 * div;
+      ++c;
+      han = 1;
+    }
+    div = val / 10;
+    if (han == 1 || div != 0) {
+      addr[c] = '0' + div;
+      val -= 10 * div;
+      ++c;
+    }
+    div = val % 10;
+    addr[c] = '0' + div;
+    ++c;
+    if(i != 3) {
+      addr[c] = '.';
+      ++c;
+    }
+   }
+   addr[c] = '\0';
+   return mrb_str_new_cstr(mrb, addr);
+}
+
+static void addhexstr(int addr, char *buf)
+{
+int num;
+int i;
+
+  for(i = 12; i >= 0; i -= 4) {
+    num = (addr >> i) & 0xf;
+    if(num < 10) {
+      *buf = '0' + num;
+    } else {
+      *buf = 'a' + num - 10;
+    }
+    ++buf;
+  }
+}
+
+static mrb_value mrb_yabm_ip6tostr(mrb_state *mrb, uint32_t *ip)
+{
+  int i, c;
+  char addr[48];
+
+  c = 0;
+  for(i = 0; i < 8; ++i) {
+    addhexstr(ip[i], &addr[c]);
+    c += 4;
+    if (i != 7) {
+      addr[c] = ':';
+      ++c;
+    }
+  }
+  addr[c] = '\0';
+
+  return mrb_str_new_cstr(mrb, addr);
+}
+
+/* 1 with the eight IPv6 words in ip, 0 with the IPv4 address in ip[0] */
+int mrb_yabm_cpaddr(mrb_state *mrb, uint32_t *ip, mrb_value addr)
+{
+  char *cstr;
+
+  cstr = mrb_str_to_cstr(mrb, addr);
+  if (strlen(cstr) == 39) {
+    mrb_yabm_strtoip6(mrb, addr, ip);
+    return 1;
+  }
+  ip[0] = mrb_yabm_strtoip(mrb, addr);
+  return 0;
+}
+
+static int mrb_yabm_expired(int start, mrb_int timeout)
+{
+  return timeout > 0 && mrb_yabm_clock() - start >= timeout;
+}
+
+static mrb_value mrb_yabm_netstart(mrb_state *mrb, mrb_value self)
+{
+  mrb_value addr, mask, gw, dns;
+  mrb_get_args(mrb, "SSSS", &addr, &mask, &gw, &dns);
+  net_start(mrb_yabm_strtoip(mrb, addr), mrb_yabm_strtoip(mrb, mask),
+    mrb_yabm_strtoip(mrb, gw), mrb_yabm_strtoip(mrb, dns));
+  mrb_yabm_trace(TRACE_NET, TRACE_OP_START, mrb_yabm_strtoip(mrb, addr), 0);
+
+  return mrb_nil_value();
+}
+
+static mrb_value mrb_yabm_netstartdhcp(mrb_state *mrb, mrb_value self)
+{
+  mrb_int timeout = 0;
+  int start;
+
+  mrb_get_args(mrb, "|i", &timeout);
+  start = mrb_yabm_clock();
+  net_startdhcp();
+  if (timeout > 0) {
+    while (netstat == 0) {
+      if (mrb_yabm_expired(start, timeout)) {
+        mrb_yabm_trace(TRACE_NET, TRACE_OP_TIMEOUT, 0,
+          mrb_yabm_clock() - start);
+        return mrb_nil_value();
+      }
+      mrb_yabm_poll();
+      delay_ms(1);
+    }
+  }
+  mrb_yabm_trace(TRACE_NET, TRACE_OP_START, 0, mrb_yabm_clock() - start);
+  return mrb_fixnum_value(0);
+}
+
+static mrb_value mrb_yabm_netstat(mrb_state *mrb, mrb_value self)
+{
+
+  return mrb_fixnum_value(netstat);
+}
+
+static mrb_value mrb_yabm_getaddress(mrb_state *mrb, mrb_value self)
+{
+
+  return mrb_yabm_iptostr(mrb, getmyaddress());
+}
+
+#if !defined(YABM_NO_UDP)
+void rtl_udp_init();
+void rtl_udp_bind(int port);
+int rtl_udp_recv(char *buf, int len);
+void rtl_udp_send(int addr, int port, char *buf, int len);
+
+static mrb_value mrb_yabm_udpinit(mrb_state *mrb, mrb_value self)
+{
+  rtl_udp_init();
+  return mrb_nil_value();
+}
+
+static mrb_value mrb_yabm_udpbind(mrb_state *mrb, mrb_value self)
+{
+  mrb_int port;
+  mrb_get_args(mrb, "i", &port);
+  rtl_udp_bind(port);
+  mrb_yabm_trace(TRACE_UDP, TRACE_OP_BIND, port, 0);
+  return mrb_nil_value();
+}
+
+static mrb_value mrb_yabm_udprecv(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_buffer *buf;
+  mrb_value dst = mrb_nil_value();
+  char buff[1024];
+  int len;
+  mrb_get_args(mrb, "|o", &dst);
+
+  buf = mrb_yabm_buffer_arg(mrb, dst);
+  if (buf != NULL) {
+    len = rtl_udp_recv(buf->ptr, buf->capa);
+    mrb_yabm_buffer_set(buf, len);
+  } else {
+    len = rtl_udp_recv(buff, sizeof(buff));
+  }
+  if (len != 0)
+    mrb_yabm_trace(TRACE_UDP, TRACE_OP_RECV, 0, len);
+  if (buf != NULL)
+    return mrb_fixnum_value(len);
+  return mrb_str_new(mrb, buff, len);
+}
+
+static mrb_value mrb_yabm_udpsend(mrb_state *mrb, mrb_value self)
+{
+  mrb_value buff, addr;
+  mrb_int port, len, size;
+  char *ptr;
+  mrb_get_args(mrb, "Sioi", &addr, &port, &buff, &len);
+  ptr = mrb_yabm_bytes(mrb, buff, &size);
+  if (len > size)
+    len = size;
+  rtl_udp_send(mrb_yabm_strtoip(mrb, addr), port, ptr, len);
+  mrb_yabm_trace(TRACE_UDP, TRACE_OP_SEND, port, len);
+  return mrb_nil_value();
+}
+
+#endif /* !YABM_NO_UDP */
+
+#if !defined(YABM_NO_HTTPSVR)
+void httpsvr_init();
+void httpsvr_bind(int port);
+void httpsvr_setres(char *buff, int len);
+int httpsvr_copyreq(char *buff);
+
+static mrb_value mrb_yabm_httpsvrinit(mrb_state *mrb, mrb_value self)
+{
+  httpsvr_init();
+  return mrb_nil_value();
+}
+
+static mrb_value mrb_yabm_httpsvrbind(mrb_state *mrb, mrb_value self)
+{
+  mrb_int port;
+  mrb_get_args(mrb, "i", &port);
+  httpsvr_bind(port);
+  return mrb_nil_value();
+}
+
+static mrb_value mrb_yabm_httpsvrsetres(mrb_state *mrb, mrb_value self)
+{
+  mrb_value buff;
+  mrb_int len, size;
+  char *ptr;
+  mrb_get_args(mrb, "oi", &buff, &len);
+  ptr = mrb_yabm_bytes(mrb, buff, &size);
+  if (len > size)
+    len = size;
+  httpsvr_setres(ptr, len);
+  mrb_yabm_trace(TRACE_HTTP, TRACE_OP_SEND, 0, len);
+  return mrb_nil_value();
+}
+
+static mrb_value mrb_yabm_httpsvrgetreq(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_buffer *buf;
+  mrb_value dst = mrb_nil_value();
+  char buff[1024];
+  int n;
+  mrb_get_args(mrb, "|o", &dst);
+
+  buf = mrb_yabm_buffer_arg(mrb, dst);
+  n = httpsvr_copyreq(buff);
+  if (n == 0)
+    return mrb_nil_value();
+  mrb_yabm_trace(TRACE_HTTP, TRACE_OP_RECV, 0, n);
+  if (buf != NULL) {
+    if (n > buf->capa)
+      n = buf->capa;
+    memcpy(buf->ptr, buff, n);
+    mrb_yabm_buffer_set(buf, n);
+    return mrb_fixnum_value(n);
+  }
+  return mrb_str_new(mrb, buff, n);
+}
+
+#endif /* !YABM_NO_HTTPSVR */
+
+#if !defined(YABM_NO_HTTP) || !defined(YABM_NO_HTTPS)
+int http_connect(uint32_t *addr, int port, char *header, int type);
+int http_read(char *buf, int len);
+void http_close();
+
+int https_connect(char *host, uint32_t *addr, int port, char *header, int type);
+int https_read(char *buf, int len);
+void https_close();
+
+/*
+ * Shared body of http and https, which differ only in the transport.
+ * With a Buffer the body is stored in it and the total length received
+ * is returned, which is larger than the Buffer when it was cut short.
+ */
+static mrb_value mrb_yabm_httpget(mrb_state *mrb, int tls)
+{
+  mrb_yabm_buffer *buf;
+  mrb_value str;
+  mrb_value host, addr, header;
+  mrb_value dst = mrb_nil_value();
+  mrb_int port;
+  mrb_int timeout = 0;
+  char tmp[512];
+  uint32_t ip[8];
+  int len, type, start, total;
+
+  if (tls)
+    mrb_get_args(mrb, "SSiS|io", &host, &addr, &port, &header, &timeout,
+      &dst);
+  else
+    mrb_get_args(mrb, "SiS|io", &addr, &port, &header, &timeout, &dst);
+  buf = mrb_yabm_buffer_arg(mrb, dst);
+  type = mrb_yabm_cpaddr(mrb, ip, addr);
+  if (buf != NULL) {
+    mrb_yabm_buffer_set(buf, 0);
+    str = mrb_fixnum_value(0);
+  } else {
+    str = mrb_str_new_cstr(mrb, "");
+  }
+  total = 0;
+  start = mrb_yabm_clock();
+  if (tls)
+    len = https_connect(RSTRING_PTR(host), ip, port, RSTRING_PTR(header),
+      type);
+  else
+    len = http_connect(ip, port, RSTRING_PTR(header), type);
+  mrb_yabm_trace(TRACE_HTTP, TRACE_OP_CONNECT, port, len);
+  if (len) {
+    while(1) {
+      if (buf != NULL && buf->fill < buf->capa) {
+        len = buf->capa - buf->fill;
+        len = tls ? https_read(buf->ptr + buf->fill, len) :
+          http_read(buf->ptr + buf->fill, len);
+        if (len > 0)
+          mrb_yabm_buffer_set(buf, buf->fill + len);
+      } else {
+        len = tls ? https_read(tmp, sizeof(tmp)) :
+          http_read(tmp, sizeof(tmp));
+        if (len > 0 && buf == NULL)
+          mrb_str_cat(mrb, str, tmp, len);
+      }
+      if (len < 0)
+        break;
+      total += len;
+      if (mrb_yabm_expired(start, timeout)) {
+        mrb_yabm_trace(TRACE_HTTP, TRACE_OP_TIMEOUT, port,
+          mrb_yabm_clock() - start);
+        str = mrb_nil_value();
+        break;
+      }
+      mrb_yabm_poll();
+    }
+    if (tls)
+      https_close();
+    else
+      http_close();
+    mrb_yabm_trace(TRACE_HTTP, TRACE_OP_CLOSE, port,
+      mrb_nil_p(str) ? -1 : total);
+    if (buf != NULL && !mrb_nil_p(str))
+      str = mrb_fixnum_value(total);
+  } else if (mrb_yabm_expired(start, timeout)) {
+    str = mrb_nil_value();
+  }
+  return str;
+}
+
+#if !defined(YABM_NO_HTTP)
+static mrb_value mrb_yabm_http(mrb_state *mrb, mrb_value self)
+{
+  return mrb_yabm_httpget(mrb, 0);
+}
+#endif
+
+#if !defined(YABM_NO_HTTPS)
+static mrb_value mrb_yabm_https(mrb_state *mrb, mrb_value self)
+{
+  return mrb_yabm_httpget(mrb, 1);
+}
+#endif
+#endif /* !YABM_NO_HTTP || !YABM_NO_HTTPS */
+
+/*
+ * The resolver and the SNTP client are started and then polled, so the
+ * deadline holds while a server does not answer.  The poll calls return
+ * -1 while waiting, then 1 with an answer or 0 without.
+ */
+int lookup_start(char *host, int type);
+int lookup_poll(uint32_t *addr);
+void lookup_cancel();
+int sntp_start(uint32_t *addr, int type);
+int sntp_poll();
+void sntp_cancel();
+
+/* 1 with the answer in addr, 0 without one, -1 past the deadline. */
+static int mrb_yabm_lookup_wait(char *host, uint32_t *addr, int type,
+  mrb_int timeout)
+{
+  int start, found;
+
+  mrb_yabm_poll();
+  start = mrb_yabm_clock();
+  found = lookup_start(host, type) ? -1 : 0;
+  while (found < 0 && (found = lookup_poll(addr)) < 0) {
+    if (mrb_yabm_expired(start, timeout)) {
+      lookup_cancel();
+      mrb_yabm_trace(TRACE_NET, TRACE_OP_TIMEOUT, 0,
+        mrb_yabm_clock() - start);
+      return -1;
+    }
+    mrb_yabm_poll();
+    delay_ms(1);
+  }
+  mrb_yabm_trace(TRACE_NET, TRACE_OP_LOOKUP,
+    found ? addr[type == 1 ? 7 : 0] : 0, mrb_yabm_clock() - start);
+  return found;
+}
+
+/*
+ * lookup(host, timeout = 0, cached = false) with cached returns an answer
+ * kept in the KV store without a query, and keeps new answers there.
+ */
+static mrb_value mrb_yabm_lookup(mrb_state *mrb, mrb_value self)
+{
+  mrb_value host;
+  mrb_int timeout = 0;
+  mrb_bool cached = 0;
+  uint32_t addr[8];
+  int found;
+
+  mrb_get_args(mrb, "S|ib", &host, &timeout, &cached);
+  if (cached && mrb_yabm_kv_dnsget(RSTRING_PTR(host), addr))
+    return mrb_yabm_iptostr(mrb, addr[0]);
+  found = mrb_yabm_lookup_wait(mrb_str_to_cstr(mrb, host), addr, 0, timeout);
+  if (found < 0)
+    return mrb_nil_value();
+  if (!found)
+    return mrb_str_new_cstr(mrb, "");
+  if (cached)
+    mrb_yabm_kv_dnsput(RSTRING_PTR(host), addr[0]);
+  return mrb_yabm_iptostr(mrb, addr[0]);
+}
+
+static mrb_value mrb_yabm_lookup6(mrb_state *mrb, mrb_value self)
+{
+  mrb_value host;
+  mrb_int timeout = 0;
+  uint32_t addr[8];
+  int found;
+
+  mrb_get_args(mrb, "S|i", &host, &timeout);
+  found = mrb_yabm_lookup_wait(mrb_str_to_cstr(mrb, host), addr, 1, timeout);
+  if (found < 0)
+    return mrb_nil_value();
+  if (found)
+    return mrb_yabm_ip6tostr(mrb, addr);
+  else
+    return mrb_str_new_cstr(mrb, "");
+}
+
+static mrb_value mrb_yabm_sntp(mrb_state *mrb, mrb_value self)
+{
+  mrb_value addr;
+  mrb_int timeout = 0;
+  uint32_t ip[8];
+  int start, set;
+
+  mrb_get_args(mrb, "S|i", &addr, &timeout);
+  mrb_yabm_poll();
+  start = mrb_yabm_clock();
+  set = sntp_start(ip, mrb_yabm_cpaddr(mrb, ip, addr)) ? -1 : 0;
+  while (set < 0 && (set = sntp_poll()) < 0) {
+    if (mrb_yabm_expired(start, timeout)) {
+      sntp_cancel();
+      mrb_yabm_trace(TRACE_NET, TRACE_OP_TIMEOUT, ip[0],
+        mrb_yabm_clock() - start);
+      return mrb_nil_value();
+    }
+    mrb_yabm_poll();
+    delay_ms(1);
+  }
+  mrb_yabm_trace(TRACE_NET, TRACE_OP_SNTP, ip[0], mrb_yabm_clock() - start);
+
+  return mrb_fixnum_value(0);
+}
+
+void mrb_yabm_net_init(mrb_state *mrb, struct RClass *yabm)
+{
+  yabm_define_method(mrb, yabm, "netstart", mrb_yabm_netstart, MRB_ARGS_REQ(4));
+  yabm_define_method(mrb, yabm, "netstartdhcp", mrb_yabm_netstartdhcp, MRB_ARGS_OPT(1));
+  yabm_define_method(mrb, yabm, "netstat", mrb_yabm_netstat, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "getaddress", mrb_yabm_getaddress, MRB_ARGS_NONE());
+#if !defined(YABM_NO_UDP)
+  yabm_define_method(mrb, yabm, "udpinit", mrb_yabm_udpinit, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "udpbind", mrb_yabm_udpbind, MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "udprecv", mrb_yabm_udprecv, MRB_ARGS_OPT(1));
+  yabm_define_method(mrb, yabm, "udpsend", mrb_yabm_udpsend, MRB_ARGS_REQ(4));
+#endif
+#if !defined(YABM_NO_HTTPSVR)
+  yabm_define_method(mrb, yabm, "httpsvrinit", mrb_yabm_httpsvrinit, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "httpsvrbind", mrb_yabm_httpsvrbind, MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "httpsvrsetres", mrb_yabm_httpsvrsetres, MRB_ARGS_REQ(2));
+  yabm_define_method(mrb, yabm, "httpsvrgetreq", mrb_yabm_httpsvrgetreq, MRB_ARGS_OPT(1));
+#endif
+#if !defined(YABM_NO_HTTP)
+  yabm_define_method(mrb, yabm, "http", mrb_yabm_http, MRB_ARGS_ARG(3, 2));
+#endif
+#if !defined(YABM_NO_HTTPS)
+  yabm_define_method(mrb, yabm, "https", mrb_yabm_https, MRB_ARGS_ARG(4, 2));
+#endif
+  yabm_define_method(mrb, yabm, "lookup", mrb_yabm_lookup, MRB_ARGS_ARG(1, 2));
+  yabm_define_method(mrb, yabm, "lookup6", mrb_yabm_lookup6, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "sntp", mrb_yabm_sntp, MRB_ARGS_ARG(1, 1));
+}
@@ -0,0 +1,706 @@
+/*
+** mrb_yabm_snmp.c - SNMP v2c agent for the switch MIB counters
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+#if (defined(YABM_DUMMY) || (defined(YABM_REALTEK) && defined(YABM_UDP))) && \
+  !defined(YABM_NO_MIB) && !defined(YABM_NO_UDP)
+#define	YABM_SNMP
+#endif
+
+#if defined(YABM_SNMP)
+
+/*
+ * Datagram sockets with the peer address from the firmware as udp_*,
+ * apart from the single rtl_udp_* socket.  udp_recvfrom returns the
+ * bytes read or 0 when nothing is pending.
+ */
+int udp_open(int port);
+int udp_recvfrom(int s, char *buf, int len, uint32_t *addr, int *port);
+int udp_sendto(int s, uint32_t addr, int port, char *buf, int len);
+void udp_close(int s);
+void delay_ms(int ms);
+
+#define	SNMP_MSGSIZE		1472
+#define	SNMP_HEADROOM		80
+#define	SNMP_VBSIZE		192
+#define	SNMP_OIDMAX		24
+#define	SNMP_VARBINDS		16
+#define	SNMP_QSIZE		2048
+#define	SNMP_PORTS		8
+#define	SNMP_COMMUNITY		32
+#define	SNMP_BURST		16
+
+#define	ASN_INTEGER		0x02
+#define	ASN_OCTETS		0x04
+#define	ASN_OID			0x06
+#define	ASN_SEQUENCE		0x30
+#define	ASN_COUNTER		0x41
+#define	ASN_NOSUCHOBJECT	0x80
+#define	ASN_NOSUCHINSTANCE	0x81
+#define	ASN_ENDOFMIBVIEW	0x82
+
+#define	SNMP_GET		0xa0
+#define	SNMP_GETNEXT		0xa1
+#define	SNMP_RESPONSE		0xa2
+#define	SNMP_GETBULK		0xa5
+
+#define	SNMP_TOOBIG		1
+
+/* Column syntaxes besides the ASN ones. */
+#define	SNMP_INDEX		0xf0
+#define	SNMP_COUNT		0xf1
+#define	SNMP_DESCR		0xf2
+
+typedef struct {
+  unsigned char sub;
+  unsigned char syntax;
+  short dir;
+  short type;
+} snmp_col;
+
+typedef struct {
+  unsigned char prefix[10];
+  unsigned char len;
+  unsigned char tree;
+  unsigned char table;
+  unsigned char ncols;
+  const snmp_col *cols;
+} snmp_group;
+
+typedef struct {
+  unsigned long oid[SNMP_OIDMAX];
+  int len;
+} snmp_oid;
+
+static const snmp_col ifnumber[] = {
+  { 1, SNMP_COUNT, 0, 0 },
+};
+
+static const snmp_col ifentry[] = {
+  { 1, SNMP_INDEX, 0, 0 },
+  { 2, SNMP_DESCR, 0, 0 },
+  { 3, ASN_INTEGER, 0, 6 },
+  { 10, ASN_COUNTER, MIB_IN, MIB_IFINOCTETS },
+  { 11, ASN_COUNTER, MIB_IN, MIB_IFINUCASTPKTS },
+  { 13, ASN_COUNTER, MIB_IN, MIB_DOT1DTPPORTINDISCARDS },
+  { 14, ASN_COUNTER, MIB_IN, MIB_DOT3STATSFCSERRORS },
+  { 16, ASN_COUNTER, MIB_OUT, MIB_IFOUTOCTETS },
+  { 17, ASN_COUNTER, MIB_OUT, MIB_IFOUTUCASTPKTS },
+  { 19, ASN_COUNTER, MIB_OUT, MIB_IFOUTDISCARDS },
+};
+
+static const snmp_col etherstatsentry[] = {
+  { 1, SNMP_INDEX, 0, 0 },
+  { 3, ASN_COUNTER, MIB_IN, MIB_ETHERSTATSDROPEVENTS },
+  { 4, ASN_COUNTER, MIB_IN, MIB_ETHERSTATSOCTETS },
+  { 6, ASN_COUNTER, MIB_IN, MIB_ETHERSTATSBROADCASTPKTS },
+  { 8, ASN_COUNTER, MIB_IN, MIB_DOT3STATSFCSERRORS },
+  { 9, ASN_COUNTER, MIB_IN, MIB_ETHERSTATSUNDERSIZEPKTS },
+  { 10, ASN_COUNTER, MIB_IN, MIB_ETHERSTATSOVERSIZEPKTS },
+  { 11, ASN_COUNTER, MIB_IN, MIB_ETHERSTATSFRAGMEMTS },
+  { 12, ASN_COUNTER, MIB_IN, MIB_ETHERSTATSJABBERS },
+  { 13, ASN_COUNTER, MIB_OUT, MIB_ETHERSTATSCOLLISIONS },
+  { 14, ASN_COUNTER, MIB_IN, MIB_ETHERSTATSPKTS64OCTETS },
+  { 15, ASN_COUNTER, MIB_IN, MIB_ETHERSTATSPKTS65TO127OCTETS },
+  { 16, ASN_COUNTER, MIB_IN, MIB_ETHERSTATSPKTS128TO255OCTETS },
+  { 17, ASN_COUNTER, MIB_IN, MIB_ETHERSTATSPKTS256TO511OCTETS },
+  { 18, ASN_COUNTER, MIB_IN, MIB_ETHERSTATSPKTS512TO1023OCTETS },
+  { 19, ASN_COUNTER, MIB_IN, MIB_ETHERSTATSPKTS1024TO1518OCTETS },
+};
+
+/*
+ * In OID order.  tree is the length of the subtree the agent owns:
+ * interfaces (1.3.6.1.2.1.2) and etherStatsTable (1.3.6.1.2.1.16.1.1).
+ */
+static const snmp_group snmpgroups[] = {
+  { { 1, 3, 6, 1, 2, 1, 2 }, 7, 7, 0,
+    sizeof(ifnumber) / sizeof(snmp_col), ifnumber },
+  { { 1, 3, 6, 1, 2, 1, 2, 2, 1 }, 9, 7, 1,
+    sizeof(ifentry) / sizeof(snmp_col), ifentry },
+  { { 1, 3, 6, 1, 2, 1, 16, 1, 1, 1 }, 10, 9, 1,
+    sizeof(etherstatsentry) / sizeof(snmp_col), etherstatsentry },
+};
+
+#define	SNMP_GROUPS	(sizeof(snmpgroups) / sizeof(snmp_group))
+
+static int snmpsock = -1;
+static int snmpports;
+static int snmppassthru;
+static int snmplast;
+static char snmpcommunity[SNMP_COMMUNITY];
+static int snmpcommunitylen;
+
+static unsigned char snmpreq[SNMP_MSGSIZE];
+static unsigned char snmpout[SNMP_HEADROOM + SNMP_MSGSIZE];
+static snmp_oid snmpvb[SNMP_VARBINDS];
+static char snmpq[SNMP_QSIZE];
+static int snmpqlen;
+
+static unsigned int snmprequests;
+static unsigned int snmpanswered;
+static unsigned int snmppassed;
+static unsigned int snmpdropped;
+static unsigned int snmpbad;
+
+/* Content length of the next element, tag < 0 for any tag, or -1. */
+static int mrb_yabm_ber_get(unsigned char **pp, unsigned char *end, int tag)
+{
+  unsigned char *p = *pp;
+  int len, n;
+
+  if (end - p < 2 || (tag >= 0 && *p != tag))
+    return -1;
+  ++p;
+  len = *p++;
+  if (len & 0x80) {
+    n = len & 0x7f;
+    if (n < 1 || n > 2 || end - p < n)
+      return -1;
+    for (len = 0; n > 0; --n)
+      len = (len << 8) | *p++;
+  }
+  if (end - p < len)
+    return -1;
+  *pp = p;
+  return len;
+}
+
+static int mrb_yabm_ber_int(unsigned char **pp, unsigned char *end, long *val)
+{
+  int len;
+
+  len = mrb_yabm_ber_get(pp, end, ASN_INTEGER);
+  if (len < 1 || len > 4)
+    return -1;
+  *val = (**pp & 0x80) ? -1 : 0;
+  while (len--)
+    *val = (*val << 8) | *(*pp)++;
+  return 0;
+}
+
+static int mrb_yabm_ber_oid(unsigned char **pp, unsigned char *end,
+  snmp_oid *oid)
+{
+  unsigned char *p;
+  unsigned long val;
+  int len;
+
+  len = mrb_yabm_ber_get(pp, end, ASN_OID);
+  if (len < 1)
+    return -1;
+  p = *pp;
+  *pp += len;
+  oid->oid[0] = *p < 80 ? *p / 40 : 2;
+  oid->oid[1] = *p - oid->oid[0] * 40;
+  oid->len = 2;
+  for (++p, val = 0; p < *pp; ++p) {
+    val = (val << 7) | (*p & 0x7f);
+    if (*p & 0x80)
+      continue;
+    if (oid->len == SNMP_OIDMAX)
+      return -1;
+    oid->oid[oid->len++] = val;
+    val = 0;
+  }
+  return 0;
+}
+
+static unsigned char *mrb_yabm_ber_hdr(unsigned char *p, int tag, int len)
+{
+  *p++ = tag;
+  if (len >= 256) {
+    *p++ = 0x82;
+    *p++ = len >> 8;
+  } else if (len >= 128) {
+    *p++ = 0x81;
+  }
+  *p++ = len;
+  return p;
+}
+
+/* INTEGER when sign, else an unsigned type such as Counter32. */
+static unsigned char *mrb_yabm_ber_num(unsigned char *p, int tag,
+  unsigned long val, int sign)
+{
+  unsigned char b[5];
+  int i;
+
+  b[0] = (sign && (val & 0x80000000UL)) ? 0xff : 0;
+  for (i = 1; i < 5; ++i)
+    b[i] = val >> ((4 - i) * 8);
+  for (i = 0; i < 4 && b[i] == (((b[i + 1] & 0x80) != 0) ? 0xff : 0); ++i)
+    ;
+  p = mrb_yabm_ber_hdr(p, tag, 5 - i);
+  memcpy(p, b + i, 5 - i);
+  return p + 5 - i;
+}
+
+static unsigned char *mrb_yabm_ber_putoid(unsigned char *p,
+  const snmp_oid *oid)
+{
+  unsigned char *len;
+  unsigned long val;
+  int i, n;
+
+  *p++ = ASN_OID;
+  len = p++;
+  *p++ = oid->oid[0] * 40 + oid->oid[1];
+  for (i = 2; i < oid->len; ++i) {
+    val = oid->oid[i];
+    for (n = 28; n > 0 && (val >> n) == 0; n -= 7)
+      ;
+    for (; n > 0; n -= 7)
+      *p++ = 0x80 | ((val >> n) & 0x7f);
+    *p++ = val & 0x7f;
+  }
+  *len = p - len - 1;
+  return p;
+}
+
+static int mrb_yabm_snmp_cmp(const snmp_oid *a, const snmp_oid *b)
+{
+  int i;
+
+  for (i = 0; i < a->len && i < b->len; ++i)
+    if (a->oid[i] != b->oid[i])
+      return a->oid[i] < b->oid[i] ? -1 : 1;
+  return a->len - b->len;
+}
+
+static int mrb_yabm_snmp_intree(const snmp_oid *oid, const snmp_group *g)
+{
+  int i;
+
+  if (oid->len < g->tree)
+    return 0;
+  for (i = 0; i < g->tree; ++i)
+    if (oid->oid[i] != g->prefix[i])
+      return 0;
+  return 1;
+}
+
+/*
+ * Looks up oid, or with next the first instance after it, in place.
+ * The next instance must lie in the subtree of oid unless anywhere is
+ * set.  Returns the column, or NULL with *row set to -1 at the end,
+ * -2 for a missing row of a known column and 0 otherwise.
+ */
+static const snmp_col *mrb_yabm_snmp_find(snmp_oid *oid, int next,
+  int anywhere, int *row)
+{
+  const snmp_group *g;
+  snmp_oid inst;
+  int i, c, r, rows, cmp, known;
+
+  known = 0;
+  for (i = 0; i < SNMP_GROUPS; ++i) {
+    g = &snmpgroups[i];
+    if (next && !anywhere && !mrb_yabm_snmp_intree(oid, g))
+      continue;
+    rows = g->table ? snmpports : 1;
+    for (c = 0; c < g->len; ++c)
+      inst.oid[c] = g->prefix[c];
+    inst.len = g->len + 2;
+    for (c = 0; c < g->ncols; ++c) {
+      inst.oid[g->len] = g->cols[c].sub;
+      if (!next && oid->len > g->len + 1 &&
+        memcmp(inst.oid, oid->oid, (g->len + 1) * sizeof(inst.oid[0])) == 0)
+        known = 1;
+      for (r = g->table; r < g->table + rows; ++r) {
+        inst.oid[g->len + 1] = r;
+        cmp = mrb_yabm_snmp_cmp(&inst, oid);
+        if (cmp == 0 && !next) {
+          *row = r;
+          return &g->cols[c];
+        }
+        if (cmp > 0 && next) {
+          *oid = inst;
+          *row = r;
+          return &g->cols[c];
+        }
+      }
+    }
+  }
+  *row = next ? -1 : known ? -2 : 0;
+  return NULL;
+}
+
+static unsigned char *mrb_yabm_snmp_value(unsigned char *p,
+  const snmp_col *col, int row)
+{
+  switch (col->syntax) {
+  case SNMP_INDEX:
+    return mrb_yabm_ber_num(p, ASN_INTEGER, row, 1);
+  case SNMP_COUNT:
+    return mrb_yabm_ber_num(p, ASN_INTEGER, snmpports, 1);
+  case SNMP_DESCR:
+    p = mrb_yabm_ber_hdr(p, ASN_OCTETS, 5);
+    memcpy(p, "port", 4);
+    p[4] = '0' + row;
+    return p + 5;
+  case ASN_INTEGER:
+    return mrb_yabm_ber_num(p, ASN_INTEGER, col->type, 1);
+  }
+  return mrb_yabm_ber_num(p, ASN_COUNTER,
+    mrb_yabm_mibread(row - 1, col->dir, col->type), 0);
+}
+
+/*
+ * Appends one varbind at p, or returns NULL when it does not fit before
+ * end.  col is NULL for an exception: noSuchObject, noSuchInstance or
+ * endOfMibView as set by mrb_yabm_snmp_find.
+ */
+static unsigned char *mrb_yabm_snmp_varbind(unsigned char *p,
+  unsigned char *end, const snmp_oid *oid, const snmp_col *col, int row)
+{
+  unsigned char vb[SNMP_VBSIZE], *q;
+
+  q = mrb_yabm_ber_putoid(vb, oid);
+  if (col != NULL) {
+    q = mrb_yabm_snmp_value(q, col, row);
+  } else {
+    *q++ = row == -1 ? ASN_ENDOFMIBVIEW :
+      row == -2 ? ASN_NOSUCHINSTANCE : ASN_NOSUCHOBJECT;
+    *q++ = 0;
+  }
+  if (end - p < q - vb + 3)
+    return NULL;
+  p = mrb_yabm_ber_hdr(p, ASN_SEQUENCE, q - vb);
+  memcpy(p, vb, q - vb);
+  return p + (q - vb);
+}
+
+/*
+ * Answers the request in snmpreq into snmpout.  Returns the response
+ * length with *res at its start, 0 to hand the request to Ruby, or -1
+ * to drop it.
+ */
+static int mrb_yabm_snmp_answer(int len, unsigned char **res)
+{
+  const snmp_col *col;
+  unsigned char *p, *end, *vbl, *q, *limit;
+  unsigned char *community, pdu, hdr[24];
+  long version, reqid, nonrep, maxrep;
+  int n, i, count, rep, row, error, ended, communitylen;
+
+  p = snmpreq;
+  end = snmpreq + len;
+  if ((n = mrb_yabm_ber_get(&p, end, ASN_SEQUENCE)) < 0)
+    return -1;
+  end = p + n;
+  if (mrb_yabm_ber_int(&p, end, &version) < 0 ||
+    (communitylen = mrb_yabm_ber_get(&p, end, ASN_OCTETS)) < 0)
+    return -1;
+  community = p;
+  p += communitylen;
+  if (version != 1 || p == end)
+    return snmppassthru ? 0 : -1;
+  if (communitylen != snmpcommunitylen ||
+    memcmp(community, snmpcommunity, communitylen) != 0)
+    return -1;
+  pdu = *p;
+  if (pdu != SNMP_GET && pdu != SNMP_GETNEXT && pdu != SNMP_GETBULK)
+    return snmppassthru ? 0 : -1;
+  if (mrb_yabm_ber_get(&p, end, pdu) < 0 ||
+    mrb_yabm_ber_int(&p, end, &reqid) < 0 ||
+    mrb_yabm_ber_int(&p, end, &nonrep) < 0 ||
+    mrb_yabm_ber_int(&p, end, &maxrep) < 0 ||
+    (n = mrb_yabm_ber_get(&p, end, ASN_SEQUENCE)) < 0)
+    return -1;
+  end = p + n;
+  for (count = 0; p < end; ++count) {
+    if (count == SNMP_VARBINDS)
+      return snmppassthru ? 0 : -1;
+    if ((n = mrb_yabm_ber_get(&p, end, ASN_SEQUENCE)) < 0)
+      return -1;
+    q = p + n;
+    if (mrb_yabm_ber_oid(&p, q, &snmpvb[count]) < 0 ||
+      mrb_yabm_ber_get(&p, q, -1) < 0)
+      return -1;
+    p = q;
+  }
+
+  if (pdu != SNMP_GETBULK) {
+    nonrep = count;
+    maxrep = 0;
+  }
+  if (nonrep < 0)
+    nonrep = 0;
+  if (nonrep > count)
+    nonrep = count;
+  vbl = p = snmpout + SNMP_HEADROOM;
+  limit = vbl + SNMP_MSGSIZE - SNMP_HEADROOM;
+  error = 0;
+  for (i = 0; i < nonrep; ++i) {
+    col = mrb_yabm_snmp_find(&snmpvb[i], pdu != SNMP_GET, !snmppassthru,
+      &row);
+    if (col == NULL && snmppassthru)
+      return 0;
+    q = mrb_yabm_snmp_varbind(p, limit, &snmpvb[i], col, row);
+    if (q == NULL) {
+      error = SNMP_TOOBIG;
+      p = vbl;
+      break;
+    }
+    p = q;
+  }
+  /* Repetitions stop short once a column leaves the agent's subtree. */
+  for (rep = 0; !error && rep < maxrep; ++rep) {
+    ended = 0;
+    for (i = nonrep; i < count; ++i) {
+      col = mrb_yabm_snmp_find(&snmpvb[i], 1, !snmppassthru, &row);
+      if (col == NULL && snmppassthru) {
+        if (rep == 0)
+          return 0;
+        break;
+      }
+      ended += col == NULL;
+      q = mrb_yabm_snmp_varbind(p, limit, &snmpvb[i], col, row);
+      if (q == NULL)
+        break;
+      p = q;
+    }
+    if (i < count || ended == count - nonrep)
+      break;
+  }
+
+  /* Headers go in front of the varbinds, innermost first. */
+  q = mrb_yabm_ber_num(hdr, ASN_INTEGER, reqid, 1);
+  q = mrb_yabm_ber_num(q, ASN_INTEGER, error, 1);
+  q = mrb_yabm_ber_num(q, ASN_INTEGER, 0, 1);
+  q = mrb_yabm_ber_hdr(q, ASN_SEQUENCE, p - vbl);
+  n = q - hdr;
+  vbl -= n;
+  memcpy(vbl, hdr, n);
+  q = mrb_yabm_ber_hdr(hdr, SNMP_RESPONSE, p - vbl);
+  n = q - hdr;
+  vbl -= n;
+  memcpy(vbl, hdr, n);
+  vbl -= communitylen;
+  memcpy(vbl, community, communitylen);
+  q = mrb_yabm_ber_num(hdr, ASN_INTEGER, version, 1);
+  q = mrb_yabm_ber_hdr(q, ASN_OCTETS, communitylen);
+  n = q - hdr;
+  vbl -= n;
+  memcpy(vbl, hdr, n);
+  q = mrb_yabm_ber_hdr(hdr, ASN_SEQUENCE, p - vbl);
+  n = q - hdr;
+  vbl -= n;
+  memcpy(vbl, hdr, n);
+  *res = vbl;
+  return p - vbl;
+}
+
+/* Queued for Ruby as addr(4) port(2) len(2) data. */
+static void mrb_yabm_snmp_queue(uint32_t addr, int port, int len)
+{
+  unsigned char *p;
+
+  if (snmpqlen + 8 + len > SNMP_QSIZE) {
+    ++snmpdropped;
+    return;
+  }
+  p = (unsigned char *)snmpq + snmpqlen;
+  p[0] = addr >> 24;
+  p[1] = addr >> 16;
+  p[2] = addr >> 8;
+  p[3] = addr;
+  p[4] = port >> 8;
+  p[5] = port;
+  p[6] = len >> 8;
+  p[7] = len;
+  memcpy(p + 8, snmpreq, len);
+  snmpqlen += 8 + len;
+  ++snmppassed;
+}
+
+/* Busy for a second after each request, so walks get short sleeps. */
+int mrb_yabm_snmp_poll()
+{
+  unsigned char *res;
+  uint32_t addr;
+  int i, len, n, port;
+
+  if (snmpsock < 0)
+    return 0;
+  for (i = 0; i < SNMP_BURST; ++i) {
+    len = udp_recvfrom(snmpsock, (char *)snmpreq, sizeof(snmpreq), &addr,
+      &port);
+    if (len <= 0)
+      break;
+    ++snmprequests;
+    snmplast = mrb_yabm_clock();
+    n = mrb_yabm_snmp_answer(len, &res);
+    if (n > 0) {
+      udp_sendto(snmpsock, addr, port, (char *)res, n);
+      ++snmpanswered;
+    } else if (n == 0) {
+      mrb_yabm_snmp_queue(addr, port, len);
+    } else {
+      ++snmpbad;
+    }
+  }
+  return mrb_yabm_clock() - snmplast < 1000;
+}
+
+static void mrb_yabm_snmp_close()
+{
+  if (snmpsock >= 0)
+    udp_close(snmpsock);
+  snmpsock = -1;
+  snmpqlen = 0;
+}
+
+/*
+ * snmpstart(port = 161, community = "public", ports = 5, passthru = true)
+ * answers GET, GETNEXT and GETBULK on interfaces and etherStatsTable
+ * from the MIB counters, ifIndex n being switch port n - 1.  With
+ * passthru everything else is left for snmprecv, otherwise answered
+ * with noSuchObject, noSuchInstance or endOfMibView.
+ */
+static mrb_value mrb_yabm_snmpstart(mrb_state *mrb, mrb_value self)
+{
+  mrb_value community = mrb_nil_value();
+  mrb_int port = 161, ports = 5;
+  mrb_bool passthru = 1;
+  mrb_get_args(mrb, "|iSib", &port, &community, &ports, &passthru);
+
+  if (ports < 1 || ports > SNMP_PORTS)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid port count");
+  if (mrb_nil_p(community)) {
+    memcpy(snmpcommunity, "public", 6);
+    snmpcommunitylen = 6;
+  } else {
+    if (RSTRING_LEN(community) > SNMP_COMMUNITY)
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "community too long");
+    memcpy(snmpcommunity, RSTRING_PTR(community), RSTRING_LEN(community));
+    snmpcommunitylen = RSTRING_LEN(community);
+  }
+  mrb_yabm_snmp_close();
+  snmpsock = udp_open(port);
+  if (snmpsock < 0)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "cannot open SNMP port");
+  snmpports = ports;
+  snmppassthru = passthru;
+  snmplast = mrb_yabm_clock() - 1000;
+  mrb_yabm_trace(TRACE_SNMP, TRACE_OP_BIND, port, 0);
+
+  return mrb_fixnum_value(0);
+}
+
+/*
+ * snmprecv(timeout = 0) returns [addr, port, request] for a request the
+ * agent left to Ruby, or nil.  Reply with snmpsend.
+ */
+static mrb_value mrb_yabm_snmprecv(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res;
+  mrb_int timeout = 0;
+  unsigned char *p;
+  uint32_t addr;
+  int len, start;
+  mrb_get_args(mrb, "|i", &timeout);
+
+  start = mrb_yabm_clock();
+  mrb_yabm_poll();
+  while (snmpqlen == 0 && snmpsock >= 0 && timeout > 0 &&
+    mrb_yabm_clock() - start < timeout) {
+    delay_ms(1);
+    mrb_yabm_poll();
+  }
+  if (snmpqlen == 0)
+    return mrb_nil_value();
+  p = (unsigned char *)snmpq;
+  addr = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+  len = (p[6] << 8) | p[7];
+  res = mrb_ary_new_capa(mrb, 3);
+  mrb_ary_push(mrb, res, mrb_yabm_iptostr(mrb, addr));
+  mrb_ary_push(mrb, res, mrb_fixnum_value((p[4] << 8) | p[5]));
+  mrb_ary_push(mrb, res, mrb_str_new(mrb, snmpq + 8, len));
+  snmpqlen -= 8 + len;
+  memmove(snmpq, snmpq + 8 + len, snmpqlen);
+  mrb_yabm_trace(TRACE_SNMP, TRACE_OP_RECV, len, 0);
+
+  return res;
+}
+
+/* snmpsend(addr, port, data) replies from the agent port */
+static mrb_value mrb_yabm_snmpsend(mrb_state *mrb, mrb_value self)
+{
+  mrb_value addr, data;
+  mrb_int port, len;
+  char *ptr;
+  mrb_get_args(mrb, "Sio", &addr, &port, &data);
+
+  if (snmpsock < 0)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "SNMP not started");
+  ptr = mrb_yabm_bytes(mrb, data, &len);
+  len = udp_sendto(snmpsock, mrb_yabm_strtoip(mrb, addr), port, ptr, len);
+  mrb_yabm_trace(TRACE_SNMP, TRACE_OP_SEND, port, len);
+
+  return mrb_fixnum_value(len);
+}
+
+/* snmpstat returns [requests, answered, passed, dropped, bad] */
+static mrb_value mrb_yabm_snmpstat(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res;
+
+  res = mrb_ary_new_capa(mrb, 5);
+  mrb_ary_push(mrb, res, mrb_fixnum_value(snmprequests));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(snmpanswered));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(snmppassed));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(snmpdropped));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(snmpbad));
+
+  return res;
+}
+
+static mrb_value mrb_yabm_snmpstop(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_snmp_close();
+  mrb_yabm_trace(TRACE_SNMP, TRACE_OP_CLOSE, 0, 0);
+
+  return mrb_fixnum_value(0);
+}
+#else
+int mrb_yabm_snmp_poll()
+{
+  return 0;
+}
+#endif /* YABM_SNMP */
+
+void mrb_yabm_snmp_init(mrb_state *mrb, struct RClass *yabm)
+{
+#if defined(YABM_SNMP)
+  yabm_define_method(mrb, yabm, "snmpstart", mrb_yabm_snmpstart, MRB_ARGS_OPT(4));
+  yabm_define_method(mrb, yabm, "snmprecv", mrb_yabm_snmprecv, MRB_ARGS_OPT(1));
+  yabm_define_method(mrb, yabm, "snmpsend", mrb_yabm_snmpsend, MRB_ARGS_REQ(3));
+  yabm_define_method(mrb, yabm, "snmpstat", mrb_yabm_snmpstat, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "snmpstop", mrb_yabm_snmpstop, MRB_ARGS_NONE());
+#endif
+}
+
+void mrb_yabm_snmp_final(mrb_state *mrb)
+{
+#if defined(YABM_SNMP)
+  mrb_yabm_snmp_close();
+  snmprequests = 0;
+  snmpanswered = 0;
+  snmppassed = 0;
+  snmpdropped = 0;
+  snmpbad = 0;
+#endif
+}
@@ -0,0 +1,188 @@
+/*
+** mrb_yabm_spi.c - SPI master on GPIO pins
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+unsigned long gpio_getdir();
+void gpio_setdir(unsigned long val);
+unsigned long gpio_getdat();
+void gpio_setdat(unsigned long val);
+
+static unsigned long spisck;
+static unsigned long spimosi;
+static unsigned long spimiso;
+static unsigned long spics;
+static int spicpol;
+static int spicpha;
+static int spidiv;
+static int spiactive;
+
+static void mrb_yabm_spi_delay()
+{
+  volatile int i;
+
+  for (i = 0; i < spidiv; ++i)
+    ;
+}
+
+/*
+ * Shift len bytes out of out, MSB first, and store what comes back in
+ * in when it is not NULL.  The data register is written from a shadow
+ * copy read once per call, so each edge is a single register write.
+ */
+static void mrb_yabm_spi_shift(const unsigned char *out, unsigned char *in,
+  int len)
+{
+  unsigned long dat;
+  int i, bit, val;
+
+  dat = gpio_getdat();
+  dat = spicpol ? dat | spisck : dat & ~spisck;
+  if (spics && !spiactive) {
+    dat &= ~spics;
+    gpio_setdat(dat);
+    spiactive = 1;
+  }
+  for (i = 0; i < len; ++i) {
+    val = 0;
+    for (bit = 0x80; bit != 0; bit >>= 1) {
+      if (!spicpha) {
+        dat = (out[i] & bit) ? dat | spimosi : dat & ~spimosi;
+        gpio_setdat(dat);
+        mrb_yabm_spi_delay();
+        gpio_setdat(dat ^ spisck);
+        if (in != NULL && (gpio_getdat() & spimiso))
+          val |= bit;
+        mrb_yabm_spi_delay();
+      } else {
+        dat = (out[i] & bit) ? dat | spimosi : dat & ~spimosi;
+        gpio_setdat(dat ^ spisck);
+        mrb_yabm_spi_delay();
+        gpio_setdat(dat);
+        if (in != NULL && (gpio_getdat() & spimiso))
+          val |= bit;
+        mrb_yabm_spi_delay();
+      }
+    }
+    if (in != NULL)
+      in[i] = val;
+  }
+  if (!spicpha && len > 0)
+    gpio_setdat(dat);
+}
+
+static void mrb_yabm_spi_release(int hold)
+{
+  if (spics && spiactive && !hold) {
+    gpio_setdat(gpio_getdat() | spics);
+    spiactive = 0;
+  }
+}
+
+/*
+ * spiinit(sck, mosi, miso, cs = -1, mode = 0, div = 0) takes GPIO pin
+ * numbers, -1 for an unused pin.  div is the busy loop count per half
+ * clock, 0 for the fastest clock.
+ */
+static mrb_value mrb_yabm_spiinit(mrb_state *mrb, mrb_value self)
+{
+  mrb_int sck, mosi, miso, cs = -1, mode = 0, div = 0;
+  unsigned long dat;
+  mrb_get_args(mrb, "iii|iii", &sck, &mosi, &miso, &cs, &mode, &div);
+
+  if (sck < 0 || sck > 31 || mosi > 31 || miso > 31 || cs > 31 ||
+    mode < 0 || mode > 3 || div < 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid SPI parameter");
+  spisck = 1UL << sck;
+  spimosi = mosi < 0 ? 0 : 1UL << mosi;
+  spimiso = miso < 0 ? 0 : 1UL << miso;
+  spics = cs < 0 ? 0 : 1UL << cs;
+  spicpol = mode >> 1;
+  spicpha = mode & 1;
+  spidiv = div;
+  spiactive = 0;
+
+  dat = gpio_getdat() | spics;
+  dat = spicpol ? dat | spisck : dat & ~spisck;
+  gpio_setdat(dat);
+  gpio_setdir((gpio_getdir() | spisck | spimosi | spics) & ~spimiso);
+
+  return mrb_fixnum_value(0);
+}
+
+/*
+ * spixfer(data, hold = false, buf = nil) sends data, a String or Buffer,
+ * and returns the bytes read meanwhile, or their count when stored in
+ * buf.  With hold chip select stays asserted for the next call.
+ */
+static mrb_value mrb_yabm_spixfer(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_buffer *buf;
+  mrb_value data, res, dst = mrb_nil_value();
+  mrb_bool hold = 0;
+  mrb_int len;
+  char *ptr;
+  mrb_get_args(mrb, "o|bo", &data, &hold, &dst);
+
+  if (spisck == 0)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "SPI not initialized");
+  buf = mrb_yabm_buffer_arg(mrb, dst);
+  ptr = mrb_yabm_bytes(mrb, data, &len);
+  if (buf != NULL) {
+    if (len > buf->capa)
+      len = buf->capa;
+    mrb_yabm_spi_shift((unsigned char *)ptr, (unsigned char *)buf->ptr, len);
+    mrb_yabm_buffer_set(buf, len);
+    res = mrb_fixnum_value(len);
+  } else {
+    res = mrb_str_new(mrb, NULL, len);
+    ptr = mrb_yabm_bytes(mrb, data, &len);
+    mrb_yabm_spi_shift((unsigned char *)ptr,
+      (unsigned char *)RSTRING_PTR(res), len);
+  }
+  mrb_yabm_spi_release(hold);
+  mrb_yabm_trace(TRACE_SPI, TRACE_OP_READ, hold, len);
+
+  return res;
+}
+
+/* spiwrite(data, hold = false) sends without sampling MISO */
+static mrb_value mrb_yabm_spiwrite(mrb_state *mrb, mrb_value self)
+{
+  mrb_value data;
+  mrb_bool hold = 0;
+  mrb_int len;
+  char *ptr;
+  mrb_get_args(mrb, "o|b", &data, &hold);
+
+  if (spisck == 0)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "SPI not initialized");
+  ptr = mrb_yabm_bytes(mrb, data, &len);
+  mrb_yabm_spi_shift((unsigned char *)ptr, NULL, len);
+  mrb_yabm_spi_release(hold);
+  mrb_yabm_trace(TRACE_SPI, TRACE_OP_WRITE, hold, len);
+
+  return mrb_fixnum_value(len);
+}
+
+void mrb_yabm_spi_init(mrb_state *mrb, struct RClass *yabm)
+{
+  yabm_define_method(mrb, yabm, "spiinit", mrb_yabm_spiinit, MRB_ARGS_ARG(3, 3));
+  yabm_define_method(mrb, yabm, "spixfer", mrb_yabm_spixfer, MRB_ARGS_ARG(1, 2));
+  yabm_define_method(mrb, yabm, "spiwrite", mrb_yabm_spiwrite, MRB_ARGS_ARG(1, 1));
+}
+
+void mrb_yabm_spi_final(mrb_state *mrb)
+{
+  spisck = 0;
+  spiactive = 0;
+}
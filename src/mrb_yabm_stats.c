@@ -0,0 +1,221 @@
+/*
+** mrb_yabm_stats.c - per-method call statistics
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+#include "mruby/proc.h"
+
+#include "mrb_yabm.h"
+
+#if defined(YABM_STATS)
+
+#define	STATS_MIN		128
+#define	STATS_BUCKETS		16
+#define	STATS_BUFARGS		4
+
+typedef struct {
+  mrb_sym mid;
+  mrb_func_t func;
+  unsigned int calls;
+  unsigned long long total;
+  unsigned int max;
+  unsigned long long bytes;
+  unsigned int hist[STATS_BUCKETS];
+} stats_entry;
+
+/*
+ * Open addressing on the method symbol.  The table doubles before it is
+ * three quarters full, so every registered method keeps an entry.
+ */
+static stats_entry *stats;
+static int statsmax;
+static int statsused;
+
+static stats_entry *mrb_yabm_stats_find(mrb_sym mid)
+{
+  int i, n;
+
+  if (statsmax == 0)
+    return NULL;
+  i = mid % statsmax;
+  for (n = 0; n < statsmax; ++n) {
+    if (stats[i].mid == mid || stats[i].mid == 0)
+      return &stats[i];
+    i = (i + 1) % statsmax;
+  }
+  return NULL;
+}
+
+static void mrb_yabm_stats_grow(mrb_state *mrb)
+{
+  stats_entry *old;
+  int i, oldmax;
+
+  old = stats;
+  oldmax = statsmax;
+  statsmax = oldmax ? oldmax * 2 : STATS_MIN;
+  stats = (stats_entry *)mrb_calloc(mrb, statsmax, sizeof(stats_entry));
+  for (i = 0; i < oldmax; ++i)
+    if (old[i].mid != 0)
+      *mrb_yabm_stats_find(old[i].mid) = old[i];
+  mrb_free(mrb, old);
+}
+
+static int mrb_yabm_stats_bucket(unsigned int us)
+{
+  int b;
+
+  b = 0;
+  while (us > 1 && b < STATS_BUCKETS - 1) {
+    us >>= 1;
+    ++b;
+  }
+  return b;
+}
+
+/*
+ * The wrapper's proc carries the registered name, so an alias still
+ * finds its entry.  Buffer arguments count their view after the call,
+ * which is what a native fill received or what a send left in place.
+ */
+static mrb_value mrb_yabm_stats_call(mrb_state *mrb, mrb_value self)
+{
+  stats_entry *ent;
+  const mrb_value *argv;
+  mrb_value res, bufs[STATS_BUFARGS];
+  unsigned int start, us, bytes;
+  int i, argc, nbufs;
+
+  ent = mrb_yabm_stats_find(mrb_symbol(mrb_proc_cfunc_env_get(mrb, 0)));
+  if (ent == NULL || ent->func == NULL)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "unknown instrumented method");
+  bytes = 0;
+  nbufs = 0;
+  argc = mrb_get_argc(mrb);
+  argv = mrb_get_argv(mrb);
+  for (i = 0; i < argc; ++i) {
+    if (mrb_string_p(argv[i]))
+      bytes += RSTRING_LEN(argv[i]);
+    else if (nbufs < STATS_BUFARGS && mrb_yabm_buffer_get(mrb, argv[i]))
+      bufs[nbufs++] = argv[i];
+  }
+  start = mrb_yabm_uclock();
+  res = ent->func(mrb, self);
+  us = mrb_yabm_uclock() - start;
+  if (mrb_string_p(res))
+    bytes += RSTRING_LEN(res);
+  for (i = 0; i < nbufs; ++i)
+    if (DATA_PTR(bufs[i]) != NULL)
+      bytes += mrb_yabm_buffer_get(mrb, bufs[i])->len;
+  ++ent->calls;
+  ent->total += us;
+  if (us > ent->max)
+    ent->max = us;
+  ent->bytes += bytes;
+  ++ent->hist[mrb_yabm_stats_bucket(us)];
+
+  return res;
+}
+
+void mrb_yabm_stats_define(mrb_state *mrb, struct RClass *c, const char *name,
+  mrb_func_t func, mrb_aspec aspec)
+{
+  stats_entry *ent;
+  struct RProc *p;
+  mrb_method_t m;
+  mrb_value env;
+  mrb_sym mid;
+
+  mid = mrb_intern_cstr(mrb, name);
+  if ((statsused + 1) * 4 > statsmax * 3)
+    mrb_yabm_stats_grow(mrb);
+  ent = mrb_yabm_stats_find(mid);
+  if (ent->mid == 0)
+    ++statsused;
+  ent->mid = mid;
+  ent->func = func;
+  env = mrb_symbol_value(mid);
+  p = mrb_proc_new_cfunc_with_env(mrb, mrb_yabm_stats_call, 1, &env);
+  MRB_METHOD_FROM_PROC(m, p);
+  mrb_define_method_raw(mrb, c, mid, m);
+}
+
+static mrb_value mrb_yabm_num(mrb_state *mrb, unsigned long long val)
+{
+  if (val > MRB_INT_MAX)
+    val = MRB_INT_MAX;
+  return mrb_fixnum_value((mrb_int)val);
+}
+
+/*
+ * YABM.stats(reset = false) returns
+ * [[name, calls, total_us, max_us, bytes, [log2 histogram]], ...]
+ * for every method called since the last reset.
+ */
+static mrb_value mrb_yabm_stats(mrb_state *mrb, mrb_value self)
+{
+  stats_entry *ent;
+  mrb_value res, row, hist;
+  mrb_bool reset = 0;
+  int i, j;
+  mrb_get_args(mrb, "|b", &reset);
+
+  res = mrb_ary_new(mrb);
+  for (i = 0; i < statsmax; ++i) {
+    ent = &stats[i];
+    if (ent->mid == 0 || ent->calls == 0)
+      continue;
+    row = mrb_ary_new(mrb);
+    mrb_ary_push(mrb, row, mrb_str_new_cstr(mrb, mrb_sym_name(mrb, ent->mid)));
+    mrb_ary_push(mrb, row, mrb_yabm_num(mrb, ent->calls));
+    mrb_ary_push(mrb, row, mrb_yabm_num(mrb, ent->total));
+    mrb_ary_push(mrb, row, mrb_yabm_num(mrb, ent->max));
+    mrb_ary_push(mrb, row, mrb_yabm_num(mrb, ent->bytes));
+    hist = mrb_ary_new(mrb);
+    for (j = 0; j < STATS_BUCKETS; ++j)
+      mrb_ary_push(mrb, hist, mrb_yabm_num(mrb, ent->hist[j]));
+    mrb_ary_push(mrb, row, hist);
+    mrb_ary_push(mrb, res, row);
+    if (reset) {
+      ent->calls = 0;
+      ent->total = 0;
+      ent->max = 0;
+      ent->bytes = 0;
+      memset(ent->hist, 0, sizeof(ent->hist));
+    }
+  }
+
+  return res;
+}
+
+#else
+
+static mrb_value mrb_yabm_stats(mrb_state *mrb, mrb_value self)
+{
+  return mrb_ary_new(mrb);
+}
+
+#endif /* YABM_STATS */
+
+void mrb_yabm_stats_init(mrb_state *mrb, struct RClass *yabm)
+{
+  mrb_define_class_method(mrb, yabm, "stats", mrb_yabm_stats, MRB_ARGS_OPT(1));
+}
+
+void mrb_yabm_stats_final(mrb_state *mrb)
+{
+#if defined(YABM_STATS)
+  mrb_free(mrb, stats);
+  stats = NULL;
+  statsmax = 0;
+  statsused = 0;
+#endif
+}
@@ -0,0 +1,284 @@
+/*
+** mrb_yabm_telemetry.c - line protocol / JSON encoder into a Buffer
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+static void mrb_yabm_tm_cat(mrb_yabm_tm *tm, const char *ptr, int len)
+{
+  mrb_yabm_buffer *buf = tm->buf;
+
+  if (tm->full || len > buf->capa - buf->fill) {
+    tm->full = 1;
+    return;
+  }
+  memcpy(buf->ptr + buf->fill, ptr, len);
+  buf->fill += len;
+}
+
+static void mrb_yabm_tm_num(mrb_yabm_tm *tm, unsigned long val, int neg,
+  int digits)
+{
+  char str[24];
+  int i;
+
+  i = sizeof(str);
+  do {
+    str[--i] = '0' + val % 10;
+    val /= 10;
+  } while (val != 0 || (int)sizeof(str) - i < digits);
+  if (neg)
+    str[--i] = '-';
+  mrb_yabm_tm_cat(tm, str + i, (int)sizeof(str) - i);
+}
+
+/* JSON string body; line protocol keys and tags are written as is. */
+static void mrb_yabm_tm_str(mrb_yabm_tm *tm, const char *ptr, int len)
+{
+  static const char hex[] = "0123456789abcdef";
+  char esc[6];
+  int i, n;
+
+  if (tm->format != TM_JSON) {
+    mrb_yabm_tm_cat(tm, ptr, len);
+    return;
+  }
+  for (i = 0; i < len; i = n + 1) {
+    for (n = i; n < len && ptr[n] != '"' && ptr[n] != '\\' &&
+      (unsigned char)ptr[n] >= 0x20; ++n)
+      ;
+    mrb_yabm_tm_cat(tm, ptr + i, n - i);
+    if (n == len)
+      break;
+    if ((unsigned char)ptr[n] < 0x20) {
+      memcpy(esc, "\\u00", 4);
+      esc[4] = hex[ptr[n] >> 4];
+      esc[5] = hex[ptr[n] & 0xf];
+      mrb_yabm_tm_cat(tm, esc, 6);
+    } else {
+      mrb_yabm_tm_cat(tm, "\\", 1);
+      mrb_yabm_tm_cat(tm, ptr + n, 1);
+    }
+  }
+}
+
+static void mrb_yabm_tm_key(mrb_yabm_tm *tm, const char *key, int len)
+{
+  if (tm->format == TM_JSON) {
+    mrb_yabm_tm_cat(tm, ",\"", 2);
+    mrb_yabm_tm_str(tm, key, len);
+    mrb_yabm_tm_cat(tm, "\":", 2);
+  } else {
+    mrb_yabm_tm_cat(tm, tm->fields++ ? "," : " ", 1);
+    mrb_yabm_tm_cat(tm, key, len);
+    mrb_yabm_tm_cat(tm, "=", 1);
+  }
+}
+
+/*
+ * A record is begin, tags, fields, end.  Line protocol:
+ *   name,tags,key=val field=123i,field=45i time_ms
+ * JSON, one object per line:
+ *   {"name":"name","key":"val","field":123,"field":45,"time":time_ms}
+ * tags is "key=val,key=val" and may be empty.
+ */
+void mrb_yabm_tm_begin(mrb_yabm_tm *tm, mrb_yabm_buffer *buf, int format,
+  const char *name, int namelen, const char *tags, int tagslen)
+{
+  int i, n, eq;
+
+  tm->buf = buf;
+  tm->format = format;
+  tm->fields = 0;
+  tm->start = buf->fill;
+  tm->full = 0;
+  if (format != TM_JSON) {
+    mrb_yabm_tm_cat(tm, name, namelen);
+    if (tagslen > 0) {
+      mrb_yabm_tm_cat(tm, ",", 1);
+      mrb_yabm_tm_cat(tm, tags, tagslen);
+    }
+    return;
+  }
+  mrb_yabm_tm_cat(tm, "{\"name\":\"", 9);
+  mrb_yabm_tm_str(tm, name, namelen);
+  mrb_yabm_tm_cat(tm, "\"", 1);
+  for (i = 0; i < tagslen; i = n + 1) {
+    eq = -1;
+    for (n = i; n < tagslen && tags[n] != ','; ++n)
+      if (eq < 0 && tags[n] == '=')
+        eq = n;
+    if (eq < 0)
+      continue;
+    mrb_yabm_tm_key(tm, tags + i, eq - i);
+    mrb_yabm_tm_cat(tm, "\"", 1);
+    mrb_yabm_tm_str(tm, tags + eq + 1, n - eq - 1);
+    mrb_yabm_tm_cat(tm, "\"", 1);
+  }
+}
+
+/* Numeric tag such as port=1, before any field. */
+void mrb_yabm_tm_tag(mrb_yabm_tm *tm, const char *key, int val)
+{
+  if (tm->format == TM_JSON) {
+    mrb_yabm_tm_key(tm, key, strlen(key));
+  } else {
+    mrb_yabm_tm_cat(tm, ",", 1);
+    mrb_yabm_tm_cat(tm, key, strlen(key));
+    mrb_yabm_tm_cat(tm, "=", 1);
+  }
+  mrb_yabm_tm_num(tm, val < 0 ? -val : val, val < 0, 1);
+}
+
+static void mrb_yabm_tm_value(mrb_yabm_tm *tm, unsigned long val, int neg)
+{
+  mrb_yabm_tm_num(tm, val, neg, 1);
+  if (tm->format != TM_JSON)
+    mrb_yabm_tm_cat(tm, "i", 1);
+}
+
+void mrb_yabm_tm_field(mrb_yabm_tm *tm, const char *key, long val)
+{
+  mrb_yabm_tm_key(tm, key, strlen(key));
+  mrb_yabm_tm_value(tm, val < 0 ? -val : val, val < 0);
+}
+
+void mrb_yabm_tm_ufield(mrb_yabm_tm *tm, const char *key, unsigned long val)
+{
+  mrb_yabm_tm_key(tm, key, strlen(key));
+  mrb_yabm_tm_value(tm, val, 0);
+}
+
+/*
+ * sec is the epoch time, 0 for none, and ms is added to it.  Returns 1,
+ * or 0 with the partial record removed when the buffer is full.
+ */
+int mrb_yabm_tm_end(mrb_yabm_tm *tm, unsigned long sec, int ms)
+{
+  if (sec != 0) {
+    sec += ms / 1000;
+    ms %= 1000;
+    if (tm->format == TM_JSON)
+      mrb_yabm_tm_cat(tm, ",\"time\":", 8);
+    else
+      mrb_yabm_tm_cat(tm, " ", 1);
+    mrb_yabm_tm_num(tm, sec, 0, 1);
+    mrb_yabm_tm_num(tm, ms, 0, 3);
+  }
+  if (tm->format == TM_JSON)
+    mrb_yabm_tm_cat(tm, "}\n", 2);
+  else
+    mrb_yabm_tm_cat(tm, "\n", 1);
+  if (tm->full) {
+    tm->buf->fill = tm->start;
+    tm->buf->len = tm->buf->fill - tm->buf->off;
+    return 0;
+  }
+  tm->buf->len = tm->buf->fill - tm->buf->off;
+  return 1;
+}
+
+/* The destination of an encoder, which must be a Buffer. */
+mrb_yabm_buffer *mrb_yabm_tm_buffer(mrb_state *mrb, mrb_value val)
+{
+  mrb_yabm_buffer *buf;
+
+  buf = mrb_yabm_buffer_get(mrb, val);
+  if (buf == NULL)
+    mrb_raise(mrb, E_TYPE_ERROR, "YABM::Buffer expected");
+  return buf;
+}
+
+/*
+ * tmencode(buf, format, name, tags, keys, values, time = 0) appends one
+ * record and returns 1, or 0 when it does not fit.
+ */
+static mrb_value mrb_yabm_tmencode(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_tm tm;
+  mrb_value bufv, name, tags, keys, vals, key, val;
+  mrb_int format, sec = 0;
+  int i;
+  mrb_get_args(mrb, "oiSSAA|i", &bufv, &format, &name, &tags, &keys, &vals,
+    &sec);
+
+  if (RARRAY_LEN(keys) != RARRAY_LEN(vals))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "keys and values differ in size");
+  if (RARRAY_LEN(keys) == 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no fields");
+  mrb_yabm_tm_begin(&tm, mrb_yabm_tm_buffer(mrb, bufv), format,
+    RSTRING_PTR(name), RSTRING_LEN(name), RSTRING_PTR(tags), RSTRING_LEN(tags));
+  for (i = 0; i < RARRAY_LEN(keys); ++i) {
+    key = mrb_ary_ref(mrb, keys, i);
+    val = mrb_ary_ref(mrb, vals, i);
+    if (!mrb_string_p(key) || !mrb_fixnum_p(val))
+      mrb_raise(mrb, E_TYPE_ERROR, "String key and Integer value expected");
+    mrb_yabm_tm_key(&tm, RSTRING_PTR(key), RSTRING_LEN(key));
+    mrb_yabm_tm_value(&tm, mrb_fixnum(val) < 0 ? -mrb_fixnum(val) :
+      mrb_fixnum(val), mrb_fixnum(val) < 0);
+  }
+
+  return mrb_fixnum_value(mrb_yabm_tm_end(&tm, sec, 0));
+}
+
+/*
+ * tmsamples(buf, format, name, tags, key, data, width, time, step_ms)
+ * writes a record per big-endian sample of data, a String or Buffer.
+ * width is 1, 2 or 4 bytes, negative for signed samples.  Returns the
+ * number of records written.
+ */
+static mrb_value mrb_yabm_tmsamples(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_tm tm;
+  mrb_yabm_buffer *buf;
+  mrb_value bufv, name, tags, key, data;
+  mrb_int format, width, sec, step, len;
+  unsigned char *ptr;
+  unsigned long val;
+  int i, n, size, count;
+  mrb_get_args(mrb, "oiSSSoiii", &bufv, &format, &name, &tags, &key, &data,
+    &width, &sec, &step);
+
+  size = width < 0 ? -width : width;
+  if (size != 1 && size != 2 && size != 4)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid sample width");
+  buf = mrb_yabm_tm_buffer(mrb, bufv);
+  ptr = (unsigned char *)mrb_yabm_bytes(mrb, data, &len);
+  count = 0;
+  for (i = 0; i + size <= len; i += size) {
+    val = 0;
+    for (n = 0; n < size; ++n)
+      val = (val << 8) | ptr[i + n];
+    mrb_yabm_tm_begin(&tm, buf, format, RSTRING_PTR(name), RSTRING_LEN(name),
+      RSTRING_PTR(tags), RSTRING_LEN(tags));
+    mrb_yabm_tm_key(&tm, RSTRING_PTR(key), RSTRING_LEN(key));
+    if (width < 0 && (val & (1UL << (size * 8 - 1))))
+      mrb_yabm_tm_value(&tm, (~val + 1) & (0xffffffffUL >> (32 - size * 8)), 1);
+    else
+      mrb_yabm_tm_value(&tm, val, 0);
+    if (!mrb_yabm_tm_end(&tm, sec, count * step))
+      break;
+    ++count;
+  }
+
+  return mrb_fixnum_value(count);
+}
+
+void mrb_yabm_telemetry_init(mrb_state *mrb, struct RClass *yabm)
+{
+  mrb_define_const(mrb, yabm, "TM_LINE", mrb_fixnum_value(TM_LINE));
+  mrb_define_const(mrb, yabm, "TM_JSON", mrb_fixnum_value(TM_JSON));
+
+  yabm_define_method(mrb, yabm, "tmencode", mrb_yabm_tmencode, MRB_ARGS_ARG(6, 1));
+  yabm_define_method(mrb, yabm, "tmsamples", mrb_yabm_tmsamples, MRB_ARGS_REQ(9));
+}
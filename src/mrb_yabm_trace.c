@@ -0,0 +1,220 @@
+/*
+** mrb_yabm_trace.c - binary I/O event trace
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+#define	TRACE_DEFEVENTS		256
+#define	TRACE_EVSIZE		16
+#define	TRACE_HDRSIZE		20
+#define	TRACE_PKTEVENTS		((1024 - TRACE_HDRSIZE) / TRACE_EVSIZE)
+
+typedef struct {
+  unsigned int time;
+  unsigned char sub;
+  unsigned char op;
+  unsigned short seq;
+  unsigned int arg;
+  int res;
+} trace_event;
+
+static trace_event *tracebuf;
+static int tracesize;
+static int tracehead;
+static int tracecount;
+static unsigned int traceseq;
+static unsigned int tracelost;
+
+void mrb_yabm_trace(int sub, int op, unsigned int arg, int res)
+{
+  trace_event *ev;
+
+  if (tracebuf == NULL)
+    return;
+  ev = &tracebuf[tracehead];
+  ev->time = mrb_yabm_clock();
+  ev->sub = sub;
+  ev->op = op;
+  ev->seq = traceseq++;
+  ev->arg = arg;
+  ev->res = res;
+  if (++tracehead == tracesize)
+    tracehead = 0;
+  if (tracecount < tracesize)
+    ++tracecount;
+  else
+    ++tracelost;
+}
+
+static unsigned char *mrb_yabm_put32(unsigned char *ptr, unsigned int val)
+{
+  *ptr++ = val >> 24;
+  *ptr++ = val >> 16;
+  *ptr++ = val >> 8;
+  *ptr++ = val;
+  return ptr;
+}
+
+/*
+ * Dump layout, all big-endian:
+ *   "YTRC", u16 version, u16 event size, u32 count, u32 lost, u32 now
+ *   then count events of u32 time, u8 sub, u8 op, u16 seq, u32 arg, s32 res
+ * oldest first.  tools/yabm_trace.rb decodes it.
+ */
+static int mrb_yabm_trace_fill(unsigned char *ptr, int first, int count)
+{
+  trace_event *ev;
+  unsigned char *start;
+  int i, pos;
+
+  start = ptr;
+  pos = tracehead - tracecount + first;
+  if (pos < 0)
+    pos += tracesize;
+  for (i = 0; i < count; ++i) {
+    ev = &tracebuf[pos];
+    ptr = mrb_yabm_put32(ptr, ev->time);
+    *ptr++ = ev->sub;
+    *ptr++ = ev->op;
+    *ptr++ = ev->seq >> 8;
+    *ptr++ = ev->seq;
+    ptr = mrb_yabm_put32(ptr, ev->arg);
+    ptr = mrb_yabm_put32(ptr, ev->res);
+    if (++pos == tracesize)
+      pos = 0;
+  }
+  return ptr - start;
+}
+
+static void mrb_yabm_trace_header(unsigned char *ptr, int count)
+{
+  memcpy(ptr, "YTRC", 4);
+  ptr[4] = 0;
+  ptr[5] = 1;
+  ptr[6] = 0;
+  ptr[7] = TRACE_EVSIZE;
+  ptr = mrb_yabm_put32(ptr + 8, count);
+  ptr = mrb_yabm_put32(ptr, tracelost);
+  mrb_yabm_put32(ptr, mrb_yabm_clock());
+}
+
+static void mrb_yabm_trace_clear()
+{
+  tracehead = 0;
+  tracecount = 0;
+  tracelost = 0;
+}
+
+static mrb_value mrb_yabm_traceon(mrb_state *mrb, mrb_value self)
+{
+  mrb_int events = TRACE_DEFEVENTS;
+  mrb_get_args(mrb, "|i", &events);
+
+  if (events < 1)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid trace size");
+  if (tracebuf == NULL || tracesize != events) {
+    mrb_free(mrb, tracebuf);
+    tracebuf = NULL;
+    tracebuf = (trace_event *)mrb_malloc(mrb, events * sizeof(trace_event));
+    tracesize = events;
+  }
+  mrb_yabm_trace_clear();
+
+  return mrb_fixnum_value(0);
+}
+
+static mrb_value mrb_yabm_traceoff(mrb_state *mrb, mrb_value self)
+{
+  mrb_free(mrb, tracebuf);
+  tracebuf = NULL;
+  tracesize = 0;
+  mrb_yabm_trace_clear();
+
+  return mrb_fixnum_value(0);
+}
+
+static mrb_value mrb_yabm_tracedump(mrb_state *mrb, mrb_value self)
+{
+  mrb_value str;
+  mrb_bool clear = 0;
+  mrb_get_args(mrb, "|b", &clear);
+
+  str = mrb_str_new(mrb, NULL, TRACE_HDRSIZE + tracecount * TRACE_EVSIZE);
+  mrb_yabm_trace_header((unsigned char *)RSTRING_PTR(str), tracecount);
+  if (tracecount > 0)
+    mrb_yabm_trace_fill((unsigned char *)RSTRING_PTR(str) + TRACE_HDRSIZE,
+      0, tracecount);
+  if (clear)
+    mrb_yabm_trace_clear();
+
+  return str;
+}
+
+void rtl_udp_send(int addr, int port, char *buf, int len);
+
+/* Send the ring as datagrams of at most 1024 bytes without a Ruby copy. */
+static mrb_value mrb_yabm_tracesend(mrb_state *mrb, mrb_value self)
+{
+  unsigned char pkt[TRACE_HDRSIZE + TRACE_PKTEVENTS * TRACE_EVSIZE];
+  mrb_value addr;
+  mrb_int port;
+  mrb_bool clear = 0;
+  int ip, first, n, pkts;
+  mrb_get_args(mrb, "Si|b", &addr, &port, &clear);
+
+  ip = mrb_yabm_strtoip(mrb, addr);
+  first = 0;
+  pkts = 0;
+  do {
+    n = tracecount - first;
+    if (n > TRACE_PKTEVENTS)
+      n = TRACE_PKTEVENTS;
+    mrb_yabm_trace_header(pkt, n);
+    if (n > 0)
+      mrb_yabm_trace_fill(pkt + TRACE_HDRSIZE, first, n);
+    rtl_udp_send(ip, port, (char *)pkt, TRACE_HDRSIZE + n * TRACE_EVSIZE);
+    first += n;
+    ++pkts;
+  } while (first < tracecount);
+  if (clear)
+    mrb_yabm_trace_clear();
+
+  return mrb_fixnum_value(pkts);
+}
+
+void mrb_yabm_trace_init(mrb_state *mrb, struct RClass *yabm)
+{
+  mrb_define_const(mrb, yabm, "TRACE_NET", mrb_fixnum_value(TRACE_NET));
+  mrb_define_const(mrb, yabm, "TRACE_UDP", mrb_fixnum_value(TRACE_UDP));
+  mrb_define_const(mrb, yabm, "TRACE_HTTP", mrb_fixnum_value(TRACE_HTTP));
+  mrb_define_const(mrb, yabm, "TRACE_I2C", mrb_fixnum_value(TRACE_I2C));
+  mrb_define_const(mrb, yabm, "TRACE_GPIO", mrb_fixnum_value(TRACE_GPIO));
+  mrb_define_const(mrb, yabm, "TRACE_MDIO", mrb_fixnum_value(TRACE_MDIO));
+  mrb_define_const(mrb, yabm, "TRACE_UART", mrb_fixnum_value(TRACE_UART));
+  mrb_define_const(mrb, yabm, "TRACE_MQTT", mrb_fixnum_value(TRACE_MQTT));
+  mrb_define_const(mrb, yabm, "TRACE_SPI", mrb_fixnum_value(TRACE_SPI));
+  mrb_define_const(mrb, yabm, "TRACE_SNMP", mrb_fixnum_value(TRACE_SNMP));
+
+  yabm_define_method(mrb, yabm, "traceon", mrb_yabm_traceon, MRB_ARGS_OPT(1));
+  yabm_define_method(mrb, yabm, "traceoff", mrb_yabm_traceoff, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "tracedump", mrb_yabm_tracedump, MRB_ARGS_OPT(1));
+  yabm_define_method(mrb, yabm, "tracesend", mrb_yabm_tracesend, MRB_ARGS_ARG(2, 1));
+}
+
+void mrb_yabm_trace_final(mrb_state *mrb)
+{
+  mrb_free(mrb, tracebuf);
+  tracebuf = NULL;
+  tracesize = 0;
+  mrb_yabm_trace_clear();
+}
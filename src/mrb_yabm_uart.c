@@ -0,0 +1,511 @@
+/*
+** mrb_yabm_uart.c - UART receive ring
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+
+#include "mrb_yabm.h"
+
+#if !defined(YABM_NO_UART)
+
+#define	UART_PORTS		2
+#define	UART_DEFSIZE		2048
+
+#define	FRAME_MAX		256
+#define	FRAME_SLOTS		16
+
+typedef struct {
+  int mode;
+  int arg[3];
+  unsigned char cur[FRAME_MAX];
+  int len;
+  int need;
+  int skip;
+  int last;
+  unsigned char slot[FRAME_SLOTS][FRAME_MAX];
+  int slotlen[FRAME_SLOTS];
+  int head;
+  int tail;
+  int frames;
+  int errors;
+  int dropped;
+} uart_framer;
+
+typedef struct {
+  unsigned char *buf;
+  int size;
+  int head;
+  int tail;
+  int rx;
+  int overrun;
+  uart_framer *framer;
+} uart_ring;
+
+static uart_ring rings[UART_PORTS];
+
+static uart_ring *mrb_yabm_uart_port(mrb_state *mrb, mrb_int port)
+{
+  if (port < 0 || port >= UART_PORTS)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid uart port");
+  return &rings[port];
+}
+
+/* the ring of a port, allocated when it is first read or fed */
+static uart_ring *mrb_yabm_uart_ring(mrb_state *mrb, mrb_int port)
+{
+  uart_ring *ring;
+
+  ring = mrb_yabm_uart_port(mrb, port);
+  if (ring->buf == NULL) {
+    ring->buf = (unsigned char *)mrb_malloc(mrb, UART_DEFSIZE);
+    ring->size = UART_DEFSIZE;
+    ring->head = 0;
+    ring->tail = 0;
+  }
+  return ring;
+}
+
+static int mrb_yabm_uart_used(uart_ring *ring)
+{
+  int n;
+
+  n = ring->head - ring->tail;
+  if (n < 0)
+    n += ring->size;
+  return n;
+}
+
+static int mrb_yabm_hexval(int ch)
+{
+  if (ch >= '0' && ch <= '9')
+    return ch - '0';
+  if (ch >= 'A' && ch <= 'F')
+    return ch - 'A' + 10;
+  if (ch >= 'a' && ch <= 'f')
+    return ch - 'a' + 10;
+  return -1;
+}
+
+/* $...*hh sentences carry an XOR of the bytes between $ and * */
+static int mrb_yabm_nmea_ok(const unsigned char *ptr, int len)
+{
+  int i, sum, hi, lo;
+
+  if (len == 0 || (ptr[0] != '$' && ptr[0] != '!'))
+    return 1;
+  sum = 0;
+  for (i = 1; i < len && ptr[i] != '*'; ++i)
+    sum ^= ptr[i];
+  if (i + 3 != len)
+    return 0;
+  hi = mrb_yabm_hexval(ptr[i + 1]);
+  lo = mrb_yabm_hexval(ptr[i + 2]);
+  return hi >= 0 && lo >= 0 && ((hi << 4) | lo) == sum;
+}
+
+static void mrb_yabm_frame_done(uart_framer *f)
+{
+  int ok, next;
+
+  ok = 1;
+  if (f->mode == FRAME_DELIM) {
+    if (f->len > 0 && f->cur[f->len - 1] == '\r')
+      --f->len;
+    if (f->arg[1])
+      ok = mrb_yabm_nmea_ok(f->cur, f->len);
+  } else if (f->mode == FRAME_MODBUS) {
+    ok = f->len >= 4 && mrb_yabm_crc16(0xffff, f->cur, f->len) == 0;
+  }
+  if (f->skip) {
+    ++f->dropped;
+  } else if (!ok) {
+    ++f->errors;
+  } else if (f->len > 0) {
+    next = (f->head + 1) % FRAME_SLOTS;
+    if (next == f->tail) {
+      ++f->dropped;
+    } else {
+      memcpy(f->slot[f->head], f->cur, f->len);
+      f->slotlen[f->head] = f->len;
+      f->head = next;
+      ++f->frames;
+    }
+  }
+  f->len = 0;
+  f->need = 0;
+  f->skip = 0;
+}
+
+static void mrb_yabm_frame_gap(uart_framer *f, int now)
+{
+  if (f->mode == FRAME_MODBUS && f->len > 0 && now - f->last >= f->arg[0])
+    mrb_yabm_frame_done(f);
+}
+
+static void mrb_yabm_frame_byte(uart_framer *f, unsigned char ch, int now)
+{
+  int i;
+
+  mrb_yabm_frame_gap(f, now);
+  f->last = now;
+  if (f->mode == FRAME_DELIM && ch == f->arg[0]) {
+    mrb_yabm_frame_done(f);
+    return;
+  }
+  if (f->len == FRAME_MAX) {
+    /* oversize frame, discard up to the next boundary */
+    f->skip = 1;
+    f->len = 0;
+  }
+  f->cur[f->len++] = ch;
+  if (f->mode == FRAME_LENGTH && !f->skip) {
+    if (f->len == f->arg[0] + f->arg[1]) {
+      f->need = 0;
+      for (i = 0; i < f->arg[1]; ++i)
+        f->need = (f->need << 8) | f->cur[f->arg[0] + i];
+      f->need += f->arg[2];
+      if (f->need < f->len || f->need > FRAME_MAX) {
+        ++f->errors;
+        f->len = 0;
+        f->need = 0;
+        return;
+      }
+    }
+    if (f->need != 0 && f->len == f->need)
+      mrb_yabm_frame_done(f);
+  }
+}
+
+static void mrb_yabm_uart_put(uart_ring *ring, const unsigned char *ptr,
+  int len)
+{
+  int next, now;
+
+  ring->rx += len;
+  if (ring->framer) {
+    now = mrb_yabm_clock();
+    while (len--)
+      mrb_yabm_frame_byte(ring->framer, *ptr++, now);
+    return;
+  }
+  while (len--) {
+    next = ring->head + 1;
+    if (next == ring->size)
+      next = 0;
+    if (next == ring->tail) {
+      ++ring->overrun;
+    } else {
+      ring->buf[ring->head] = *ptr;
+      ring->head = next;
+    }
+    ++ptr;
+  }
+}
+
+#if defined(YABM_REALTEK)
+int getrxdata(char *buff, int len);
+#endif
+#if defined(YABM_BROADCOM) || defined(YABM_ADMTEK)
+int havech(int);
+int getch(int);
+#endif
+
+static void mrb_yabm_uart_drain(int port, uart_ring *ring)
+{
+#if defined(YABM_REALTEK)
+  char tmp[64];
+  int len;
+
+  if (port != 0)
+    return;
+  while ((len = getrxdata(tmp, sizeof(tmp))) > 0)
+    mrb_yabm_uart_put(ring, (unsigned char *)tmp, len);
+#elif defined(YABM_BROADCOM) || defined(YABM_ADMTEK)
+  unsigned char ch;
+
+  while (havech(port)) {
+    ch = getch(port);
+    mrb_yabm_uart_put(ring, &ch, 1);
+  }
+#endif
+}
+
+/*
+ * Called from every native wait point.  Returns the number of ports with
+ * a receive ring so callers can shorten their sleep slices.
+ */
+int mrb_yabm_uart_poll()
+{
+  int i, n;
+
+  n = 0;
+  for (i = 0; i < UART_PORTS; ++i) {
+    if (rings[i].buf != NULL) {
+      mrb_yabm_uart_drain(i, &rings[i]);
+      if (rings[i].framer)
+        mrb_yabm_frame_gap(rings[i].framer, mrb_yabm_clock());
+      ++n;
+    }
+  }
+  return n;
+}
+
+static mrb_value mrb_yabm_uartbuf(mrb_state *mrb, mrb_value self)
+{
+  uart_ring *ring;
+  mrb_int port, size;
+  mrb_get_args(mrb, "ii", &port, &size);
+
+  if (size < 16)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "uart buffer too small");
+  ring = mrb_yabm_uart_port(mrb, port);
+  mrb_free(mrb, ring->buf);
+  ring->buf = NULL;
+  ring->buf = (unsigned char *)mrb_malloc(mrb, size);
+  ring->size = size;
+  ring->head = 0;
+  ring->tail = 0;
+
+  return mrb_fixnum_value(0);
+}
+
+static mrb_value mrb_yabm_uart_read(mrb_state *mrb, mrb_int port,
+  mrb_value arg)
+{
+  uart_ring *ring;
+  mrb_yabm_buffer *buf;
+  mrb_value str;
+  char *ptr;
+  int len, n, max;
+
+  ring = mrb_yabm_uart_ring(mrb, port);
+  buf = mrb_yabm_buffer_get(mrb, arg);
+  if (buf != NULL)
+    max = buf->capa;
+  else if (mrb_nil_p(arg))
+    max = -1;
+  else if (mrb_integer_p(arg))
+    max = mrb_fixnum(arg);
+  else
+    mrb_raise(mrb, E_TYPE_ERROR, "Integer or YABM::Buffer expected");
+  mrb_yabm_uart_drain(port, ring);
+  len = mrb_yabm_uart_used(ring);
+  if (max >= 0 && len > max)
+    len = max;
+  if (buf != NULL) {
+    ptr = buf->ptr;
+  } else {
+    str = mrb_str_new(mrb, NULL, len);
+    ptr = RSTRING_PTR(str);
+  }
+  n = ring->size - ring->tail;
+  if (n > len)
+    n = len;
+  memcpy(ptr, ring->buf + ring->tail, n);
+  memcpy(ptr + n, ring->buf, len - n);
+  ring->tail = (ring->tail + len) % ring->size;
+  if (len)
+    mrb_yabm_trace(TRACE_UART, TRACE_OP_READ, port, len);
+  if (buf != NULL) {
+    mrb_yabm_buffer_set(buf, len);
+    return mrb_fixnum_value(len);
+  }
+
+  return str;
+}
+
+/* uartread(port, max = all) or uartread(port, buffer) */
+static mrb_value mrb_yabm_uartread(mrb_state *mrb, mrb_value self)
+{
+  mrb_value arg = mrb_nil_value();
+  mrb_int port;
+  mrb_get_args(mrb, "i|o", &port, &arg);
+
+  return mrb_yabm_uart_read(mrb, port, arg);
+}
+
+#if defined(YABM_REALTEK)
+/* readuart(buffer = nil) is uartread(0, buffer), kept for old scripts */
+static mrb_value mrb_yabm_readuart(mrb_state *mrb, mrb_value self)
+{
+  mrb_value arg = mrb_nil_value();
+  mrb_get_args(mrb, "|o", &arg);
+
+  return mrb_yabm_uart_read(mrb, 0, arg);
+}
+#endif
+
+static mrb_value mrb_yabm_uartstat(mrb_state *mrb, mrb_value self)
+{
+  uart_ring *ring;
+  mrb_value res;
+  mrb_int port;
+  mrb_get_args(mrb, "i", &port);
+
+  /* a port that was never read has no ring and nothing buffered */
+  ring = mrb_yabm_uart_port(mrb, port);
+  res = mrb_ary_new(mrb);
+  mrb_ary_push(mrb, res, mrb_fixnum_value(ring->rx));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(ring->overrun));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(mrb_yabm_uart_used(ring)));
+
+  return res;
+}
+
+/*
+ * uartframe(port, FRAME_DELIM, delim = 10, nmea_check = 0)
+ * uartframe(port, FRAME_LENGTH, offset, size, adjust)
+ *   frame length = big-endian size-byte field at offset + adjust
+ * uartframe(port, FRAME_MODBUS, gap_ms = 4)
+ * uartframe(port, FRAME_NONE)
+ */
+static mrb_value mrb_yabm_uartframe(mrb_state *mrb, mrb_value self)
+{
+  uart_ring *ring;
+  uart_framer *f;
+  mrb_int port, mode;
+  mrb_int arg[3] = {0, 0, 0};
+  int n;
+
+  n = mrb_get_args(mrb, "ii|iii", &port, &mode, &arg[0], &arg[1], &arg[2]);
+  ring = mrb_yabm_uart_ring(mrb, port);
+  if (mode == FRAME_NONE) {
+    mrb_free(mrb, ring->framer);
+    ring->framer = NULL;
+    return mrb_fixnum_value(0);
+  }
+  if (mode == FRAME_DELIM) {
+    if (n < 3)
+      arg[0] = '\n';
+  } else if (mode == FRAME_LENGTH) {
+    if (n < 5 || arg[1] < 1 || arg[1] > 2 || arg[0] < 0 ||
+      arg[0] + arg[1] > FRAME_MAX)
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid length field");
+  } else if (mode == FRAME_MODBUS) {
+    if (n < 3)
+      arg[0] = 4;
+  } else {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid frame mode");
+  }
+  if (ring->framer == NULL)
+    ring->framer = (uart_framer *)mrb_malloc(mrb, sizeof(uart_framer));
+  f = ring->framer;
+  memset(f, 0, sizeof(uart_framer));
+  f->mode = mode;
+  f->arg[0] = arg[0];
+  f->arg[1] = arg[1];
+  f->arg[2] = arg[2];
+
+  return mrb_fixnum_value(0);
+}
+
+static uart_framer *mrb_yabm_uart_framer(mrb_state *mrb, mrb_int port)
+{
+  uart_ring *ring;
+
+  ring = mrb_yabm_uart_ring(mrb, port);
+  if (ring->framer == NULL)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "uart framing not enabled");
+  mrb_yabm_uart_drain(port, ring);
+  mrb_yabm_frame_gap(ring->framer, mrb_yabm_clock());
+  return ring->framer;
+}
+
+static mrb_value mrb_yabm_uartgetframe(mrb_state *mrb, mrb_value self)
+{
+  uart_framer *f;
+  mrb_value str;
+  mrb_int port;
+  mrb_get_args(mrb, "i", &port);
+
+  f = mrb_yabm_uart_framer(mrb, port);
+  if (f->head == f->tail)
+    return mrb_nil_value();
+  str = mrb_str_new(mrb, (char *)f->slot[f->tail], f->slotlen[f->tail]);
+  f->tail = (f->tail + 1) % FRAME_SLOTS;
+
+  return str;
+}
+
+static mrb_value mrb_yabm_uartframestat(mrb_state *mrb, mrb_value self)
+{
+  uart_framer *f;
+  mrb_value res;
+  mrb_int port;
+  mrb_get_args(mrb, "i", &port);
+
+  f = mrb_yabm_uart_framer(mrb, port);
+  res = mrb_ary_new(mrb);
+  mrb_ary_push(mrb, res, mrb_fixnum_value(f->frames));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(f->errors));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(f->dropped));
+
+  return res;
+}
+
+#if defined(YABM_DUMMY)
+static mrb_value mrb_yabm_uartinject(mrb_state *mrb, mrb_value self)
+{
+  uart_ring *ring;
+  mrb_value str;
+  mrb_int port;
+  mrb_get_args(mrb, "iS", &port, &str);
+
+  ring = mrb_yabm_uart_ring(mrb, port);
+  mrb_yabm_uart_put(ring, (unsigned char *)RSTRING_PTR(str),
+    RSTRING_LEN(str));
+
+  return mrb_fixnum_value(RSTRING_LEN(str));
+}
+#endif
+
+#else
+int mrb_yabm_uart_poll()
+{
+  return 0;
+}
+#endif /* !YABM_NO_UART */
+
+void mrb_yabm_uart_init(mrb_state *mrb, struct RClass *yabm)
+{
+#if !defined(YABM_NO_UART)
+  mrb_define_const(mrb, yabm, "FRAME_NONE", mrb_fixnum_value(FRAME_NONE));
+  mrb_define_const(mrb, yabm, "FRAME_DELIM", mrb_fixnum_value(FRAME_DELIM));
+  mrb_define_const(mrb, yabm, "FRAME_LENGTH", mrb_fixnum_value(FRAME_LENGTH));
+  mrb_define_const(mrb, yabm, "FRAME_MODBUS", mrb_fixnum_value(FRAME_MODBUS));
+
+  yabm_define_method(mrb, yabm, "uartbuf", mrb_yabm_uartbuf, MRB_ARGS_REQ(2));
+  yabm_define_method(mrb, yabm, "uartread", mrb_yabm_uartread, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "uartstat", mrb_yabm_uartstat, MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "uartframe", mrb_yabm_uartframe, MRB_ARGS_ARG(2, 3));
+  yabm_define_method(mrb, yabm, "uartgetframe", mrb_yabm_uartgetframe, MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "uartframestat", mrb_yabm_uartframestat, MRB_ARGS_REQ(1));
+#if defined(YABM_REALTEK)
+  yabm_define_method(mrb, yabm, "readuart", mrb_yabm_readuart, MRB_ARGS_OPT(1));
+#endif
+#if defined(YABM_DUMMY)
+  yabm_define_method(mrb, yabm, "uartinject", mrb_yabm_uartinject, MRB_ARGS_REQ(2));
+#endif
+#endif
+}
+
+void mrb_yabm_uart_final(mrb_state *mrb)
+{
+#if !defined(YABM_NO_UART)
+  int i;
+
+  for (i = 0; i < UART_PORTS; ++i) {
+    mrb_free(mrb, rings[i].buf);
+    mrb_free(mrb, rings[i].framer);
+    memset(&rings[i], 0, sizeof(uart_ring));
+  }
+#endif
+}
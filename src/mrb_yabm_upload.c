@@ -0,0 +1,327 @@
+/*
+** mrb_yabm_upload.c - HTTP requests with a streamed body
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/data.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+#include "mruby/class.h"
+#include "mruby/error.h"
+
+#include "mrb_yabm.h"
+
+#if (defined(YABM_DUMMY) || defined(YABM_HTTP_WRITE)) && !defined(YABM_NO_HTTP)
+
+/*
+ * http_write and https_write send more of the request after the header
+ * given to *_connect, and like tcp_write return the bytes taken, which
+ * may be fewer than len, or -1.
+ */
+int http_connect(uint32_t *addr, int port, char *header, int type);
+int http_write(char *buf, int len);
+int http_read(char *buf, int len);
+void http_close();
+#if !defined(YABM_NO_HTTPS)
+int https_connect(char *host, uint32_t *addr, int port, char *header,
+  int type);
+int https_write(char *buf, int len);
+int https_read(char *buf, int len);
+void https_close();
+#else
+#define	https_connect(host, addr, port, header, type)	0
+#define	https_write(buf, len)				(-1)
+#define	https_read(buf, len)				(-1)
+#define	https_close()
+#endif
+void delay_ms(int ms);
+
+static int uptls;
+static int upstart;
+static mrb_int uptimeout;
+
+static int mrb_yabm_up_expired()
+{
+  return uptimeout > 0 && mrb_yabm_clock() - upstart >= uptimeout;
+}
+
+static int mrb_yabm_up_write(const char *ptr, int len)
+{
+  int n;
+
+  while (len > 0) {
+    n = uptls ? https_write((char *)ptr, len) : http_write((char *)ptr, len);
+    if (n < 0 || (n == 0 && mrb_yabm_up_expired()))
+      return -1;
+    if (n == 0) {
+      delay_ms(1);
+      mrb_yabm_poll();
+      continue;
+    }
+    ptr += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int mrb_yabm_up_chunk(const char *ptr, int len)
+{
+  char hex[12];
+  int i, n;
+
+  i = sizeof(hex);
+  hex[--i] = '\n';
+  hex[--i] = '\r';
+  n = len;
+  do {
+    hex[--i] = "0123456789abcdef"[n & 15];
+    n >>= 4;
+  } while (n > 0);
+  if (mrb_yabm_up_write(hex + i, sizeof(hex) - i) < 0 ||
+    mrb_yabm_up_write(ptr, len) < 0)
+    return -1;
+  return mrb_yabm_up_write("\r\n", 2);
+}
+
+static mrb_value mrb_yabm_up_next(mrb_state *mrb, mrb_value arg)
+{
+  return mrb_yield(mrb, RARRAY_PTR(arg)[0], RARRAY_PTR(arg)[1]);
+}
+
+/*
+ * Sends the body from the block until it returns nil, or until len
+ * bytes went out when len is not negative.  Each chunk is written
+ * before the block runs again, so one Buffer can be refilled.  An
+ * exception from the block is left in *exc for after the close.
+ */
+static long mrb_yabm_up_stream(mrb_state *mrb, mrb_value blk, long len,
+  mrb_value *exc)
+{
+  mrb_value chunk, arg[2];
+  mrb_bool raised;
+  mrb_int n;
+  long sent;
+  char *ptr;
+  int ai, res;
+
+  ptr = NULL;
+  for (sent = 0; len < 0 || sent < len; sent += n) {
+    ai = mrb_gc_arena_save(mrb);
+    arg[0] = blk;
+    arg[1] = mrb_fixnum_value(sent);
+    raised = 0;
+    chunk = mrb_protect(mrb, mrb_yabm_up_next,
+      mrb_ary_new_from_values(mrb, 2, arg), &raised);
+    if (raised) {
+      *exc = chunk;
+      return -1;
+    }
+    n = 0;
+    if (!mrb_nil_p(chunk))
+      ptr = mrb_yabm_bytes(mrb, chunk, &n);
+    if (n == 0) {
+      mrb_gc_arena_restore(mrb, ai);
+      break;
+    }
+    if (len >= 0 && n > len - sent)
+      n = len - sent;
+    res = len < 0 ? mrb_yabm_up_chunk(ptr, n) : mrb_yabm_up_write(ptr, n);
+    mrb_gc_arena_restore(mrb, ai);
+    if (res < 0)
+      return -1;
+  }
+  if (len < 0 && mrb_yabm_up_write("0\r\n\r\n", 5) < 0)
+    return -1;
+  return sent;
+}
+
+/* Whether a header field name is among the lines after the first. */
+static int mrb_yabm_up_field(mrb_value hdr, const char *name)
+{
+  const char *p, *end, *q;
+
+  p = RSTRING_PTR(hdr);
+  end = p + RSTRING_LEN(hdr);
+  for (; p < end; ++p) {
+    if (*p != '\n')
+      continue;
+    for (q = name, ++p; *q != '\0' && p < end; ++q, ++p)
+      if ((*p | 0x20) != (*q | 0x20))
+        break;
+    if (*q == '\0' && p < end && *p == ':')
+      return 1;
+    --p;
+  }
+  return 0;
+}
+
+/* Whether the request line asks for HTTP/1.0. */
+static int mrb_yabm_up_http10(mrb_value hdr)
+{
+  const char *p;
+  int n;
+
+  p = RSTRING_PTR(hdr);
+  for (n = 0; n < RSTRING_LEN(hdr) && p[n] != '\r' && p[n] != '\n'; ++n)
+    ;
+  return n >= 8 && memcmp(p + n - 8, "HTTP/1.0", 8) == 0;
+}
+
+static void mrb_yabm_up_length(mrb_state *mrb, mrb_value hdr, long len)
+{
+  char num[12];
+  int i;
+
+  i = sizeof(num);
+  num[--i] = '\0';
+  do {
+    num[--i] = '0' + len % 10;
+    len /= 10;
+  } while (len > 0);
+  mrb_str_cat_cstr(mrb, hdr, "Content-Length: ");
+  mrb_str_cat_cstr(mrb, hdr, num + i);
+  mrb_str_cat_cstr(mrb, hdr, "\r\n\r\n");
+}
+
+/*
+ * httpreq(addr, port, header, body = nil, timeout = 0, dst = nil,
+ *   host = nil) { |sent| chunk }
+ * sends the request line and header fields in header, then the body.
+ * body is a String or a Buffer sent in place, or the length of the
+ * body the block returns chunk by chunk.  With no body the block's
+ * chunks go out with chunked transfer encoding, ended by nil, which
+ * needs an HTTP/1.1 request.  The framing fields, Connection: close
+ * for HTTP/1.1 and the blank line are added here.  With host the
+ * request goes over https_*.  The response is returned as http does,
+ * nil on timeout or when the body could not be sent.  An exception
+ * from the block propagates after the connection is closed.
+ */
+static mrb_value mrb_yabm_httpreq(mrb_state *mrb, mrb_value self)
+{
+  mrb_yabm_buffer *buf;
+  mrb_value addr, header, hdr, res, exc;
+  mrb_value body = mrb_nil_value();
+  mrb_value dst = mrb_nil_value();
+  mrb_value host = mrb_nil_value();
+  mrb_value blk = mrb_nil_value();
+  mrb_int port, blen;
+  uint32_t ip[8];
+  char tmp[512];
+  char *ptr;
+  long len, total;
+  int n, type;
+  mrb_get_args(mrb, "SiS|oioo&", &addr, &port, &header, &body, &uptimeout,
+    &dst, &host, &blk);
+
+  ptr = NULL;
+  len = 0;
+  if (mrb_fixnum_p(body)) {
+    len = mrb_fixnum(body);
+    if (len < 0 || mrb_nil_p(blk))
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "body length needs a block");
+  } else if (!mrb_nil_p(body)) {
+    ptr = mrb_yabm_bytes(mrb, body, &blen);
+    len = blen;
+  } else if (!mrb_nil_p(blk)) {
+    len = -1;
+  }
+  uptls = !mrb_nil_p(host);
+  buf = mrb_yabm_buffer_arg(mrb, dst);
+  type = mrb_yabm_cpaddr(mrb, ip, addr);
+  if (len < 0 && mrb_yabm_up_http10(header))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "chunked body needs HTTP/1.1");
+
+  hdr = mrb_str_dup(mrb, header);
+  n = RSTRING_LEN(hdr);
+  if (n >= 4 && memcmp(RSTRING_PTR(hdr) + n - 4, "\r\n\r\n", 4) == 0)
+    mrb_str_resize(mrb, hdr, n - 2);
+  else if (n < 2 || memcmp(RSTRING_PTR(hdr) + n - 2, "\r\n", 2) != 0)
+    mrb_str_cat_cstr(mrb, hdr, "\r\n");
+  if (!mrb_yabm_up_http10(hdr) && !mrb_yabm_up_field(hdr, "Connection"))
+    mrb_str_cat_cstr(mrb, hdr, "Connection: close\r\n");
+  if (len < 0)
+    mrb_str_cat_cstr(mrb, hdr, "Transfer-Encoding: chunked\r\n\r\n");
+  else
+    mrb_yabm_up_length(mrb, hdr, len);
+
+  upstart = mrb_yabm_clock();
+  if (uptls)
+    n = https_connect(mrb_str_to_cstr(mrb, host), ip, port,
+      mrb_str_to_cstr(mrb, hdr), type);
+  else
+    n = http_connect(ip, port, mrb_str_to_cstr(mrb, hdr), type);
+  mrb_yabm_trace(TRACE_HTTP, TRACE_OP_CONNECT, port, n);
+  if (!n)
+    return mrb_nil_value();
+
+  exc = mrb_nil_value();
+  if (ptr != NULL)
+    total = mrb_yabm_up_write(ptr, len) < 0 ? -1 : len;
+  else if (!mrb_nil_p(blk))
+    total = mrb_yabm_up_stream(mrb, blk, len, &exc);
+  else
+    total = 0;
+  mrb_yabm_trace(TRACE_HTTP, TRACE_OP_WRITE, port, total);
+  if (total < 0 || (len >= 0 && total < len)) {
+    res = mrb_nil_value();
+  } else {
+    if (buf != NULL) {
+      mrb_yabm_buffer_set(buf, 0);
+      res = mrb_fixnum_value(0);
+    } else {
+      res = mrb_str_new_cstr(mrb, "");
+    }
+    total = 0;
+    while (1) {
+      if (buf != NULL && buf->fill < buf->capa) {
+        n = buf->capa - buf->fill;
+        n = uptls ? https_read(buf->ptr + buf->fill, n) :
+          http_read(buf->ptr + buf->fill, n);
+        if (n > 0)
+          mrb_yabm_buffer_set(buf, buf->fill + n);
+      } else {
+        n = uptls ? https_read(tmp, sizeof(tmp)) : http_read(tmp, sizeof(tmp));
+        if (n > 0 && buf == NULL)
+          mrb_str_cat(mrb, res, tmp, n);
+      }
+      if (n < 0)
+        break;
+      total += n;
+      if (mrb_yabm_up_expired()) {
+        mrb_yabm_trace(TRACE_HTTP, TRACE_OP_TIMEOUT, port,
+          mrb_yabm_clock() - upstart);
+        res = mrb_nil_value();
+        break;
+      }
+      if (n == 0)
+        delay_ms(1);
+      mrb_yabm_poll();
+    }
+    if (buf != NULL && !mrb_nil_p(res))
+      res = mrb_fixnum_value(total);
+  }
+  if (uptls)
+    https_close();
+  else
+    http_close();
+  mrb_yabm_trace(TRACE_HTTP, TRACE_OP_CLOSE, port,
+    mrb_nil_p(res) ? -1 : total);
+  if (!mrb_nil_p(exc))
+    mrb_exc_raise(mrb, exc);
+
+  return res;
+}
+
+#endif /* (YABM_DUMMY || YABM_HTTP_WRITE) && !YABM_NO_HTTP */
+
+void mrb_yabm_upload_init(mrb_state *mrb, struct RClass *yabm)
+{
+#if (defined(YABM_DUMMY) || defined(YABM_HTTP_WRITE)) && !defined(YABM_NO_HTTP)
+  yabm_define_method(mrb, yabm, "httpreq", mrb_yabm_httpreq,
+    MRB_ARGS_ARG(3, 4) | MRB_ARGS_BLOCK());
+#endif
+}
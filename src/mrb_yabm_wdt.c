@@ -0,0 +1,164 @@
+/*
+** mrb_yabm_wdt.c - watchdog supervisor, wait points and msleep
+**
+** Shared by the hardware and dummy builds; the watchdog_* and delay_ms
+** entry points of the dummy build live in mrb_yabm_dummy_dev.c.
+**
+** See Copyright Notice in LICENSE
+*/
+
+#include "mruby.h"
+#include "mruby/array.h"
+
+#include "mrb_yabm.h"
+
+void delay_ms(int);
+void watchdog_start(int);
+void watchdog_reset();
+void watchdog_stop();
+
+static int wdtrun;
+static int wdtfeed;
+
+/*
+ * Watchdog supervisor.  With a budget set, the native side keeps the
+ * hardware timer fed only while the script has called heartbeat within
+ * the last budget ms, so a wedged script still gets reset.
+ */
+static int wdtbudget;
+static int wdtbeat;
+static int wdtmaxgap;
+static int wdtbeats;
+static int wdtmiss;
+static int wdtlate;
+
+int mrb_yabm_poll()
+{
+  int active;
+
+  active = mrb_yabm_uart_poll();
+  active += mrb_yabm_console_poll();
+  mrb_yabm_mib_poll();
+  mrb_yabm_mqtt_poll();
+  active += mrb_yabm_snmp_poll();
+  active += mrb_yabm_gpio_poll();
+  if (wdtbudget > 0) {
+    if (mrb_yabm_clock() - wdtbeat <= wdtbudget) {
+      if (wdtrun)
+        watchdog_reset();
+    } else if (!wdtlate) {
+      /* one miss per expired window, until the next heartbeat */
+      wdtlate = 1;
+      ++wdtmiss;
+    }
+  } else if (wdtrun && wdtfeed) {
+    watchdog_reset();
+  }
+  return active;
+}
+
+static mrb_value mrb_yabm_watchdogstart(mrb_state *mrb, mrb_value self)
+{
+  mrb_int val;
+  mrb_bool feed = 0;
+  mrb_get_args(mrb, "i|b", &val, &feed);
+  watchdog_start(val);
+  wdtrun = 1;
+  wdtfeed = feed;
+
+  return mrb_fixnum_value(0);
+}
+
+static mrb_value mrb_yabm_watchdogreset(mrb_state *mrb, mrb_value self)
+{
+  watchdog_reset();
+
+  return mrb_fixnum_value(0);
+}
+
+static mrb_value mrb_yabm_watchdogstop(mrb_state *mrb, mrb_value self)
+{
+  watchdog_stop();
+  wdtrun = 0;
+
+  return mrb_fixnum_value(0);
+}
+
+static mrb_value mrb_yabm_watchdogsupervise(mrb_state *mrb, mrb_value self)
+{
+  mrb_int budget;
+  mrb_get_args(mrb, "i", &budget);
+  wdtbudget = budget;
+  wdtbeat = mrb_yabm_clock();
+  wdtlate = 0;
+
+  return mrb_fixnum_value(0);
+}
+
+static mrb_value mrb_yabm_heartbeat(mrb_state *mrb, mrb_value self)
+{
+  int now, gap;
+
+  now = mrb_yabm_clock();
+  gap = now - wdtbeat;
+  if (wdtbeats != 0 && gap > wdtmaxgap)
+    wdtmaxgap = gap;
+  wdtbeat = now;
+  wdtlate = 0;
+  ++wdtbeats;
+  if (wdtrun)
+    watchdog_reset();
+
+  return mrb_fixnum_value(gap);
+}
+
+static mrb_value mrb_yabm_watchdogstat(mrb_state *mrb, mrb_value self)
+{
+  mrb_value res;
+  mrb_bool clear = 0;
+  mrb_get_args(mrb, "|b", &clear);
+
+  res = mrb_ary_new(mrb);
+  mrb_ary_push(mrb, res, mrb_fixnum_value(wdtmaxgap));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(wdtbeats));
+  mrb_ary_push(mrb, res, mrb_fixnum_value(wdtmiss));
+  if (clear) {
+    wdtmaxgap = 0;
+    wdtbeats = 0;
+    wdtmiss = 0;
+  }
+
+  return res;
+}
+
+static mrb_value mrb_yabm_msleep(mrb_state *mrb, mrb_value self)
+{
+  mrb_int val;
+  int n, slice, start;
+  mrb_get_args(mrb, "i", &val);
+  slice = mrb_yabm_poll() ? 1 : 100;
+  start = mrb_yabm_clock();
+  for (;;) {
+    mrb_yabm_gc_idle(mrb);
+    n = val - (mrb_yabm_clock() - start);
+    if (n <= 0)
+      break;
+    if (n > slice)
+      n = slice;
+    delay_ms(n);
+    mrb_yabm_poll();
+  }
+
+  return mrb_fixnum_value(0);
+}
+
+void mrb_yabm_wdt_init(mrb_state *mrb, struct RClass *yabm)
+{
+  yabm_define_method(mrb, yabm, "watchdogstart", mrb_yabm_watchdogstart, MRB_ARGS_ARG(1, 1));
+  yabm_define_method(mrb, yabm, "watchdogreset", mrb_yabm_watchdogreset, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "watchdogstop", mrb_yabm_watchdogstop, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "watchdogsupervise", mrb_yabm_watchdogsupervise, MRB_ARGS_REQ(1));
+  yabm_define_method(mrb, yabm, "heartbeat", mrb_yabm_heartbeat, MRB_ARGS_NONE());
+  yabm_define_method(mrb, yabm, "watchdogstat", mrb_yabm_watchdogstat, MRB_ARGS_OPT(1));
+  yabm_define_method(mrb, yabm, "msleep", mrb_yabm_msleep, MRB_ARGS_REQ(1));
+}
@@ -0,0 +1,447 @@
+##
+## YABM Test (yabm-dummy build)
+##
+
+assert("YABM#getarch") do
+  t = YABM.new
+  assert_equal(YABM::MODULE_DUMMY, t.getarch)
+end
+
+assert("YABM#buildinfo") do
+  t = YABM.new
+  assert_equal(0x100, YABM::MIB_IN)
+  assert_raise(NameError) { YABM::MIB_NONE }
+  assert_true(YABM.const_defined?(:MODULE_KS8695))
+  assert_equal(9, YABM::MODULE_KS8695)
+  info = t.buildinfo
+  assert_true(info[0].include?("mib"))
+  assert_true(info[2] > 0)
+end
+
+assert("YABM#watchdogsupervise") do
+  t = YABM.new
+  t.watchdogstat(true)
+  t.watchdogsupervise(20)
+  t.heartbeat
+  t.msleep(250)
+  t.heartbeat
+  assert_equal(1, t.watchdogstat(true)[2])
+  t.watchdogsupervise(0)
+end
+
+assert("YABM#getaddress") do
+  t = YABM.new
+  t.netstart("192.168.0.105", "255.255.255.0", "192.168.0.1", "192.168.0.1")
+  assert_equal("192.168.0.105", t.getaddress)
+end
+
+assert("YABM#uartread") do
+  t = YABM.new
+  t.uartinject(0, "ab\0cd")
+  assert_equal("ab\0cd", t.uartread(0))
+  assert_equal("", t.uartread(0))
+  assert_equal([0, 0, 0], t.uartstat(1))
+end
+
+assert("YABM#uartgetframe") do
+  t = YABM.new
+  t.uartframe(0, YABM::FRAME_DELIM, 10, 1)
+  t.uartinject(0, "$GPX,1*52\r\n$GPX,1*00\r\nno checksum\n")
+  assert_equal("$GPX,1*52", t.uartgetframe(0))
+  assert_equal("no checksum", t.uartgetframe(0))
+  assert_nil(t.uartgetframe(0))
+  assert_equal([2, 1, 0], t.uartframestat(0))
+  t.uartframe(0, YABM::FRAME_NONE)
+end
+
+assert("YABM#tracedump") do
+  t = YABM.new
+  t.traceon(8)
+  d = t.tracedump(true)
+  assert_equal("YTRC", d[0, 4])
+  t.traceoff
+end
+
+assert("YABM#i2csim") do
+  t = YABM.new
+  t.i2csim(0x76, "\x00" * 0xd0 + "\x60")
+  assert_equal(1, t.i2cchk(0x76))
+  assert_equal(0, t.i2cchk(0x77))
+  assert_equal(0x60, t.i2cread(0x76, 1, 0xd0))
+  assert_equal(3, t.i2cwrite(0x76, [0xf4, 0x27, 0xa0]))
+  assert_equal([0x27, 0xa0], t.i2cread(0x76, 2, 0xf4))
+  assert_equal("\x27", t.i2csimregs(0x76)[0xf4])
+end
+
+assert("YABM#gpiosimlog") do
+  t = YABM.new
+  t.gpiosimlog(true)
+  t.gpiosetdir(0xf0)
+  t.gpiosetdat(0xff)
+  t.gpiosimin(0x05, 0x0f)
+  assert_equal(0xf5, t.gpiogetdat)
+  assert_equal(["dir", "dat"], t.gpiosimlog(true).map { |w| w[1] })
+end
+
+assert("YABM#crc32") do
+  t = YABM.new
+  assert_equal(0xcbf43926, t.crc32("123456789"))
+  assert_equal(0xcbf43926, t.crc32("56789", t.crc32("1234")))
+  assert_equal(0x4b37, t.crc16("123456789"))
+  assert_equal(0, t.crc16("\x01\x03\x00\x00\x00\x01\x84\x0a"))
+  hdr = "\x45\x00\x00\x73\x00\x00\x40\x00\x40\x11\x00\x00\xc0\xa8\x00\x01\xc0\xa8\x00\xc7"
+  assert_equal(0xb861, t.cksum(hdr) ^ 0xffff)
+  assert_equal(0xb861, t.cksum(hdr[10, 10], t.cksum(hdr[0, 10])) ^ 0xffff)
+end
+
+assert("YABM#sha256") do
+  t = YABM.new
+  assert_equal("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+    t.hexenc(t.sha256("abc")))
+  b = YABM::Buffer.new
+  b.append("abc")
+  assert_equal(t.sha256("abc"), t.dlverify(b, 3))
+  assert_nil(t.download("127.0.0.1", 1, "/10", b))
+  assert_nil(t.download("0000:0000:0000:0000:0000:0000:0000:0001", 1, "/10", b))
+  assert_raise(TypeError) { t.download("127.0.0.1", 1, "/10", 5) }
+  b.release
+end
+
+assert("YABM#httpreq") do
+  t = YABM.new
+  assert_raise(ArgumentError) { t.httpreq("127.0.0.1", 1, "PUT / HTTP/1.0\r\n", 10) }
+  assert_nil(t.httpreq("127.0.0.1", 1, "PUT / HTTP/1.0\r\n", "x"))
+  assert_nil(t.httpreq("127.0.0.1", 1, "PUT / HTTP/1.0", "x"))
+  assert_raise(ArgumentError) { t.httpreq("127.0.0.1", 1, "POST / HTTP/1.0\r\n") { nil } }
+  assert_raise(ArgumentError) { t.httpreq("127.0.0.1", 1, "POST / HTTP/1.1\r\n", -1) { nil } }
+  assert_nil(t.httpreq("127.0.0.1", 1, "POST / HTTP/1.1\r\n") { nil })
+  assert_nil(t.httpreq("127.0.0.1", 1, "POST / HTTP/1.1\r\n", 3, 100) { "abc" })
+end
+
+assert("YABM#b64enc") do
+  t = YABM.new
+  assert_equal("00ff1a", t.hexenc("\x00\xff\x1a"))
+  assert_equal("\x00\xff\x1a", t.hexdec("00FF1a"))
+  assert_nil(t.hexdec("0g"))
+  assert_equal("Zm9vYg==", t.b64enc("foob"))
+  assert_equal("foobar", t.b64dec("Zm9v\r\nYmFy"))
+  assert_nil(t.b64dec("Zm9v!"))
+  b = YABM::Buffer.new
+  b.append("\x00\xff\x1a")
+  assert_equal(6, t.hexenc(b, b))
+  assert_equal("00ff1a", b.to_s)
+  b.clear
+  b.append("xxfoob")
+  b.view(2)
+  assert_equal(8, t.b64enc(b, b))
+  assert_equal("Zm9vYg==", b.to_s)
+  b.release
+end
+
+assert("YABM#gpioevents") do
+  t = YABM.new
+  t.gpiosimin(0, 0x10)
+  assert_equal(0, t.gpiowatch(0x10, 0, 2))
+  t.gpiosimin(0x10, 0x10)
+  ev = t.gpioevents(100)
+  assert_equal([[4, 1]], ev.map { |e| e[1, 2] })
+  assert_equal(1, t.gpiopulses(4))
+  t.gpiosimin(0, 0x10)
+  t.gpiopulses(4)
+  t.gpiosimin(0x10, 0x10)
+  t.msleep(5)
+  assert_equal([], t.gpioevents)
+  assert_equal(1, t.gpiopulses(4, true))
+  t.gpiosimin(0, 0x20)
+  t.gpiodebounce(5, 200)
+  t.gpiowatch(0x20, 0, 2)
+  t.gpiosimin(0x20, 0x20)
+  assert_equal([], t.gpioevents + t.gpioevents + t.gpioevents)
+  t.gpiowatch(0)
+end
+
+assert("YABM#spixfer") do
+  t = YABM.new
+  t.gpiosimin(0x04, 0x04)
+  t.spiinit(0, 1, 2, 3, 0)
+  t.gpiosimlog(true)
+  assert_equal("\xff\xff", t.spixfer("\xa5\x00"))
+  log = t.gpiosimlog(true)
+  assert_equal(0, log[0][2] & 0x08)
+  assert_equal(0x08, log[-1][2] & 0x08)
+  assert_equal(0x03, log[2][2] & 0x03)
+  t.gpiosimin(0, 0x04)
+  assert_equal(1, t.spiwrite("\x00"))
+end
+
+assert("YABM#spixfer modes") do
+  t = YABM.new
+  t.gpiosimloop(1, 2)
+  4.times do |mode|
+    t.spiinit(0, 1, 2, 3, mode)
+    t.gpiosimlog(true)
+    assert_equal("\xa5\x3c", t.spixfer("\xa5\x3c"))
+    assert_equal(mode >> 1, t.gpiosimlog(true)[-1][2] & 0x01)
+  end
+  t.gpiosimloop(-1, 2)
+end
+
+assert("YABM#getmib") do
+  t = YABM.new
+  t.mibsimset(1, YABM::MIB_IN, YABM::MIB_IFINOCTETS, 0xffffffff)
+  assert_equal(0xffffffff, t.getmib(1, YABM::MIB_IN, YABM::MIB_IFINOCTETS))
+  t.mibsim(1, YABM::MIB_IN, 1_000_000, 1000)
+  t.msleep(20)
+  assert_true(t.getmib(1, YABM::MIB_IN, YABM::MIB_IFINOCTETS) < 0xffffffff)
+  t.mibsim(1, YABM::MIB_IN, 0, 0)
+end
+
+assert("YABM#regrun") do
+  t = YABM.new
+  t.regsim(0xb8000010, 0x1234)
+  assert_equal(0x1234, t.regmodify(0xb8000010, 0xff00, 0xab00))
+  assert_equal([0xab34, 0], t.regread(0xb8000010, 2))
+  assert_raise(ArgumentError) { t.regread(0xb8000012) }
+  s = t.regcompile([[YABM::REG_WRITE, 0xb8000020, 5],
+    [YABM::REG_WAIT, 0xb8000024, 1, 1, 2], [YABM::REG_READ, 0xb8000020]])
+  assert_equal([nil], t.regrun(s))
+  t.regsim(0xb8000024, 1)
+  assert_equal(5, t.regrun(s)[-1])
+  t.regsim(0xb8000028, 0x80, 2)
+  assert_nil(t.regwait(0xb8000028, 0x80, 0x80, 0))
+  assert_true(t.regwait(0xb8000028, 0x80, 0x80, 100) > 0)
+  t.regsim(0xfffffffc, 0xdeadbeef)
+  assert_equal(0xdeadbeef, t.regmodify(0xfffffffc, 0xffffffff, 0x80000001))
+  assert_equal(0x80000001, t.regread(0xfffffffc))
+  start = t.count
+  t.regrun(t.regcompile([[YABM::REG_DELAY, 20]]))
+  assert_true(t.count - start >= 19)
+end
+
+assert("YABM#fxstats") do
+  t = YABM.new
+  d = [5, 1, 9, 3, 7, 2, 8, 4, 6, 10]
+  assert_equal([10, 1, 10, 6, 3], t.fxstats(d))
+  assert_equal([-2, 16], t.fxstats("\xff\xfe\x00\x10", -2)[1, 2])
+  assert_equal(3300, t.fxscale(4095, 3300 * 65536 / 4095, 16))
+  assert_equal([-92, -98], t.fxscale(d, 3, 1, -100)[0, 2])
+  assert_equal(5, t.fxpoly(4, [98304, 16384, 8192], 16))
+  assert_equal([1, 5, 10], t.fxpercentile(d, [0, 50, 100]))
+  assert_equal([5, 4, 6], t.fxdecimate(d, 3))
+  assert_equal([5, 3, 5, 4], t.fxmovavg(d, 3)[0, 4])
+  assert_raise(ArgumentError) { t.fxstats("\x00", 3) }
+  cal = [27504, 26435, -1000, 36477, -10685, 3024, 2855, 140, -7, 15500,
+    -14600, 6000].map { |v| [v & 0xff, (v >> 8) & 0xff] }.flatten
+  cal += [0, 75, 0x6a, 0x01, 0, 0x13, 0x2f, 0x03, 0x1e]
+  raw = [0x65, 0x5a, 0xc0, 0x7e, 0xed, 0x00, 0x6d, 0x60]
+  assert_equal([2508, 100653, 41713], t.bme280(cal, raw))
+  bursts = raw.pack("C*") * 2
+  assert_equal([[2508, 100653, 41713]] * 2, t.bme280(cal, bursts))
+  assert_raise(ArgumentError) { t.bme280(cal, bursts[0, 12]) }
+  assert_equal([4294967295], t.fxscale("\xff\xff\xff\xff", 1, 0, 0, 4))
+end
+
+assert("YABM#linkevents") do
+  t = YABM.new
+  assert_equal([0x3100, 0x782d], t.mdiodump(2, 0, 2))
+  assert_equal([[2, 1, 100, 1]], t.linkwatch(0x04))
+  assert_equal([], t.linkevents)
+  t.mdiosim(2, 1, 0x7809)
+  t.mdiosim(2, 0, 0x0000)
+  assert_equal([2, 0, 0, 0], t.linkevents[0][0, 4])
+  t.mdiosim(2, 1, 0x782d)
+  assert_equal([2, 1, 10, 0], t.linkevents[0][0, 4])
+  t.mdiosim(2, 1, 0x780d)
+  assert_equal([2, 1, 10, 0], t.linkevents[0][0, 4])
+  t.mdiosim(2, 1, 0x782d)
+  t.mdiosim(2, 0, 0x3100)
+  t.linkwatch(0)
+  assert_raise(ArgumentError) { t.linkwatch(0x100) }
+end
+
+assert("YABM#tmencode") do
+  t = YABM.new
+  b = YABM::Buffer.new
+  assert_equal(1, t.tmencode(b, YABM::TM_LINE, "env", "host=sw1", ["temp", "hum"], [-5, 40], 1700000000))
+  assert_equal("env,host=sw1 temp=-5i,hum=40i 1700000000000\n", b.to_s)
+  b.clear
+  assert_equal(2, t.tmsamples(b, YABM::TM_JSON, "adc", "", "v", "\xff\xfe\x00\x10", -2, 1700000000, 500))
+  assert_equal("{\"name\":\"adc\",\"v\":-2,\"time\":1700000000000}\n" +
+    "{\"name\":\"adc\",\"v\":16,\"time\":1700000000500}\n", b.to_s)
+  b.clear
+  t.mibsimset(1, YABM::MIB_IN, YABM::MIB_IFINOCTETS, 1234)
+  assert_equal(1, t.mibencode(b, YABM::TM_LINE, "port", 0x02))
+  assert_true(b.to_s.start_with?("port,port=1 in_octets=1234i,"))
+  b.clear
+  assert_equal(1, t.tmencode(b, YABM::TM_JSON, "a\tb", "", ["v"], [1]))
+  assert_equal("{\"name\":\"a\\u0009b\",\"v\":1}\n", b.to_s)
+  assert_raise(ArgumentError) { t.tmencode(b, YABM::TM_LINE, "env", "", [], []) }
+  b.release
+end
+
+assert("YABM#mqttpublish") do
+  t = YABM.new
+  assert_nil(t.mqttpublish("a/b", "x"))
+  id = t.mqttpublish("a/b", "x", 1)
+  assert_true(id > 0)
+  assert_equal([YABM::MQTT_CLOSED, 0, 1], t.mqttstat[0, 3])
+  t.mqttdisconnect
+  assert_equal(0, t.mqttstat[2])
+  assert_equal(-1, t.mqttconnect("127.0.0.1", 1, "test"))
+end
+
+assert("YABM#mqttconnect loopback") do
+  t = YABM.new
+  t.mqttsim(18830)
+  assert_equal(0, t.mqttconnect("127.0.0.1", 18830, "test", 1))
+  assert_true(t.mqttpublish("a/b", "x", 1) > 0)
+  t.msleep(20)
+  assert_equal(0, t.mqttstat[2])
+  # QoS 0 traffic alone must not keep the broker from answering pings
+  17.times do
+    t.mqttpublish("a/b", "x")
+    t.msleep(100)
+  end
+  assert_equal(YABM::MQTT_CONNECTED, t.mqttstat[0])
+  assert_true(t.mqttsimstat[0] > 0)
+  assert_equal(1, t.mqttsimstat[1])
+  t.mqttdisconnect
+  t.mqttsim(0)
+end
+
+assert("YABM#snmpstart") do
+  t = YABM.new
+  get = "\x30\x26\x02\x01\x01\x04\x06public\xa0\x19\x02\x01\x01\x02\x01\x00" +
+    "\x02\x01\x00\x30\x0e\x30\x0c\x06\x08\x2b\x06\x01\x02\x01\x02\x01\x00\x05\x00"
+  t.snmpstart(16161)
+  t.udpinit
+  t.udpsend("127.0.0.1", 16161, get, get.size)
+  res = ""
+  10.times { res = t.udprecv if res.empty?; t.msleep(10) }
+  assert_equal(0xa2, res.getbyte(13))
+  assert_true(res.end_with?("\x02\x01\x05"))
+  get[35] = "\x01"
+  get[36] = "\x05"
+  t.udpsend("127.0.0.1", 16161, get, get.size)
+  req = t.snmprecv(100)
+  assert_equal(get, req[2])
+  assert_equal([2, 1, 1, 0, 0], t.snmpstat)
+  t.snmpstart(16161, "public", 5, false)
+  get[35] = "\x02"
+  get[36] = "\x01"
+  get[37] = "\x01"
+  t.udpsend("127.0.0.1", 16161, get, get.size)
+  res = ""
+  10.times { res = t.udprecv if res.empty?; t.msleep(10) }
+  assert_true(res.end_with?("\x81\x00"))
+  t.snmpstop
+end
+
+assert("YABM#lookup deadline") do
+  t = YABM.new
+  start = t.count
+  assert_nil(t.lookup("dead.invalid", 200))
+  assert_nil(t.lookup6("dead.invalid", 200))
+  assert_true(t.count - start < 1000)
+  assert_equal("127.0.0.1", t.lookup("localhost", 1000))
+end
+
+assert("YABM#printbuf") do
+  t = YABM.new
+  assert_raise(ArgumentError) { t.printbuf(8, 2) }
+  t.printbuf(8, YABM::PRINT_DROP)
+  _, dropped, written = t.printstat
+  t.print(".........\n")
+  assert_equal([8, dropped + 2, written], t.printstat)
+  t.printflush
+  assert_equal([0, dropped + 2, written + 8], t.printstat)
+  t.printbuf(8, YABM::PRINT_BLOCK)
+  t.print(".........\n")
+  assert_equal([2, dropped + 2, written + 16], t.printstat)
+  t.printbuf(0)
+  assert_equal([0, dropped + 2, written + 18], t.printstat)
+  t.print("\n")
+  assert_equal([0, dropped + 2, written + 19], t.printstat)
+end
+
+assert("YABM#kvput") do
+  t = YABM.new
+  t.kvformat
+  assert_nil(t.kvget("a"))
+  assert_equal(1, t.kvput("a", "hello"))
+  assert_equal(1, t.kvput("b", "x" * 100))
+  assert_equal(1, t.kvput("a", "again"))
+  assert_equal("again", t.kvget("a"))
+  assert_equal(1, t.kvdel("b"))
+  assert_equal(["a"], t.kvkeys)
+  200.times { |i| t.kvput("n", i.to_s * 50) }
+  assert_equal("199" * 50, t.kvget("n"))
+  assert_true(t.kvstat[5] > 0)
+  assert_raise(ArgumentError) { t.kvput("a", "x" * 513) }
+  t.kvformat
+end
+
+assert("YABM#kvdel on a full store") do
+  t = YABM.new
+  t.kvformat
+  i = 0
+  i += 1 while t.kvput("k#{i}", "x" * 500) == 1
+  assert_equal(0, t.kvput("k#{i}", "x" * 500))
+  assert_equal(1, t.kvdel("k0"))
+  assert_equal(1, t.kvput("new", "y" * 500))
+  assert_equal(1, t.kvput("k1", "z" * 500))
+  assert_equal("y" * 500, t.kvget("new"))
+  assert_equal("z" * 500, t.kvget("k1"))
+  assert_nil(t.kvget("k0"))
+  t.kvformat
+end
+
+assert("YABM#gcstat") do
+  t = YABM.new
+  t.gcfull
+  s = t.gcstat(true)
+  assert_equal(12, s.size)
+  assert_true(s[1] >= s[0])
+  assert_equal(1, s[9])
+  t.gcidle(500)
+  a = []
+  until (g = t.gcstat)[0] * 2 >= g[2] + g[3]
+    100.times { a << "x" * 64 }
+  end
+  t.msleep(5)
+  t.gcidle(0)
+  s = t.gcstat
+  assert_true(s[6] > 0)
+  assert_equal(0, s[9])
+end
+
+assert("YABM#gcidle defer") do
+  t = YABM.new
+  t.gcidle(500, true)
+  live = t.gcstat[0]
+  5000.times { "x" * 8 }
+  assert_true(t.gcstat[0] < live + 5000)
+  t.gcidle(0)
+end
+
+assert("YABM::Buffer") do
+  t = YABM.new
+  b = YABM::Buffer.new
+  t.uartinject(0, "GET /x HTTP/1.0\r\n\r\n")
+  assert_equal(19, t.uartread(0, b))
+  assert_equal(19, b.len)
+  assert_true(b.match?("GET "))
+  assert_equal(4, b.index("/x"))
+  b.view(4, 2)
+  assert_equal("/x", b.to_s)
+  assert_equal(0x78, b.getbyte(1))
+  b.reset
+  assert_equal(19, b.len)
+  b.clear
+  assert_equal(3, b.append("abc"))
+  free = YABM::Buffer.stat[2]
+  b.release
+  assert_equal(free + 1, YABM::Buffer.stat[2])
+  (YABM::Buffer.stat[0] + 2).times { YABM::Buffer.new }
+  assert_raise(ArgumentError) { YABM::Buffer.pool(0x10000, 0x10000) }
+end
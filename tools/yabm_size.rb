@@ -0,0 +1,44 @@
+#!/usr/bin/env ruby
+#
+# yabm_size.rb - size and startup report per build configuration
+#
+#   ruby tools/yabm_size.rb mruby/build/yabm-dummy mruby/build/yabm-dummy-min
+#
+# Sums text, data and bss of the mruby-yabm objects in each build
+# directory (SIZE selects a cross size, e.g. mips-elf-size), and when the
+# build has bin/mruby prints what YABM#buildinfo reports.
+#
+# See Copyright Notice in LICENSE
+
+SIZE = ENV['SIZE'] || 'size'
+
+def objsize(objs)
+  total = [0, 0, 0]
+  objs.each do |o|
+    IO.popen([SIZE, o], &:readlines).drop(1).each do |line|
+      total = total.zip(line.split[0, 3].map(&:to_i)).map(&:sum)
+    end
+  end
+  total
+end
+
+def buildinfo(dir)
+  mruby = File.join(dir, 'bin', 'mruby')
+  return nil unless File.executable?(mruby)
+  out = IO.popen([mruby, '-e', 'p YABM.new.buildinfo'], &:read)
+  out.empty? ? nil : out.strip
+end
+
+abort "usage: #{$0} build_dir ..." if ARGV.empty?
+ARGV.each do |dir|
+  objs = Dir.glob(File.join(dir, 'mrbgems', 'mruby-yabm', '**', '*.o'))
+  if objs.empty?
+    warn "#{dir}: no mruby-yabm objects"
+    next
+  end
+  text, data, bss = objsize(objs)
+  printf("%-32s text %7d data %6d bss %7d total %7d\n",
+         File.basename(dir), text, data, bss, text + data + bss)
+  info = buildinfo(dir)
+  puts "#{' ' * 32} [subsystems, init ms, constants] #{info}" if info
+end
@@ -0,0 +1,54 @@
+#!/usr/bin/env ruby
+#
+# yabm_trace.rb - decode YABM#tracedump / YABM#tracesend output
+#
+#   ruby tools/yabm_trace.rb dump.bin ...      decode saved dumps
+#   ruby tools/yabm_trace.rb -u 5000            listen for tracesend packets
+#   add -c for CSV output
+#
+# See Copyright Notice in LICENSE
+
+require 'socket'
+
+SUBSYSTEMS = %w(- net udp http i2c gpio mdio uart mqtt spi snmp)
+OPERATIONS = %w(- start bind send recv connect close read write lookup sntp
+                setdir setctl timeout probe)
+
+def decode(blob, csv, out = $stdout)
+  while blob.bytesize >= 20
+    magic, ver, evsize, count, lost, now = blob.unpack('a4nnNNN')
+    raise "bad trace magic #{magic.inspect}" unless magic == 'YTRC'
+    raise "unsupported trace version #{ver}" unless ver == 1
+    unless csv
+      out.puts "# #{count} events, #{lost} lost, device clock #{now} ms"
+    end
+    count.times do |i|
+      ev = blob.byteslice(20 + i * evsize, evsize)
+      break if ev.nil? || ev.bytesize < 16
+      time, sub, op, seq, arg, res = ev.unpack('NCCnNl>')
+      sname = SUBSYSTEMS[sub] || sub.to_s
+      oname = OPERATIONS[op] || op.to_s
+      if csv
+        out.puts [time, seq, sname, oname, arg, res].join(',')
+      else
+        out.printf("%10d %5d %-5s %-8s arg=0x%08x res=%d\n",
+                   time, seq, sname, oname, arg, res)
+      end
+    end
+    blob = blob.byteslice(20 + count * evsize..-1) || ''
+  end
+end
+
+csv = ARGV.delete('-c')
+puts 'time,seq,subsystem,op,arg,res' if csv
+if ARGV[0] == '-u'
+  sock = UDPSocket.new
+  sock.bind('0.0.0.0', Integer(ARGV[1]))
+  loop do
+    decode(sock.recvfrom(65536)[0], csv)
+    $stdout.flush
+  end
+else
+  ARGF.binmode
+  decode(ARGF.read, csv)
+end